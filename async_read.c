@@ -0,0 +1,593 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
+#include "async_read.h"
+
+#define BUF_FREE    0   /* Buffer is not in use                              */
+#define BUF_QUEUED  1   /* Buffer has a read queued or in flight             */
+#define BUF_READY   2   /* Buffer's read is done                             */
+
+/** @defgroup async_read async_read
+ *
+ *  Asynchronous read ahead.
+ *
+ *  An async read keeps a few chunk sized reads of a file in flight ahead of
+ *  the thread taking the chunks, so a file that is not in the page cache does
+ *  not stall it on every read.  The reads are submitted to an io_uring, set
+ *  up with the raw system calls, or when that is not there, made by a reader
+ *  thread.  The buffers, offsets and sizes are all aligned so the file may be
+ *  opened with O_DIRECT.
+ */
+
+/** Private method that adds a read's result to its buffer.
+ *  A short read is followed up with a read of the rest of the chunk, unless
+ *  it was at the end of the file.  With O_DIRECT only the end of the file
+ *  gives a short read, and the rest could not be read anyway, it is not
+ *  aligned.
+ *
+ *  @param[in] ar   The async read structure.
+ *  @param[in] buf  The buffer.
+ *  @param[in] res  The read's result, bytes read or a negative errno.
+ *
+ *  @return         Returns 1 if the rest of the chunk still has to be read.
+ */
+static int async_read_result(async_read *ar, async_read_buf *buf,
+                             ssize_t res) {
+    if (res < 0) {
+        buf->error = -res;
+        return 0;
+    }
+    buf->filled += res;
+
+    return res > 0 && buf->filled < ar->chunk &&
+           !(ar->flags & ASYNC_READ_DIRECT);
+}
+
+
+#ifdef __NR_io_uring_setup
+/** Private method that sets up the io_uring.
+ *
+ *  @param[in] ar   The async read structure.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int async_read_uring_init(async_read *ar) {
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(struct io_uring_params));
+    ar->ring_fd = syscall(__NR_io_uring_setup, ar->depth, &params);
+    if (ar->ring_fd < 0) {
+        ar->ring_fd = -1;
+        return ASYNC_READ_E_SYSTEM;
+    }
+
+    /* Map the rings, newer kernels map both with one call */
+    ar->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ar->cq_size = params.cq_off.cqes +
+                  params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ar->cq_size > ar->sq_size) {
+            ar->sq_size = ar->cq_size;
+        }
+        ar->cq_size = 0;
+    }
+    ar->sq_ptr = mmap(NULL, ar->sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ar->ring_fd,
+                      IORING_OFF_SQ_RING);
+    if (ar->sq_ptr == MAP_FAILED) {
+        ar->sq_ptr = NULL;
+        return ASYNC_READ_E_SYSTEM;
+    }
+    ar->cq_ptr = ar->sq_ptr;
+    if (ar->cq_size > 0) {
+        ar->cq_ptr = mmap(NULL, ar->cq_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ar->ring_fd,
+                          IORING_OFF_CQ_RING);
+        if (ar->cq_ptr == MAP_FAILED) {
+            ar->cq_ptr = NULL;
+            return ASYNC_READ_E_SYSTEM;
+        }
+    }
+    ar->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ar->sqes = mmap(NULL, ar->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ar->ring_fd, IORING_OFF_SQES);
+    if (ar->sqes == MAP_FAILED) {
+        ar->sqes = NULL;
+        return ASYNC_READ_E_SYSTEM;
+    }
+
+    ar->sq_head = (unsigned *)((char *)ar->sq_ptr + params.sq_off.head);
+    ar->sq_tail = (unsigned *)((char *)ar->sq_ptr + params.sq_off.tail);
+    ar->sq_mask = (unsigned *)((char *)ar->sq_ptr + params.sq_off.ring_mask);
+    ar->sq_array = (unsigned *)((char *)ar->sq_ptr + params.sq_off.array);
+    ar->cq_head = (unsigned *)((char *)ar->cq_ptr + params.cq_off.head);
+    ar->cq_tail = (unsigned *)((char *)ar->cq_ptr + params.cq_off.tail);
+    ar->cq_mask = (unsigned *)((char *)ar->cq_ptr + params.cq_off.ring_mask);
+    ar->cqes = (char *)ar->cq_ptr + params.cq_off.cqes;
+
+    return 0;
+}
+
+
+/** Private method that submits a read to the io_uring.
+ *  Reads the rest of the buffer's chunk.  Each buffer has at most one read in
+ *  flight, so the ring always has room.  If the read can not be submitted
+ *  the buffer is handed over with the error, so nothing waits on it.
+ *
+ *  @param[in] ar   The async read structure.
+ *  @param[in] i    The buffer.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int async_read_submit(async_read *ar, int i) {
+    async_read_buf *buf = &(ar->bufs[i]);
+    struct io_uring_sqe *sqe;
+    unsigned tail;
+    unsigned idx;
+    int retval;
+
+    buf->iov.iov_base = buf->data + buf->filled;
+    buf->iov.iov_len = ar->chunk - buf->filled;
+
+    /* Fill in the next entry, then publish it */
+    tail = *(ar->sq_tail);
+    idx = tail & *(ar->sq_mask);
+    sqe = (struct io_uring_sqe *)ar->sqes + idx;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = ar->fd;
+    sqe->addr = (uintptr_t)&(buf->iov);
+    sqe->len = 1;
+    sqe->off = buf->offset + buf->filled;
+    sqe->user_data = i;
+    ar->sq_array[idx] = idx;
+    __atomic_store_n(ar->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    do {
+        retval = syscall(__NR_io_uring_enter, ar->ring_fd, 1, 0, 0, NULL, 0);
+    } while (retval < 0 && errno == EINTR);
+
+    if (retval < 0) {
+        /* Take the entry back unless the kernel took it, a later submit
+           would otherwise send it again, a taken entry still completes */
+        if (__atomic_load_n(ar->sq_head, __ATOMIC_ACQUIRE) == tail) {
+            __atomic_store_n(ar->sq_tail, tail, __ATOMIC_RELEASE);
+            buf->error = errno;
+            buf->state = BUF_READY;
+        }
+        return ASYNC_READ_E_SYSTEM;
+    }
+
+    return 0;
+}
+
+
+/** Private method that takes the io_uring's completed reads.
+ *
+ *  @param[in] ar   The async read structure.
+ *  @param[in] wait Set to wait for at least one read to complete first.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int async_read_reap(async_read *ar, int wait) {
+    struct io_uring_cqe *cqe;
+    async_read_buf *buf;
+    unsigned head;
+    unsigned tail;
+    int retval;
+    int i;
+
+    if (wait) {
+        do {
+            retval = syscall(__NR_io_uring_enter, ar->ring_fd, 0, 1,
+                             IORING_ENTER_GETEVENTS, NULL, 0);
+        } while (retval < 0 && errno == EINTR);
+        if (retval < 0) {
+            return ASYNC_READ_E_SYSTEM;
+        }
+    }
+
+    head = *(ar->cq_head);
+    tail = __atomic_load_n(ar->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        cqe = (struct io_uring_cqe *)ar->cqes + (head & *(ar->cq_mask));
+        i = cqe->user_data;
+        buf = &(ar->bufs[i]);
+        retval = async_read_result(ar, buf, cqe->res);
+        head++;
+        __atomic_store_n(ar->cq_head, head, __ATOMIC_RELEASE);
+        if (retval) {
+            /* Short read, read the rest */
+            if (async_read_submit(ar, i) != 0) {
+                return ASYNC_READ_E_SYSTEM;
+            }
+        } else {
+            buf->state = BUF_READY;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+
+/** Private method that frees the io_uring.
+ *
+ *  @param[in] ar   The async read structure.
+ */
+static void async_read_uring_free(async_read *ar) {
+    if (ar->sqes != NULL) {
+        munmap(ar->sqes, ar->sqes_size);
+    }
+    if (ar->cq_ptr != NULL && ar->cq_ptr != ar->sq_ptr) {
+        munmap(ar->cq_ptr, ar->cq_size);
+    }
+    if (ar->sq_ptr != NULL) {
+        munmap(ar->sq_ptr, ar->sq_size);
+    }
+    if (ar->ring_fd >= 0) {
+        close(ar->ring_fd);
+    }
+    ar->sqes = ar->cq_ptr = ar->sq_ptr = NULL;
+    ar->ring_fd = -1;
+}
+
+
+/** Private method that runs the reader thread.
+ *  Reads each queued chunk, nearest the start of the file first, until it
+ *  is stopped.
+ *
+ *  @param[in] args The async read structure.
+ *
+ *  @return         Returns NULL.
+ */
+static void *async_read_t(void *args) {
+    async_read *ar = (async_read *)args;
+    async_read_buf *buf;
+    uint32_t key;
+    ssize_t res;
+    int i;
+
+    while (1) {
+        /* Find the next queued chunk */
+        key = event_prepare(&(ar->queued));
+        buf = NULL;
+        for (i = 0; i < ar->depth; i++) {
+            if (__atomic_load_n(&(ar->bufs[i].state), __ATOMIC_ACQUIRE) ==
+                BUF_QUEUED &&
+                (buf == NULL || ar->bufs[i].offset < buf->offset)) {
+                buf = &(ar->bufs[i]);
+            }
+        }
+        if (buf == NULL) {
+            if (__atomic_load_n(&(ar->stop), __ATOMIC_ACQUIRE)) {
+                event_cancel(&(ar->queued));
+                break;
+            }
+            event_wait(&(ar->queued), key, EVENT_WAIT_FOREVER);
+            continue;
+        }
+        event_cancel(&(ar->queued));
+
+        /* Read it */
+        do {
+            do {
+                res = pread(ar->fd, buf->data + buf->filled,
+                            ar->chunk - buf->filled,
+                            buf->offset + buf->filled);
+            } while (res < 0 && errno == EINTR);
+        } while (async_read_result(ar, buf, res < 0 ? -errno : res));
+
+        /* Hand it over */
+        __atomic_store_n(&(buf->state), BUF_READY, __ATOMIC_RELEASE);
+        event_broadcast(&(ar->ready));
+    }
+
+    return NULL;
+}
+
+
+/** Private method that queues a read of the next chunk into a buffer.
+ *
+ *  @param[in] ar   The async read structure.
+ *  @param[in] i    The buffer.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int async_read_queue(async_read *ar, int i) {
+    async_read_buf *buf = &(ar->bufs[i]);
+
+    buf->offset = ar->next_offset;
+    buf->filled = 0;
+    buf->error = 0;
+    ar->next_offset += ar->chunk;
+
+    #ifdef __NR_io_uring_setup
+    if (ar->backend == ASYNC_READ_URING) {
+        buf->state = BUF_QUEUED;
+        return async_read_submit(ar, i);
+    }
+    #endif
+
+    __atomic_store_n(&(buf->state), BUF_QUEUED, __ATOMIC_RELEASE);
+    event_signal(&(ar->queued));
+
+    return 0;
+}
+
+
+/** Private method that waits for a buffer's read to be done.
+ *
+ *  @param[in] ar   The async read structure.
+ *  @param[in] i    The buffer.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int async_read_wait(async_read *ar, int i) {
+    async_read_buf *buf = &(ar->bufs[i]);
+    uint32_t key;
+
+    #ifdef __NR_io_uring_setup
+    if (ar->backend == ASYNC_READ_URING) {
+        if (async_read_reap(ar, 0) != 0) {
+            return ASYNC_READ_E_SYSTEM;
+        }
+        while (buf->state == BUF_QUEUED) {
+            if (async_read_reap(ar, 1) != 0) {
+                return ASYNC_READ_E_SYSTEM;
+            }
+        }
+        return 0;
+    }
+    #endif
+
+    while (1) {
+        key = event_prepare(&(ar->ready));
+        if (__atomic_load_n(&(buf->state), __ATOMIC_ACQUIRE) != BUF_QUEUED) {
+            event_cancel(&(ar->ready));
+            break;
+        }
+        event_wait(&(ar->ready), key, EVENT_WAIT_FOREVER);
+    }
+
+    return 0;
+}
+
+
+/** Private method that waits for every read in flight.
+ *
+ *  @param[in] ar   The async read structure.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int async_read_drain(async_read *ar) {
+    int retval = 0;
+    int i;
+
+    for (i = 0; i < ar->depth; i++) {
+        if (async_read_wait(ar, i) != 0) {
+            retval = ASYNC_READ_E_SYSTEM;
+        }
+    }
+
+    return retval;
+}
+
+
+/** Initializes an async read structure.
+ *  Allocates the buffers and sets up an io_uring, or starts a reader thread
+ *  if the io_uring can not be set up.  Nothing is read until
+ *  async_read_start is called.
+ *
+ *  @param[in] ar       The async read structure.
+ *  @param[in] fd       The file's descriptor, the caller keeps it open until
+ *                      the async read is destroyed.
+ *  @param[in] chunk    Bytes to read at a time, rounded up to a multiple of
+ *                      ASYNC_READ_ALIGN.
+ *  @param[in] depth    Number of reads to keep in flight, 0 for
+ *                      ASYNC_READ_DEPTH.
+ *  @param[in] flags    ASYNC_READ_* flags.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int async_read_init(async_read *ar, int fd, size_t chunk, int depth,
+                    int flags) {
+    int i;
+
+    /* Clear the structure */
+    memset(ar, 0, sizeof(async_read));
+
+    /* Set defaults */
+    ar->fd = fd;
+    ar->flags = flags;
+    ar->depth = depth > 0 ? depth : ASYNC_READ_DEPTH;
+    ar->chunk = (chunk + ASYNC_READ_ALIGN - 1) & ~(size_t)(ASYNC_READ_ALIGN - 1);
+    if (ar->chunk == 0) {
+        ar->chunk = ASYNC_READ_ALIGN;
+    }
+    ar->ring_fd = -1;
+
+    /* Allocate the buffers */
+    ar->bufs = calloc(ar->depth, sizeof(async_read_buf));
+    if (ar->bufs == NULL) {
+        return ASYNC_READ_E_SYSTEM;
+    }
+    for (i = 0; i < ar->depth; i++) {
+        if (posix_memalign((void **)&(ar->bufs[i].data), ASYNC_READ_ALIGN,
+                           ar->chunk) != 0) {
+            ar->bufs[i].data = NULL;
+            async_read_destroy(ar);
+            return ASYNC_READ_E_SYSTEM;
+        }
+    }
+
+    /* Use an io_uring if we can */
+    #ifdef __NR_io_uring_setup
+    if (!(flags & ASYNC_READ_THREADED)) {
+        if (async_read_uring_init(ar) == 0) {
+            ar->backend = ASYNC_READ_URING;
+            return 0;
+        }
+        async_read_uring_free(ar);
+    }
+    #endif
+
+    /* Otherwise start a reader thread */
+    ar->backend = ASYNC_READ_THREAD;
+    event_init(&(ar->queued));
+    event_init(&(ar->ready));
+    if (pthread_create(&(ar->thread), NULL, async_read_t, ar) != 0) {
+        ar->backend = 0;
+        async_read_destroy(ar);
+        return ASYNC_READ_E_SYSTEM;
+    }
+
+    return 0;
+}
+
+
+/** Destroys an async read structure.
+ *  Waits for the reads in flight, stops the reader thread and frees the
+ *  buffers.  Does not close the file.
+ *
+ *  @param[in] ar   The async read structure.
+ */
+void async_read_destroy(async_read *ar) {
+    int i;
+
+    /* Wait for the reads in flight, they write into the buffers */
+    if (ar->backend != 0) {
+        async_read_drain(ar);
+    }
+
+    if (ar->backend == ASYNC_READ_THREAD) {
+        __atomic_store_n(&(ar->stop), 1, __ATOMIC_RELEASE);
+        event_broadcast(&(ar->queued));
+        pthread_join(ar->thread, NULL);
+    }
+    async_read_uring_free(ar);
+
+    if (ar->bufs != NULL) {
+        for (i = 0; i < ar->depth; i++) {
+            free(ar->bufs[i].data);
+        }
+        free(ar->bufs);
+        ar->bufs = NULL;
+    }
+    ar->backend = 0;
+}
+
+
+/** Starts reading.
+ *  Drops any chunks read ahead, then starts reading from offset, rounded
+ *  down to a multiple of ASYNC_READ_ALIGN.
+ *
+ *  @param[in] ar       The async read structure.
+ *  @param[in] offset   The file offset to read from.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int async_read_start(async_read *ar, uint64_t offset) {
+    int retval = 0;
+    int i;
+
+    /* The reads in flight are for the old offset, wait them out */
+    if (async_read_drain(ar) != 0) {
+        return ASYNC_READ_E_SYSTEM;
+    }
+    for (i = 0; i < ar->depth; i++) {
+        ar->bufs[i].state = BUF_FREE;
+    }
+
+    /* Fill every buffer */
+    ar->next_offset = offset & ~(uint64_t)(ASYNC_READ_ALIGN - 1);
+    ar->eof = 0;
+    ar->head = 0;
+    for (i = 0; i < ar->depth && retval == 0; i++) {
+        retval = async_read_queue(ar, i);
+    }
+
+    return retval;
+}
+
+
+/** Gets the next chunk.
+ *  Waits for the next chunk of the file to be read.  The chunk is good until
+ *  async_read_done is called.
+ *
+ *  @param[in]  ar      The async read structure.
+ *  @param[out] data    The chunk.
+ *  @param[out] offset  The file offset the chunk starts at.
+ *
+ *  @return             Returns the number of bytes in the chunk, 0 at the end
+ *                      of the file, otherwise an error code.
+ */
+ssize_t async_read_next(async_read *ar, char **data, uint64_t *offset) {
+    async_read_buf *buf = &(ar->bufs[ar->head]);
+
+    /* Nothing is queued past the end of the file */
+    if (buf->state == BUF_FREE) {
+        return 0;
+    }
+
+    if (async_read_wait(ar, ar->head) != 0) {
+        return ASYNC_READ_E_SYSTEM;
+    }
+    if (buf->error != 0) {
+        errno = buf->error;
+        return ASYNC_READ_E_SYSTEM;
+    }
+
+    /* A short chunk is the end of the file, stop reading ahead */
+    if (buf->filled < ar->chunk) {
+        ar->eof = 1;
+    }
+
+    *data = buf->data;
+    *offset = buf->offset;
+    return buf->filled;
+}
+
+
+/** Hands back a chunk.
+ *  Queues a read of the next chunk of the file into the chunk's buffer.
+ *
+ *  @param[in] ar   The async read structure.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+int async_read_done(async_read *ar) {
+    int i = ar->head;
+
+    ar->head = (ar->head + 1) % ar->depth;
+    ar->bufs[i].state = BUF_FREE;
+    if (ar->eof) {
+        return 0;
+    }
+
+    return async_read_queue(ar, i);
+}
@@ -0,0 +1,120 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef ASYNC_READ_H
+#define ASYNC_READ_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "event.h"
+
+/** @addtogroup async_read
+ *  @{
+ */
+
+#define ASYNC_READ_DEPTH    4       /**< Default number of reads in flight.   */
+#define ASYNC_READ_ALIGN    4096    /**< Alignment of the buffers, and of each
+                                     *   read's offset and size, enough for
+                                     *   O_DIRECT.
+                                     */
+
+#define ASYNC_READ_DIRECT   0x1     /**< The file was opened with O_DIRECT.   */
+#define ASYNC_READ_THREADED 0x2     /**< Read with a thread, even when
+                                     *   io_uring is there.
+                                     */
+
+#define ASYNC_READ_E_SYSTEM -1      /**< A system error occurred, check errno. */
+
+/** Async read backend enum.
+ *  How the reads are made.
+ */
+typedef enum {
+    ASYNC_READ_URING = 1,   /**< Reads are submitted to an io_uring.          */
+    ASYNC_READ_THREAD       /**< Reads are made by a reader thread.           */
+} async_read_backend;
+
+/** An async read buffer.
+ *  One chunk of the file, read ahead.
+ */
+typedef struct {
+    char *data;             /**< The buffer, chunk bytes.                     */
+    uint64_t offset;        /**< File offset the chunk starts at.             */
+    size_t filled;          /**< Bytes of the chunk read so far.              */
+    int state;              /**< Whether the buffer is free, queued or ready. */
+    int error;              /**< errno of a failed read, 0 if none.           */
+    struct iovec iov;       /**< What an io_uring read fills.                 */
+} async_read_buf;
+
+/** An async read structure.
+ *  Reads a file a chunk at a time, keeping depth reads in flight ahead of
+ *  the reader, and hands the chunks out in file order.  Only one thread may
+ *  take chunks from it.
+ */
+typedef struct {
+    int fd;                 /**< The file's descriptor.                       */
+    int flags;              /**< ASYNC_READ_* flags.                          */
+    async_read_backend backend; /**< How the reads are made.                  */
+    int depth;              /**< Number of buffers, and of reads in flight.   */
+    size_t chunk;           /**< Size of each read.                           */
+    uint64_t next_offset;   /**< File offset of the next read to queue.       */
+    int eof;                /**< Set once a read reached the end of the file. */
+    async_read_buf *bufs;   /**< The buffers, used in turn.                   */
+    int head;               /**< The buffer the next chunk is handed out
+                             *   from.
+                             */
+
+    /* io_uring backend */
+    int ring_fd;            /**< The io_uring, -1 if there is none.           */
+    void *sq_ptr;           /**< Mapped submission ring.                      */
+    size_t sq_size;         /**< Size of the submission ring mapping.         */
+    void *cq_ptr;           /**< Mapped completion ring.                      */
+    size_t cq_size;         /**< Size of the completion ring mapping, 0 if it
+                             *   shares the submission ring's.
+                             */
+    void *sqes;             /**< Mapped submission queue entries.             */
+    size_t sqes_size;       /**< Size of the entries mapping.                 */
+    unsigned *sq_head;      /**< Submission ring head.                        */
+    unsigned *sq_tail;      /**< Submission ring tail.                        */
+    unsigned *sq_mask;      /**< Submission ring mask.                        */
+    unsigned *sq_array;     /**< Submission ring entry indexes.               */
+    unsigned *cq_head;      /**< Completion ring head.                        */
+    unsigned *cq_tail;      /**< Completion ring tail.                        */
+    unsigned *cq_mask;      /**< Completion ring mask.                        */
+    void *cqes;             /**< Completion ring entries.                     */
+
+    /* Thread backend */
+    pthread_t thread;       /**< The reader thread.                           */
+    event queued;           /**< Signalled when a read is queued.             */
+    event ready;            /**< Signalled when a read is done.               */
+    int stop;               /**< Set to stop the reader thread.               */
+} async_read;
+
+int async_read_init(async_read *ar, int fd, size_t chunk, int depth,
+                    int flags);
+void async_read_destroy(async_read *ar);
+int async_read_start(async_read *ar, uint64_t offset);
+ssize_t async_read_next(async_read *ar, char **data, uint64_t *offset);
+int async_read_done(async_read *ar);
+
+/** @} */
+
+#endif      /* ASYNC_READ_H */
@@ -0,0 +1,155 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Measures how long it takes an attack to wind down and call its callback.
+ *
+ *   match  - time from attack_check finding the answer to the callback.
+ *   stop   - time from stop_attack to the callback.
+ *   eof    - time to run a tiny attack that has no answer, start to callback.
+ *
+ * Usage: bench_stop_latency [threads] [runs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../libattkthread.h"
+#include "../brute_force.h"
+
+#define BENCH_ALPHABET  "abcdefghijklmnopqrstuvwxyz"
+#define BENCH_BLOCK     256
+
+static volatile int bench_done;     /* Set by the callback         */
+static uint64_t bench_found_ns;     /* When the answer was found   */
+static uint64_t bench_callback_ns;  /* When the callback was called */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_callback(attack_st *attk_st) {
+    bench_callback_ns = now_ns();
+    __atomic_store_n(&bench_done, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static int bench_check_match(char *record, size_t record_size,
+                             char *ret_record, size_t return_size,
+                             void *attack_data) {
+    if (strcmp(record, "abc") == 0) {
+        bench_found_ns = now_ns();
+        return 0;
+    }
+    return E_ATTK_RECORD_NO_MATCH;
+}
+
+static int bench_check_none(char *record, size_t record_size,
+                            char *ret_record, size_t return_size,
+                            void *attack_data) {
+    return E_ATTK_RECORD_NO_MATCH;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, uint64_t *samples, int runs) {
+    uint64_t total = 0;
+    int i;
+
+    qsort(samples, runs, sizeof(uint64_t), cmp_u64);
+    for (i = 0; i < runs; i++) {
+        total += samples[i];
+    }
+    printf("%-6s runs=%d mean=%.1fus p50=%.1fus p99=%.1fus max=%.1fus\n",
+           name, runs, total / (double)runs / 1000.0,
+           samples[runs / 2] / 1000.0, samples[(runs * 99) / 100] / 1000.0,
+           samples[runs - 1] / 1000.0);
+}
+
+static uint64_t run_one(int threads, char *end, int stop_after_us,
+                        int (*check)(char *, size_t, char *, size_t, void *)) {
+    attack_st attk_st;
+    file_st file_in;
+    uint64_t start_ns;
+    uint64_t stop_ns = 0;
+
+    bench_done = 0;
+    bench_found_ns = 0;
+    brute_force_init(&file_in, BENCH_BLOCK, "a", end, BENCH_ALPHABET);
+    attack_st_init(&attk_st, &file_in, NULL, threads, check, bench_callback,
+                   NULL, NULL);
+
+    start_ns = now_ns();
+    start_attack(&attk_st);
+    if (stop_after_us > 0) {
+        usleep(stop_after_us);
+        stop_ns = now_ns();
+        stop_attack(&attk_st);
+    }
+    while (!__atomic_load_n(&bench_done, __ATOMIC_SEQ_CST)) {
+        usleep(10);
+    }
+    pthread_join(attk_st.main, NULL);
+
+    attack_st_destroy(&attk_st);
+    brute_force_destroy(&file_in);
+
+    if (stop_ns > 0) {
+        return bench_callback_ns - stop_ns;
+    } else if (bench_found_ns > 0) {
+        return bench_callback_ns - bench_found_ns;
+    }
+    return bench_callback_ns - start_ns;
+}
+
+int main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int runs = argc > 2 ? atoi(argv[2]) : 20;
+    uint64_t *samples;
+    int i;
+
+    samples = malloc(sizeof(uint64_t) * runs);
+    printf("threads=%d\n", threads);
+
+    for (i = 0; i < runs; i++) {
+        samples[i] = run_one(threads, "zzzz", 0, bench_check_match);
+    }
+    report("match", samples, runs);
+
+    for (i = 0; i < runs; i++) {
+        samples[i] = run_one(threads, "zzzzzz", 2000, bench_check_none);
+    }
+    report("stop", samples, runs);
+
+    for (i = 0; i < runs; i++) {
+        samples[i] = run_one(threads, "zz", 0, bench_check_none);
+    }
+    report("eof", samples, runs);
+
+    free(samples);
+    return 0;
+}
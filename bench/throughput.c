@@ -0,0 +1,578 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Measures end to end attack throughput for every input source.
+ *
+ *   brute_force    - generated records, record_size - 1 characters long.
+ *   read_word_list - a generated word list.
+ *   read_file      - a generated dictionary file.
+ *   make_dict      - the word list turned into a dictionary file.
+ *
+ * The first three run with each of the no-op, memcmp and hash attack_check
+ * functions, make_dict runs its own.  Each is run on its own, one record at
+ * a time, and wrapped in an attack_check_batch that is handed whole blocks.
+ * Every run is repeated for each thread count, records_per_block and
+ * record_size, over size bytes of records.  The results are printed as JSON:
+ * records per second, the p50 and p99 time to check a block, from the
+ * attack's own stage statistics, and the scaling efficiency against the
+ * fewest threads.  Progress goes to stderr.
+ *
+ * Usage: bench_throughput [-s size] [-t threads,...] [-b records,...]
+ *                         [-r record_size,...] [-d dir] [-o file] [-k]
+ *
+ *   -s  Bytes of records per run, with an optional K, M or G suffix,
+ *       default 64M.
+ *   -t  Thread counts, default 1,2,4 and the number of CPUs.
+ *   -b  Records per block, default 256,4096.
+ *   -r  Record sizes, default 8,32.
+ *   -d  Directory for the generated datasets, default the current one.
+ *   -o  File to write the JSON to, default stdout.
+ *   -k  Keep the generated datasets.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../libattkthread.h"
+#include "../brute_force.h"
+#include "../libmakedict.h"
+#include "../read_file.h"
+#include "../read_word_list.h"
+#include "../write_file.h"
+
+#define BENCH_ALPHABET      "abcdefghijklmnopqrstuvwxyz"
+#define BENCH_MAX_LIST      16
+#define BENCH_GEN_RECORDS   65536
+
+/* Input sources */
+#define SOURCE_BRUTE_FORCE  0
+#define SOURCE_WORD_LIST    1
+#define SOURCE_READ_FILE    2
+#define SOURCE_MAKE_DICT    3
+#define SOURCE_COUNT        4
+
+/* attack_check functions */
+#define CHECK_NOOP          0
+#define CHECK_MEMCMP        1
+#define CHECK_HASH          2
+#define CHECK_MAKE_DICT     3
+#define CHECK_COUNT         3
+
+static const char *source_names[] = {
+    "brute_force", "read_word_list", "read_file", "make_dict"
+};
+static const char *check_names[] = {
+    "noop", "memcmp", "hash", "make_dict"
+};
+
+/* How records are handed to the check */
+#define PATH_RECORD         0
+#define PATH_BATCH          1
+#define PATH_COUNT          2
+
+static const char *path_names[] = {
+    "record", "batch"
+};
+
+/* State shared with the batch wrapper */
+typedef struct BENCH_ST {
+    int (*check)(char *record, size_t record_size, char *ret_record,
+                 size_t return_size, void *attack_data);
+    void *check_data;
+} bench_st;
+
+/* One measurement */
+typedef struct BENCH_RESULT {
+    int source;
+    int check;
+    int path;
+    int threads;
+    int records_per_block;
+    int record_size;
+    uint64_t records;
+    double seconds;
+    double records_per_sec;
+    double p50_us;
+    double p99_us;
+    double efficiency;
+    int error;
+} bench_result;
+
+static volatile int bench_done;     /* Set by the callback          */
+static char bench_target[256];      /* What memcmp compares against */
+static volatile uint64_t bench_hash_target = 1; /* Hash that never matches */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_callback(attack_st *attk_st) {
+    __atomic_store_n(&bench_done, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static int bench_check_noop(char *record, size_t record_size,
+                            char *ret_record, size_t return_size,
+                            void *attack_data) {
+    return E_ATTK_RECORD_NO_MATCH;
+}
+
+static int bench_check_memcmp(char *record, size_t record_size,
+                              char *ret_record, size_t return_size,
+                              void *attack_data) {
+    if (memcmp(record, bench_target, record_size) == 0) {
+        return 0;
+    }
+    return E_ATTK_RECORD_NO_MATCH;
+}
+
+static int bench_check_hash(char *record, size_t record_size,
+                            char *ret_record, size_t return_size,
+                            void *attack_data) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    /* FNV-1a over the whole record */
+    for (i = 0; i < record_size; i++) {
+        hash ^= (unsigned char)record[i];
+        hash *= 0x100000001b3ULL;
+    }
+    if (hash == bench_hash_target) {
+        return 0;
+    }
+    return E_ATTK_RECORD_NO_MATCH;
+}
+
+/* Checks a block through the per-record check, packed records are checked
+   in place at their own length */
+static int bench_check_batch(char *records, size_t count, size_t stride,
+                             char *out_buf, size_t out_stride,
+                             uint64_t *results, void *attack_data) {
+    bench_st *bench = attack_data;
+    attack_records *packed = (attack_records *)records;
+    uint64_t i;
+    int r;
+
+    for (i = 0; i < count; i++) {
+        if (stride == 0) {
+            r = bench->check((char *)ATTK_RECORDS_RECORD(packed, i),
+                             ATTK_RECORDS_LEN(packed, i),
+                             out_buf != NULL ? out_buf + i * out_stride : NULL,
+                             out_stride, bench->check_data);
+        } else {
+            r = bench->check(records + i * stride, stride,
+                             out_buf != NULL ? out_buf + i * out_stride :
+                                               NULL,
+                             out_stride, bench->check_data);
+        }
+        if (r == E_ATTK_RECORD_INVALID) {
+            ATTK_BATCH_SET(results, i, ATTK_BATCH_INVALID);
+        } else if (r == 0) {
+            ATTK_BATCH_SET(results, i, ATTK_BATCH_MATCH);
+        }
+    }
+    return 0;
+}
+
+static int parse_list(const char *arg, int *list) {
+    char *end;
+    int count = 0;
+
+    while (*arg != '\0' && count < BENCH_MAX_LIST) {
+        list[count] = strtol(arg, &end, 10);
+        if (end == arg || list[count] <= 0) {
+            return -1;
+        }
+        count++;
+        arg = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+static uint64_t parse_size(const char *arg) {
+    char *end;
+    uint64_t size = strtoull(arg, &end, 10);
+
+    if (*end == 'k' || *end == 'K') {
+        size <<= 10;
+    } else if (*end == 'm' || *end == 'M') {
+        size <<= 20;
+    } else if (*end == 'g' || *end == 'G') {
+        size <<= 30;
+    }
+    return size;
+}
+
+/* Makes record i, record_size - 1 characters long */
+static void make_word(char *word, uint64_t i, int record_size) {
+    int j;
+
+    for (j = record_size - 2; j >= 0; j--) {
+        word[j] = BENCH_ALPHABET[i % 26];
+        i /= 26;
+    }
+    word[record_size - 1] = '\0';
+}
+
+/* Writes a word list and a dictionary file of count records each */
+static int make_datasets(const char *words_path, const char *dict_path,
+                         uint64_t count, int record_size) {
+    FILE *fp;
+    file_st file_out;
+    char *buf;
+    char *buf_p;
+    uint64_t i;
+    uint64_t n;
+    int retval = 0;
+
+    fp = fopen(words_path, "w");
+    buf = calloc(BENCH_GEN_RECORDS, record_size);
+    if (fp == NULL || buf == NULL) {
+        perror(words_path);
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        free(buf);
+        return -1;
+    }
+
+    write_file_init(&file_out, (char *)dict_path, "", 0, record_size);
+    if (file_out.open_file(&file_out) != 0) {
+        perror(dict_path);
+        retval = -1;
+    }
+    for (i = 0; i < count && retval == 0; i += n) {
+        n = count - i < BENCH_GEN_RECORDS ? count - i : BENCH_GEN_RECORDS;
+        memset(buf, 0, n * record_size);
+        for (buf_p = buf; buf_p < buf + n * record_size;
+             buf_p += record_size) {
+            make_word(buf_p, i + (buf_p - buf) / record_size, record_size);
+            fputs(buf_p, fp);
+            fputc('\n', fp);
+        }
+        if (file_out.next_block(&file_out, &buf, n * record_size) < 0) {
+            perror(dict_path);
+            retval = -1;
+        }
+    }
+    file_out.close_file(&file_out);
+    write_file_destroy(&file_out);
+
+    if (fclose(fp) != 0) {
+        perror(words_path);
+        retval = -1;
+    }
+    free(buf);
+    return retval;
+}
+
+static void run_one(bench_result *result, bench_st *bench,
+                    const char *words_path, const char *dict_path,
+                    const char *out_path, uint64_t count) {
+    attack_st attk_st;
+    attack_status status;
+    attack_stats stats;
+    file_st file_in;
+    char end[256];
+    uint64_t start;
+    int (*checks[])(char *, size_t, char *, size_t, void *) = {
+        bench_check_noop, bench_check_memcmp, bench_check_hash
+    };
+
+    bench_done = 0;
+
+    /* Set up the source */
+    if (result->source == SOURCE_MAKE_DICT) {
+        unlink(out_path);
+        make_dict_init(&attk_st, (char *)words_path, (char *)out_path,
+                       result->threads, bench_callback, 0,
+                       result->record_size, 0);
+        attk_st.file_in->records_per_block = result->records_per_block;
+        attk_st.block_target_us = 0;
+        bench->check = attk_st.attack_check;
+    } else {
+        if (result->source == SOURCE_BRUTE_FORCE) {
+            memset(end, 'z', result->record_size - 1);
+            end[result->record_size - 1] = '\0';
+            brute_force_init(&file_in, result->records_per_block, "a", end,
+                             BENCH_ALPHABET);
+            brute_force_range(&file_in, 0, count);
+        } else if (result->source == SOURCE_WORD_LIST) {
+            read_word_list_init(&file_in, (char *)words_path,
+                                result->records_per_block,
+                                result->record_size);
+        } else {
+            read_file_init(&file_in, result->records_per_block,
+                           (char *)dict_path, "", 0, 0);
+        }
+        attack_st_init(&attk_st, &file_in, NULL, result->threads,
+                       checks[result->check], bench_callback, NULL, NULL);
+        bench->check = checks[result->check];
+    }
+    if (result->path == PATH_BATCH) {
+        bench->check_data = attk_st.attack_data;
+        attk_st.attack_check_batch = bench_check_batch;
+        attk_st.attack_data = bench;
+    }
+
+    /* Time every block check */
+    attk_st.stage_stats = 1;
+
+    /* Run it */
+    start = now_ns();
+    start_attack(&attk_st);
+    while (!__atomic_load_n(&bench_done, __ATOMIC_SEQ_CST)) {
+        usleep(1000);
+    }
+    pthread_join(attk_st.main, NULL);
+    result->seconds = (now_ns() - start) / 1e9;
+
+    memset(&status, 0, sizeof(attack_status));
+    check_attack(&attk_st, &status);
+    result->records = status.records_tested;
+    result->error = attk_st.error;
+    result->records_per_sec = result->records / result->seconds;
+
+    /* Block check times */
+    check_attack_stats(&attk_st, &stats);
+    result->p50_us =
+        histogram_quantile(&(stats.stages[ATTACK_STAGE_CHECK]), 0.5) / 1000.0;
+    result->p99_us =
+        histogram_quantile(&(stats.stages[ATTACK_STAGE_CHECK]), 0.99) / 1000.0;
+
+    /* Clean up */
+    if (result->source == SOURCE_MAKE_DICT) {
+        make_dict_destroy(&attk_st);
+        attack_st_destroy(&attk_st);
+        unlink(out_path);
+    } else {
+        attack_st_destroy(&attk_st);
+        if (result->source == SOURCE_BRUTE_FORCE) {
+            brute_force_destroy(&file_in);
+        } else if (result->source == SOURCE_WORD_LIST) {
+            read_word_list_destroy(&file_in);
+        } else {
+            read_file_destroy(&file_in);
+        }
+    }
+}
+
+/* Works out each result's scaling efficiency against the run with the fewest
+   threads that matches it in everything else */
+static void scaling(bench_result *results, int count) {
+    bench_result *base;
+    int i;
+    int j;
+
+    for (i = 0; i < count; i++) {
+        base = NULL;
+        for (j = 0; j < count; j++) {
+            if (results[j].source == results[i].source &&
+                results[j].check == results[i].check &&
+                results[j].path == results[i].path &&
+                results[j].records_per_block ==
+                results[i].records_per_block &&
+                results[j].record_size == results[i].record_size &&
+                (base == NULL || results[j].threads < base->threads)) {
+                base = &(results[j]);
+            }
+        }
+        if (base->records_per_sec > 0) {
+            results[i].efficiency =
+                (results[i].records_per_sec * base->threads) /
+                (base->records_per_sec * results[i].threads);
+        }
+    }
+}
+
+static void report(FILE *fp, bench_result *results, int count,
+                   uint64_t size) {
+    bench_result *r;
+    int i;
+
+    fprintf(fp, "{\n  \"bench\": \"throughput\",\n  \"cpus\": %ld,\n"
+            "  \"size_bytes\": %llu,\n  \"results\": [\n",
+            sysconf(_SC_NPROCESSORS_ONLN), (unsigned long long)size);
+    for (i = 0; i < count; i++) {
+        r = &(results[i]);
+        fprintf(fp, "    {\"source\": \"%s\", \"check\": \"%s\", "
+                "\"path\": \"%s\", "
+                "\"threads\": %d, \"records_per_block\": %d, "
+                "\"record_size\": %d, \"records\": %llu, "
+                "\"seconds\": %.6f, \"records_per_sec\": %.1f, "
+                "\"block_p50_us\": %.3f, \"block_p99_us\": %.3f, "
+                "\"scaling_efficiency\": %.4f, \"error\": %d}%s\n",
+                source_names[r->source], check_names[r->check],
+                path_names[r->path], r->threads,
+                r->records_per_block, r->record_size,
+                (unsigned long long)r->records, r->seconds,
+                r->records_per_sec, r->p50_us, r->p99_us, r->efficiency,
+                r->error, i + 1 < count ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+    uint64_t size = 64 << 20;
+    int threads[BENCH_MAX_LIST] = { 1, 2, 4 };
+    int thread_count = 3;
+    int blocks[BENCH_MAX_LIST] = { 256, 4096 };
+    int block_count = 2;
+    int sizes[BENCH_MAX_LIST] = { 8, 32 };
+    int size_count = 2;
+    const char *dir = ".";
+    const char *json_path = NULL;
+    int keep = 0;
+    char words_path[4096];
+    char dict_path[4096];
+    char out_path[4096];
+    bench_st bench;
+    bench_result *results;
+    bench_result *r;
+    int result_count = 0;
+    uint64_t count;
+    FILE *fp;
+    long cpus;
+    int source;
+    int check;
+    int path;
+    int t;
+    int b;
+    int s;
+    int opt;
+
+    /* Default to 1, 2, 4 and every CPU */
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 4) {
+        threads[thread_count++] = cpus;
+    }
+
+    while ((opt = getopt(argc, argv, "s:t:b:r:d:o:k")) != -1) {
+        if (opt == 's') {
+            size = parse_size(optarg);
+        } else if (opt == 't') {
+            thread_count = parse_list(optarg, threads);
+        } else if (opt == 'b') {
+            block_count = parse_list(optarg, blocks);
+        } else if (opt == 'r') {
+            size_count = parse_list(optarg, sizes);
+        } else if (opt == 'd') {
+            dir = optarg;
+        } else if (opt == 'o') {
+            json_path = optarg;
+        } else if (opt == 'k') {
+            keep = 1;
+        } else {
+            thread_count = -1;
+            break;
+        }
+    }
+    for (s = 0; s < size_count; s++) {
+        if (sizes[s] < 2 || sizes[s] > 255) {
+            size_count = -1;
+        }
+    }
+    if (thread_count <= 0 || block_count <= 0 || size_count <= 0 ||
+        size == 0) {
+        fprintf(stderr, "Usage: %s [-s size] [-t threads,...] "
+                "[-b records,...] [-r record_size,...] [-d dir] [-o file] "
+                "[-k]\n", argv[0]);
+        return 1;
+    }
+
+    memset(bench_target, 0xff, sizeof(bench_target));
+    results = calloc(SOURCE_COUNT * CHECK_COUNT * PATH_COUNT * thread_count *
+                     block_count * size_count, sizeof(bench_result));
+    if (results == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    for (s = 0; s < size_count; s++) {
+        /* Generate the datasets for this record size */
+        count = size / sizes[s];
+        snprintf(words_path, sizeof(words_path), "%s/bench_words_%d.txt",
+                 dir, sizes[s]);
+        snprintf(dict_path, sizeof(dict_path), "%s/bench_dict_%d.bin", dir,
+                 sizes[s]);
+        snprintf(out_path, sizeof(out_path), "%s/bench_out_%d.bin", dir,
+                 sizes[s]);
+        fprintf(stderr, "generating %llu records of %d bytes\n",
+                (unsigned long long)count, sizes[s]);
+        if (make_datasets(words_path, dict_path, count, sizes[s]) != 0) {
+            return 1;
+        }
+
+        for (source = 0; source < SOURCE_COUNT; source++) {
+            for (check = 0; check < CHECK_COUNT; check++) {
+                if (source == SOURCE_MAKE_DICT && check > 0) {
+                    break;
+                }
+                for (path = 0; path < PATH_COUNT; path++) {
+                    for (b = 0; b < block_count; b++) {
+                        for (t = 0; t < thread_count; t++) {
+                            r = &(results[result_count++]);
+                            r->source = source;
+                            r->check = source == SOURCE_MAKE_DICT ?
+                                       CHECK_MAKE_DICT : check;
+                            r->path = path;
+                            r->threads = threads[t];
+                            r->records_per_block = blocks[b];
+                            r->record_size = sizes[s];
+                            run_one(r, &bench, words_path, dict_path,
+                                    out_path, count);
+                            fprintf(stderr, "%-14s %-9s %-6s threads=%-3d "
+                                    "block=%-6d size=%-3d %12.0f rec/s "
+                                    "p50=%.1fus p99=%.1fus%s\n",
+                                    source_names[r->source],
+                                    check_names[r->check],
+                                    path_names[r->path], r->threads,
+                                    r->records_per_block, r->record_size,
+                                    r->records_per_sec, r->p50_us, r->p99_us,
+                                    r->error != 0 ? " ERROR" : "");
+                        }
+                    }
+                }
+            }
+        }
+
+        if (!keep) {
+            unlink(words_path);
+            unlink(dict_path);
+        }
+    }
+
+    scaling(results, result_count);
+    fp = json_path != NULL ? fopen(json_path, "w") : stdout;
+    if (fp == NULL) {
+        perror(json_path);
+        return 1;
+    }
+    report(fp, results, result_count, size);
+    if (fp != stdout) {
+        fclose(fp);
+    }
+
+    free(results);
+    return 0;
+}
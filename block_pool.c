@@ -0,0 +1,175 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "block_pool.h"
+#include "topology.h"
+
+/** @defgroup block_pool block_pool
+ *
+ *  A pool of reusable blocks.
+ *
+ *  A block pool hands out blocks of one size and takes them back for reuse,
+ *  so blocks are not allocated and freed over and over.  Each thread keeps a
+ *  small cache of free blocks, and only touches the shared queue when its
+ *  cache runs empty or full, moving half a cache of blocks at a time.
+ */
+
+/** Initializes a block pool.
+ *  Clears a new block pool and creates its shared queue.  No blocks are
+ *  allocated until they are needed.
+ *
+ *  @param[in] pool         The block pool to initialize.
+ *  @param[in] block_size   The size of each block.
+ *  @param[in] align        The alignment of each block, a power of two and a
+ *                          multiple of sizeof(void *).
+ *  @param[in] size         The number of free blocks the shared queue can
+ *                          hold, extra free blocks are freed.
+ *  @param[in] node_id      The NUMA node to place new blocks on, -1 for any
+ *                          node.  Blocks are then page aligned.
+ *
+ *  @return                 Returns 0 on success, otherwise an error code.
+ */
+int block_pool_init(block_pool *pool, size_t block_size, size_t align,
+                    size_t size, int node_id) {
+    size_t page_size;
+
+    /* Clear the structure */
+    memset(pool, 0, sizeof(block_pool));
+
+    /* Set defaults */
+    pool->block_size = block_size;
+    pool->align = align;
+    pool->node_id = node_id;
+    if (node_id >= 0) {
+        /* Node placement works on whole pages */
+        page_size = sysconf(_SC_PAGESIZE);
+        if (pool->align < page_size) {
+            pool->align = page_size;
+        }
+    }
+
+    return queue_init(&(pool->free_blocks), size);
+}
+
+
+/** Destroys a block pool.
+ *  Frees every block in the shared queue.  Thread caches must be flushed
+ *  first and blocks still handed out are not freed.
+ *
+ *  @param[in] pool The block pool to destroy.
+ */
+void block_pool_destroy(block_pool *pool) {
+    void *block;
+    size_t size;
+
+    /* Free the blocks */
+    queue_stop(&(pool->free_blocks));
+    while (queue_try_pop(&(pool->free_blocks), &block, &size) == 0) {
+        free(block);
+    }
+    queue_destroy(&(pool->free_blocks));
+
+    /* Clear the structure */
+    memset(pool, 0, sizeof(block_pool));
+}
+
+
+/** Get a block.
+ *  Gets a free block from the thread's cache, refilling the cache from the
+ *  shared queue if it is empty, or allocates a new block if there are none.
+ *
+ *  @param[in] pool     The block pool.
+ *  @param[in] cache    The calling thread's cache.
+ *
+ *  @return             Returns the block, NULL on error.
+ */
+void *block_pool_get(block_pool *pool, block_pool_cache *cache) {
+    void *block;
+    size_t size;
+
+    /* Refill the cache */
+    while (cache->count < BLOCK_POOL_CACHE_SIZE / 2 &&
+           queue_try_pop(&(pool->free_blocks), &block, &size) == 0) {
+        cache->blocks[cache->count++] = block;
+    }
+
+    /* Reuse a block */
+    if (cache->count > 0) {
+        __atomic_store_n(&(cache->hits), cache->hits + 1, __ATOMIC_RELAXED);
+        return cache->blocks[--cache->count];
+    }
+
+    /* Allocate a new block */
+    if (posix_memalign(&block, pool->align, pool->block_size) != 0) {
+        return NULL;
+    }
+    if (pool->node_id >= 0) {
+        /* Best effort, the block works wherever it lands */
+        topology_bind(block, pool->block_size, pool->node_id);
+    }
+    __atomic_store_n(&(cache->misses), cache->misses + 1, __ATOMIC_RELAXED);
+
+    return block;
+}
+
+
+/** Put a block back.
+ *  Puts a block back into the thread's cache, moving half of the cache to the
+ *  shared queue first if it is full.
+ *
+ *  @param[in] pool     The block pool.
+ *  @param[in] cache    The calling thread's cache.
+ *  @param[in] block    The block, from block_pool_get.
+ */
+void block_pool_put(block_pool *pool, block_pool_cache *cache, void *block) {
+    /* Make room in the cache */
+    if (cache->count == BLOCK_POOL_CACHE_SIZE) {
+        while (cache->count > BLOCK_POOL_CACHE_SIZE / 2) {
+            cache->count--;
+            if (queue_try_push(&(pool->free_blocks),
+                               cache->blocks[cache->count],
+                               pool->block_size) != 0) {
+                /* The pool is full */
+                free(cache->blocks[cache->count]);
+            }
+        }
+    }
+
+    cache->blocks[cache->count++] = block;
+}
+
+
+/** Flush a thread cache.
+ *  Moves every block in the thread's cache to the shared queue, freeing any
+ *  that do not fit.  Call before the thread exits.
+ *
+ *  @param[in] pool     The block pool.
+ *  @param[in] cache    The calling thread's cache.
+ */
+void block_pool_flush(block_pool *pool, block_pool_cache *cache) {
+    while (cache->count > 0) {
+        cache->count--;
+        if (queue_try_push(&(pool->free_blocks), cache->blocks[cache->count],
+                           pool->block_size) != 0) {
+            /* The pool is full */
+            free(cache->blocks[cache->count]);
+        }
+    }
+}
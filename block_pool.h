@@ -0,0 +1,68 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef BLOCK_POOL_H
+#define BLOCK_POOL_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "queue.h"
+
+/** @addtogroup block_pool
+ *  @{
+ */
+
+#define BLOCK_POOL_CACHE_SIZE 8 /**< Number of blocks a thread cache holds. */
+
+/** A block pool thread cache.
+ *  Free blocks kept by one thread, only that thread may use it.  The hit and
+ *  miss counters may be read by other threads.
+ */
+typedef struct {
+    void *blocks[BLOCK_POOL_CACHE_SIZE]; /**< The cached blocks.               */
+    int count;                  /**< Number of cached blocks.                 */
+    uint64_t hits;              /**< Number of blocks reused.                 */
+    uint64_t misses;            /**< Number of blocks allocated.              */
+} block_pool_cache;
+
+/** A block pool structure.
+ *  A pool of reusable, aligned, equally sized blocks.  Threads get and put
+ *  blocks through their own cache, which trades blocks with a shared
+ *  lock-free queue a few at a time.
+ */
+typedef struct {
+    queue free_blocks;          /**< The shared free blocks.                  */
+    size_t block_size;          /**< The size of each block.                  */
+    size_t align;               /**< The alignment of each block.             */
+    int node_id;                /**< NUMA node new blocks are placed on, -1
+                                 *   for any node.
+                                 */
+} block_pool;
+
+int block_pool_init(block_pool *pool, size_t block_size, size_t align,
+                    size_t size, int node_id);
+void block_pool_destroy(block_pool *pool);
+void *block_pool_get(block_pool *pool, block_pool_cache *cache);
+void block_pool_put(block_pool *pool, block_pool_cache *cache, void *block);
+void block_pool_flush(block_pool *pool, block_pool_cache *cache);
+
+/** @} */
+
+#endif      /* BLOCK_POOL_H */
@@ -33,15 +33,77 @@
  *  process.
  */
 
-inline char *char_index(char *haystack, size_t hay_size, char *needle) {
+static inline char *char_index(char *haystack, size_t hay_size,
+                               char *needle) {
     return (char *)memchr(haystack, (int)*needle, hay_size);
 }
-inline char *alp_index(file_st *file, char *needle) {
+static inline char *alp_index(file_st *file, char *needle) {
     brute_force_data_st *bf_st = file->file_data;
     return (char *)memchr(bf_st->alphabet, (int)*needle,
                           strlen(bf_st->alphabet));
 }
 
+/** Private method that finds a record's position in the sequence.
+ *  Records are generated shortest first, then in alphabet order, so a record's
+ *  position is the number of shorter records plus its value in base alp_len.
+ *
+ *  @param[in] file     The file structure.
+ *  @param[in] record   The record.
+ *
+ *  @return             Returns the record's position.
+ */
+static uint64_t bf_rank(file_st *file, char *record) {
+    brute_force_data_st *bf_st = file->file_data;
+    size_t record_len = strlen(record);
+    size_t alp_len = strlen(bf_st->alphabet);
+    uint64_t rank = 0;
+    uint64_t len_records = 1;
+    int i;
+
+    /* Count the shorter records */
+    for (i = 1; i < record_len; i++) {
+        len_records *= alp_len;
+        rank += len_records;
+    }
+
+    /* Add the record's value */
+    len_records = 0;
+    for (i = 0; i < record_len; i++) {
+        len_records = len_records * alp_len +
+                      (alp_index(file, record + i) - bf_st->alphabet);
+    }
+
+    return rank + len_records;
+}
+
+/** Private method that builds the record at a position in the sequence.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[in]  rank    The record's position.
+ *  @param[out] record  The record, must hold strlen(end) + 1 characters.
+ */
+static void bf_unrank(file_st *file, uint64_t rank, char *record) {
+    brute_force_data_st *bf_st = file->file_data;
+    size_t alp_len = strlen(bf_st->alphabet);
+    uint64_t len_records = alp_len;
+    size_t record_len = 1;
+    int i;
+
+    /* Find the record's length */
+    while (rank >= len_records) {
+        rank -= len_records;
+        len_records *= alp_len;
+        record_len++;
+    }
+
+    /* Fill in the record from its last character */
+    record[record_len] = '\0';
+    for (i = record_len - 1; i >= 0; i--) {
+        record[i] = bf_st->alphabet[rank % alp_len];
+        rank /= alp_len;
+    }
+}
+
 /** Initializes a read file structure.
  *  Clears a new read file structure, copies the file path, sets the record
  *  size, and sets up its thread mutex.
@@ -135,6 +197,12 @@ int brute_force_init(file_st *file, int records_per_block, char *start,
     file->next_block = bf_next_block;
     file->free_block = bf_free_block;
     file->close_file = bf_close_file;
+    if (start_len > 0) {
+        /* An empty start has no position to seek from */
+        file->seek = bf_seek;
+    }
+    file->split = bf_split;
+    file->free_parts = bf_free_parts;
 
     return 0;
 }
@@ -159,6 +227,56 @@ void brute_force_destroy(file_st *file) {
     free(bf_st);
 }
 
+/** Narrow the generator to a range of records.
+ *  Makes a generator that has not been opened yet generate count records,
+ *  starting first records after start, or up to end if that comes first.  The
+ *  record size stays the same.
+ *
+ *  @param[in] file     The file structure.
+ *  @param[in] first    The first record, counting from start.
+ *  @param[in] count    The number of records.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int brute_force_range(file_st *file, uint64_t first, uint64_t count) {
+    brute_force_data_st *bf_st = file->file_data;
+    char *range_start;
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t last;
+
+    /* Only narrow a generator with a start that has not started yet */
+    if (strlen(bf_st->start) == 0 || strlen(bf_st->last) != 0 || count == 0) {
+        errno = EINVAL;
+        return E_ATTK_SYSTEM;
+    }
+
+    /* Find the range of records */
+    lo = bf_rank(file, bf_st->start) + first;
+    last = bf_rank(file, bf_st->end);
+    if (lo < first || lo > last) {
+        errno = EINVAL;
+        return E_ATTK_SYSTEM;
+    }
+    hi = lo + count - 1;
+    if (hi < lo || hi > last) {
+        hi = last;
+    }
+
+    /* Move start and end, end is never longer than it was */
+    range_start = malloc(strlen(bf_st->end) + 1);
+    if (range_start == NULL) {
+        return E_ATTK_SYSTEM;
+    }
+    bf_unrank(file, lo, range_start);
+    bf_unrank(file, hi, bf_st->end);
+    free(bf_st->start);
+    bf_st->start = range_start;
+    file->first_record = first;
+
+    return 0;
+}
+
 /** Start the generator.
  *  Calculates the number of words that will be generated.
  *
@@ -264,8 +382,10 @@ ssize_t bf_next_block(file_st *file, char **buf, size_t buf_size) {
         memset(buffer, 0, buf_size);
         *buf = buffer;
     } else {
+        /* Clear the buffer, it may hold longer records from before */
         buf_size = (buf_size / file->record_size) * file->record_size;
         buffer = *buf;
+        memset(buffer, 0, buf_size);
     }
     buf_p = buffer;
 
@@ -286,10 +406,7 @@ ssize_t bf_next_block(file_st *file, char **buf, size_t buf_size) {
 
         /* Find the first char to increase */
         curr_p = last_end_p;
-        while (memcmp(curr_p, alp_end_p, 1) == 0) {
-            if (curr_p < bf_st->last) {
-                break;
-            }
+        while (curr_p >= bf_st->last && *curr_p == *alp_end_p) {
             curr_p--;
         }
         if (curr_p < bf_st->last) {
@@ -350,3 +467,120 @@ int bf_close_file(file_st *file) {
     return 0;
 }
 
+/** Seek to a record.
+ *  Sets the last record generated to the one before record, so the next
+ *  block starts at record.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[in]  record  The record, counting from start.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int bf_seek(file_st *file, uint64_t record) {
+    brute_force_data_st *bf_st = file->file_data;
+
+    memset(bf_st->last, 0, strlen(bf_st->end) + 1);
+    if (record >= file->total_records) {
+        /* Nothing left to generate */
+        memcpy(bf_st->last, bf_st->end, strlen(bf_st->end));
+    } else if (record > 0) {
+        bf_unrank(file, bf_rank(file, bf_st->start) + record - 1,
+                  bf_st->last);
+    }
+
+    return 0;
+}
+
+/** Split the generator.
+ *  Splits the records between start and end into at most n ranges of about
+ *  the same size, each with its own brute force structure.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[in]  n       The maximum number of parts.
+ *  @param[out] parts   The parts, n pointers.
+ *
+ *  @return             Returns the number of parts, 0 if the file can not be
+ *                      split, otherwise an error code.
+ */
+int bf_split(file_st *file, int n, file_st **parts) {
+    brute_force_data_st *bf_st = file->file_data;
+    char *part_start;
+    char *part_end;
+    uint64_t first;
+    uint64_t count;
+    uint64_t lo;
+    uint64_t hi;
+    int part_count = 0;
+    int retval = 0;
+    int i;
+
+    /* Only split a generator that has not started yet */
+    if (strlen(bf_st->start) == 0 || strlen(bf_st->last) != 0) {
+        return 0;
+    }
+
+    /* Find the range of records */
+    first = bf_rank(file, bf_st->start);
+    count = bf_rank(file, bf_st->end) - first + 1;
+    if (n > count) {
+        n = count;
+    }
+
+    /* Create a generator for each part of the range */
+    part_start = malloc(file->record_size);
+    part_end = malloc(file->record_size);
+    if (part_start == NULL || part_end == NULL) {
+        free(part_start);
+        free(part_end);
+        return E_ATTK_SYSTEM;
+    }
+    for (i = 0; i < n; i++) {
+        /* The first count % n parts get a record more, count * i could
+           overflow */
+        lo = first + (count / n) * i + (i < count % n ? i : count % n);
+        hi = lo + count / n + (i < count % n) - 1;
+        bf_unrank(file, lo, part_start);
+        bf_unrank(file, hi, part_end);
+
+        parts[i] = malloc(sizeof(file_st));
+        if (parts[i] == NULL) {
+            bf_free_parts(file, part_count, parts);
+            part_count = E_ATTK_SYSTEM;
+            break;
+        }
+        retval = brute_force_init(parts[i], file->records_per_block,
+                                  part_start, part_end, bf_st->alphabet);
+        if (retval != 0) {
+            free(parts[i]);
+            bf_free_parts(file, part_count, parts);
+            part_count = retval;
+            break;
+        }
+
+        /* Every part uses the whole file's record size, and knows where it
+           starts */
+        parts[i]->record_size = file->record_size;
+        parts[i]->first_record = file->first_record + (lo - first);
+        part_count++;
+    }
+    free(part_start);
+    free(part_end);
+
+    return part_count;
+}
+
+/** Free split parts.
+ *  Destroys and frees the parts made by bf_split.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[in]  n       The number of parts.
+ *  @param[in]  parts   The parts.
+ */
+void bf_free_parts(file_st *file, int n, file_st **parts) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        brute_force_destroy(parts[i]);
+        free(parts[i]);
+    }
+}
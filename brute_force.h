@@ -38,10 +38,14 @@ typedef struct BRUTE_FORCE_DATA_ST {
 int brute_force_init(file_st *file, int records_per_block, char *start,
                      char *end, char *alphabet);
 void brute_force_destroy(file_st *file);
+int brute_force_range(file_st *file, uint64_t first, uint64_t count);
 int bf_open_file(file_st *file);
 ssize_t bf_next_block(file_st *file, char **buf, size_t buf_size);
 int bf_free_block(file_st *file, char *buf, size_t buf_len);
 int bf_close_file(file_st *file);
+int bf_seek(file_st *file, uint64_t record);
+int bf_split(file_st *file, int n, file_st **parts);
+void bf_free_parts(file_st *file, int n, file_st **parts);
 
 /** @} */
 
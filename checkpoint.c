@@ -0,0 +1,344 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+/** @defgroup checkpoint checkpoint
+ *
+ *  Checkpoints of the records that are done.
+ *
+ *  A checkpoint keeps the records of an input that have been checked as a
+ *  sorted list of ranges.  Blocks finish out of order, so each finished block
+ *  is merged into the list, and only the ranges around blocks still in
+ *  flight stay apart.  A checkpoint can be saved to a file and loaded again
+ *  to resume an attack from where it was.
+ */
+
+/** Private method that finds the first range ending at or after a record.
+ *  The caller holds the checkpoint mutex.
+ *
+ *  @param[in] cp       The checkpoint.
+ *  @param[in] record   The record.
+ *
+ *  @return             Returns the range's index, count if there is none.
+ */
+static int checkpoint_find(checkpoint *cp, uint64_t record) {
+    int lo = 0;
+    int hi = cp->count;
+    int mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (cp->ranges[mid * 2 + 1] < record) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+/** Initializes a checkpoint.
+ *  Creates an empty checkpoint, with no records done.
+ *
+ *  @param[in] cp   The checkpoint to initialize.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+int checkpoint_init(checkpoint *cp) {
+    /* Clear the structure */
+    memset(cp, 0, sizeof(checkpoint));
+
+    pthread_mutex_init(&(cp->mut), NULL);
+    pthread_mutex_init(&(cp->save_mut), NULL);
+
+    return 0;
+}
+
+
+/** Destroys a checkpoint.
+ *
+ *  @param[in] cp   The checkpoint to destroy.
+ */
+void checkpoint_destroy(checkpoint *cp) {
+    free(cp->ranges);
+    pthread_mutex_destroy(&(cp->mut));
+    pthread_mutex_destroy(&(cp->save_mut));
+
+    /* Clear the structure */
+    memset(cp, 0, sizeof(checkpoint));
+}
+
+
+/** Mark records done.
+ *  Merges a range of records into the done ranges.  The range may overlap
+ *  records that are already done.
+ *
+ *  @param[in] cp       The checkpoint.
+ *  @param[in] first    The first record.
+ *  @param[in] count    The number of records.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int checkpoint_add(checkpoint *cp, uint64_t first, uint64_t count) {
+    uint64_t end = first + count;
+    uint64_t merged = 0;
+    uint64_t *ranges;
+    int i;
+    int j;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&(cp->mut));
+
+    /* Find the ranges it overlaps or touches */
+    i = checkpoint_find(cp, first);
+    for (j = i; j < cp->count && cp->ranges[j * 2] <= end; j++) {
+        merged += cp->ranges[j * 2 + 1] - cp->ranges[j * 2];
+    }
+
+    if (j > i) {
+        /* Merge them into one */
+        if (cp->ranges[i * 2] < first) {
+            first = cp->ranges[i * 2];
+        }
+        if (cp->ranges[(j - 1) * 2 + 1] > end) {
+            end = cp->ranges[(j - 1) * 2 + 1];
+        }
+        memmove(cp->ranges + (i + 1) * 2, cp->ranges + j * 2,
+                sizeof(uint64_t) * 2 * (cp->count - j));
+        cp->count -= j - i - 1;
+    } else {
+        /* Make room for a new range */
+        if (cp->count == cp->size) {
+            ranges = realloc(cp->ranges, sizeof(uint64_t) * 2 *
+                             (cp->size ? cp->size * 2 : CHECKPOINT_MIN_RANGES));
+            if (ranges == NULL) {
+                pthread_mutex_unlock(&(cp->mut));
+                return CHECKPOINT_E_SYSTEM;
+            }
+            cp->ranges = ranges;
+            cp->size = cp->size ? cp->size * 2 : CHECKPOINT_MIN_RANGES;
+        }
+        memmove(cp->ranges + (i + 1) * 2, cp->ranges + i * 2,
+                sizeof(uint64_t) * 2 * (cp->count - i));
+        cp->count++;
+    }
+    cp->ranges[i * 2] = first;
+    cp->ranges[i * 2 + 1] = end;
+    cp->done += (end - first) - merged;
+
+    pthread_mutex_unlock(&(cp->mut));
+
+    return 0;
+}
+
+
+/** Find the next record to check.
+ *  Finds the first record, at or after record, that is not done.
+ *
+ *  @param[in]  cp      The checkpoint.
+ *  @param[in]  record  The record to start looking from.
+ *  @param[out] end     The first done record after it, UINT64_MAX if there
+ *                      are none.
+ *
+ *  @return             Returns the record.
+ */
+uint64_t checkpoint_next(checkpoint *cp, uint64_t record, uint64_t *end) {
+    int i;
+
+    pthread_mutex_lock(&(cp->mut));
+    i = checkpoint_find(cp, record + 1);
+    if (i < cp->count && cp->ranges[i * 2] <= record) {
+        /* It is done, skip to the end of its range */
+        record = cp->ranges[i * 2 + 1];
+        i++;
+    }
+    *end = i < cp->count ? cp->ranges[i * 2] : UINT64_MAX;
+    pthread_mutex_unlock(&(cp->mut));
+
+    return record;
+}
+
+
+/** Get the number of records done.
+ *
+ *  @param[in] cp   The checkpoint.
+ *
+ *  @return         Returns the number of records done.
+ */
+uint64_t checkpoint_done(checkpoint *cp) {
+    uint64_t done;
+
+    pthread_mutex_lock(&(cp->mut));
+    done = cp->done;
+    pthread_mutex_unlock(&(cp->mut));
+
+    return done;
+}
+
+
+/** Save a checkpoint.
+ *  Writes the done ranges to a new file next to path, syncs it, then renames
+ *  it over path, so a crash leaves either the old or the new checkpoint.
+ *
+ *  @param[in] cp   The checkpoint.
+ *  @param[in] path The checkpoint file.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+int checkpoint_save(checkpoint *cp, const char *path) {
+    checkpoint_header_st header;
+    uint64_t *ranges;
+    size_t ranges_size;
+    char *tmp_path;
+    int fd;
+    int retval = CHECKPOINT_E_SYSTEM;
+    int i;
+
+    pthread_mutex_lock(&(cp->save_mut));
+
+    /* Copy the ranges */
+    pthread_mutex_lock(&(cp->mut));
+    ranges_size = sizeof(uint64_t) * 2 * cp->count;
+    ranges = malloc(ranges_size + 1);
+    if (ranges != NULL) {
+        for (i = 0; i < cp->count * 2; i++) {
+            ranges[i] = htobe64(cp->ranges[i]);
+        }
+    }
+    header.magic = htobe32(CHECKPOINT_MAGIC);
+    header.version = htobe32(CHECKPOINT_VERSION);
+    header.total_records = htobe64(cp->total_records);
+    header.count = htobe64(cp->count);
+    pthread_mutex_unlock(&(cp->mut));
+
+    /* Write them out */
+    tmp_path = malloc(strlen(path) + 5);
+    if (ranges != NULL && tmp_path != NULL) {
+        sprintf(tmp_path, "%s.tmp", path);
+        fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            if (write(fd, &header, sizeof(header)) == sizeof(header) &&
+                write(fd, ranges, ranges_size) == (ssize_t)ranges_size &&
+                fsync(fd) == 0) {
+                retval = 0;
+            }
+            if (close(fd) != 0) {
+                retval = CHECKPOINT_E_SYSTEM;
+            }
+            if (retval == 0 && rename(tmp_path, path) != 0) {
+                retval = CHECKPOINT_E_SYSTEM;
+            }
+            if (retval != 0) {
+                unlink(tmp_path);
+            }
+        }
+    }
+    free(tmp_path);
+    free(ranges);
+
+    pthread_mutex_unlock(&(cp->save_mut));
+
+    return retval;
+}
+
+
+/** Load a checkpoint.
+ *  Replaces the done ranges with the ones saved in a checkpoint file.
+ *
+ *  @param[in] cp   The checkpoint.
+ *  @param[in] path The checkpoint file.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+int checkpoint_load(checkpoint *cp, const char *path) {
+    checkpoint_header_st header;
+    uint64_t *ranges = NULL;
+    uint64_t count;
+    uint64_t done = 0;
+    int fd;
+    int retval = 0;
+    uint64_t i;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return CHECKPOINT_E_SYSTEM;
+    }
+
+    /* Read the header */
+    if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+        be32toh(header.magic) != CHECKPOINT_MAGIC ||
+        be32toh(header.version) != CHECKPOINT_VERSION) {
+        close(fd);
+        return CHECKPOINT_E_INVALID;
+    }
+    count = be64toh(header.count);
+    if (count > INT32_MAX / 2) {
+        close(fd);
+        return CHECKPOINT_E_INVALID;
+    }
+
+    /* Read the ranges, they must be sorted and apart */
+    if (count > 0) {
+        ranges = malloc(sizeof(uint64_t) * 2 * count);
+        if (ranges == NULL) {
+            retval = CHECKPOINT_E_SYSTEM;
+        } else if (read(fd, ranges, sizeof(uint64_t) * 2 * count) !=
+                   (ssize_t)(sizeof(uint64_t) * 2 * count)) {
+            retval = CHECKPOINT_E_INVALID;
+        }
+    }
+    for (i = 0; retval == 0 && i < count * 2; i += 2) {
+        ranges[i] = be64toh(ranges[i]);
+        ranges[i + 1] = be64toh(ranges[i + 1]);
+        if (ranges[i] >= ranges[i + 1] ||
+            (i > 0 && ranges[i] <= ranges[i - 1])) {
+            retval = CHECKPOINT_E_INVALID;
+        }
+        done += ranges[i + 1] - ranges[i];
+    }
+    close(fd);
+    if (retval != 0) {
+        free(ranges);
+        return retval;
+    }
+
+    /* Swap them in */
+    pthread_mutex_lock(&(cp->mut));
+    free(cp->ranges);
+    cp->ranges = ranges;
+    cp->count = count;
+    cp->size = count;
+    cp->done = done;
+    cp->total_records = be64toh(header.total_records);
+    pthread_mutex_unlock(&(cp->mut));
+
+    return 0;
+}
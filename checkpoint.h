@@ -0,0 +1,77 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/** @addtogroup checkpoint
+ *  @{
+ */
+
+#define CHECKPOINT_MAGIC      0x434b5054 /**< Checkpoint file magic, "CKPT".  */
+#define CHECKPOINT_VERSION    1          /**< Checkpoint file version.        */
+#define CHECKPOINT_MIN_RANGES 16         /**< Ranges to make room for first.  */
+
+/*** Errors ***/
+#define CHECKPOINT_E_SYSTEM   -1 /**< A system error occurred, check errno.   */
+#define CHECKPOINT_E_INVALID  -2 /**< The checkpoint file is not valid.       */
+
+/** Checkpoint file header.
+ *  Followed by count pairs of first and end records, all big endian.
+ */
+typedef struct CHECKPOINT_HEADER_ST {
+    uint32_t magic;             /**< CHECKPOINT_MAGIC.                        */
+    uint32_t version;           /**< CHECKPOINT_VERSION.                      */
+    uint64_t total_records;     /**< Records in the input.                    */
+    uint64_t count;             /**< Number of ranges.                        */
+} __attribute__ ((packed)) checkpoint_header_st;
+
+/** A checkpoint structure.
+ *  The records of an input that are done, as sorted ranges that are merged
+ *  as blocks finish, in any order.  The ranges between them are the records
+ *  still to check.
+ */
+typedef struct CHECKPOINT {
+    pthread_mutex_t mut;        /**< Mutex for the ranges.                    */
+    pthread_mutex_t save_mut;   /**< Mutex so saves do not overlap.           */
+    uint64_t *ranges;           /**< Done ranges, pairs of the first record
+                                 *   and the record after the last.
+                                 */
+    int count;                  /**< Number of ranges.                        */
+    int size;                   /**< Number of ranges there is room for.      */
+    uint64_t done;              /**< Number of records in the ranges.         */
+    uint64_t total_records;     /**< Records in the input, 0 if unknown.      */
+} checkpoint;
+
+int checkpoint_init(checkpoint *cp);
+void checkpoint_destroy(checkpoint *cp);
+int checkpoint_add(checkpoint *cp, uint64_t first, uint64_t count);
+uint64_t checkpoint_next(checkpoint *cp, uint64_t record, uint64_t *end);
+uint64_t checkpoint_done(checkpoint *cp);
+int checkpoint_save(checkpoint *cp, const char *path);
+int checkpoint_load(checkpoint *cp, const char *path);
+
+/** @} */
+
+#endif      /* CHECKPOINT_H */
@@ -0,0 +1,1056 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "distribute.h"
+
+/** @defgroup distribute distribute
+ *
+ *  Spread an attack over several processes or machines.
+ *
+ *  A coordinator splits the records of an input into units, ranges of record
+ *  numbers, and leases them to workers over TCP or a Unix socket.  Each
+ *  worker runs a normal attack on the records of its unit, for example a
+ *  brute_force generator narrowed with brute_force_range, or a read_file
+ *  opened with skip_records and count_records.  Workers say they are alive
+ *  while they work, a unit whose worker goes quiet or disconnects is leased
+ *  to the next worker that asks.  The first match, or the last unit done,
+ *  stops every worker.
+ *
+ *  Addresses are "unix:PATH", or "HOST:PORT" with an optional "tcp:" in
+ *  front.  A coordinator listens on every address when HOST is empty or "*".
+ */
+
+/** Private method that gets the current time.
+ *
+ *  @return Returns the monotonic time in milliseconds.
+ */
+static uint64_t dist_now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/** Private method that opens a socket for an address.
+ *  Either listens on it, or connects to it.
+ *
+ *  @param[in]  address     The address.
+ *  @param[in]  listening   Non-zero to listen, otherwise connect.
+ *  @param[out] unix_path   Set to a copy of the Unix socket path when
+ *                          listening on one, may be NULL when connecting.
+ *
+ *  @return                 Returns the socket, otherwise an error code.
+ */
+static int dist_socket(const char *address, int listening, char **unix_path) {
+    struct sockaddr_un sun;
+    struct addrinfo hints;
+    struct addrinfo *res;
+    struct addrinfo *ai;
+    char *host;
+    char *port;
+    int fd;
+    int one = 1;
+    int retval;
+
+    if (strncmp(address, "unix:", 5) == 0) {
+        /* A Unix socket */
+        address += 5;
+        if (strlen(address) == 0 || strlen(address) >= sizeof(sun.sun_path)) {
+            return DIST_E_ADDRESS;
+        }
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, address);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return DIST_E_SYSTEM;
+        }
+        if (listening) {
+            /* Take over a socket left behind by an old coordinator */
+            unlink(address);
+            retval = bind(fd, (struct sockaddr *)&sun, sizeof(sun));
+            if (retval == 0) {
+                retval = listen(fd, DIST_BACKLOG);
+            }
+            if (retval == 0) {
+                *unix_path = strdup(address);
+            }
+        } else {
+            retval = connect(fd, (struct sockaddr *)&sun, sizeof(sun));
+        }
+        if (retval != 0) {
+            close(fd);
+            return DIST_E_SYSTEM;
+        }
+        return fd;
+    }
+
+    /* A TCP socket, split the host and port */
+    if (strncmp(address, "tcp:", 4) == 0) {
+        address += 4;
+    }
+    host = strdup(address);
+    if (host == NULL) {
+        return DIST_E_SYSTEM;
+    }
+    port = strrchr(host, ':');
+    if (port == NULL || strlen(port + 1) == 0) {
+        free(host);
+        return DIST_E_ADDRESS;
+    }
+    *port++ = '\0';
+    if (host[0] == '[' && strlen(host) > 1 && host[strlen(host) - 1] == ']') {
+        /* An IPv6 address */
+        host[strlen(host) - 1] = '\0';
+        memmove(host, host + 1, strlen(host));
+    }
+
+    /* Look it up */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    if (getaddrinfo(strlen(host) == 0 || strcmp(host, "*") == 0 ? NULL : host,
+                    port, &hints, &res) != 0) {
+        free(host);
+        return DIST_E_ADDRESS;
+    }
+    free(host);
+
+    /* Use the first one that works */
+    fd = DIST_E_SYSTEM;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                    ai->ai_protocol);
+        if (fd < 0) {
+            fd = DIST_E_SYSTEM;
+            continue;
+        }
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            retval = bind(fd, ai->ai_addr, ai->ai_addrlen);
+            if (retval == 0) {
+                retval = listen(fd, DIST_BACKLOG);
+            }
+        } else {
+            retval = connect(fd, ai->ai_addr, ai->ai_addrlen);
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        if (retval == 0) {
+            break;
+        }
+        close(fd);
+        fd = DIST_E_SYSTEM;
+    }
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+
+/** Private method that sends a message.
+ *  On a non-blocking socket a message that does not fit in the socket buffer
+ *  is an error, messages are small so only a stuck peer fills it.
+ *
+ *  @param[in] fd       The socket.
+ *  @param[in] type     The DIST_MSG_* type.
+ *  @param[in] payload  The payload, already big endian.
+ *  @param[in] size     The payload size.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+static int dist_send(int fd, uint32_t type, const void *payload,
+                     uint32_t size) {
+    char msg[sizeof(dist_msg_header) + DIST_MAX_PAYLOAD];
+    dist_msg_header *header = (dist_msg_header *)msg;
+    size_t msg_size = sizeof(dist_msg_header) + size;
+    size_t sent = 0;
+    ssize_t n;
+
+    header->type = htobe32(type);
+    header->size = htobe32(size);
+    if (size > 0) {
+        memcpy(msg + sizeof(dist_msg_header), payload, size);
+    }
+
+    while (sent < msg_size) {
+        n = send(fd, msg + sent, msg_size - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return DIST_E_SYSTEM;
+        }
+        sent += n;
+    }
+
+    return 0;
+}
+
+
+/** Private method that reads exactly size bytes from a blocking socket.
+ *
+ *  @param[in]  fd      The socket.
+ *  @param[out] buf     The buffer.
+ *  @param[in]  size    The number of bytes.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+static int dist_read_full(int fd, void *buf, size_t size) {
+    size_t got = 0;
+    ssize_t n;
+
+    while (got < size) {
+        n = read(fd, (char *)buf + got, size - got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            return DIST_E_SYSTEM;
+        } else if (n == 0) {
+            return DIST_E_CLOSED;
+        }
+        got += n;
+    }
+
+    return 0;
+}
+
+
+/** Private method that receives a message on a blocking socket.
+ *
+ *  @param[in]  fd          The socket.
+ *  @param[out] type        The DIST_MSG_* type.
+ *  @param[out] payload     The payload, still big endian.
+ *  @param[in]  max_size    The size of payload.
+ *  @param[out] size        The payload size.
+ *
+ *  @return                 Returns 0 on success, otherwise an error code.
+ */
+static int dist_recv(int fd, uint32_t *type, void *payload, size_t max_size,
+                     uint32_t *size) {
+    dist_msg_header header;
+    int retval;
+
+    retval = dist_read_full(fd, &header, sizeof(header));
+    if (retval != 0) {
+        return retval;
+    }
+    *type = be32toh(header.type);
+    *size = be32toh(header.size);
+    if (*size > max_size) {
+        return DIST_E_PROTOCOL;
+    }
+
+    return dist_read_full(fd, payload, *size);
+}
+
+
+/** Initializes a coordinator.
+ *  Starts listening on address.  Units are unit_records records long, except
+ *  maybe the last one.
+ *
+ *  @param[in] dc               The coordinator.
+ *  @param[in] address          The address to listen on.
+ *  @param[in] total_records    The number of records in the input.
+ *  @param[in] unit_records     The number of records per unit.
+ *  @param[in] lease_ms         Milliseconds a worker may go quiet before its
+ *                              unit is leased again, 0 for DIST_LEASE_MS.
+ *
+ *  @return                     Returns 0 on success, otherwise an error code.
+ */
+int dist_coordinator_init(dist_coordinator *dc, const char *address,
+                          uint64_t total_records, uint64_t unit_records,
+                          uint32_t lease_ms) {
+    #ifdef DEBUG
+    printf("dist_coordinator_init: START\n");
+    #endif
+
+    /* Clear the structure */
+    memset(dc, 0, sizeof(dist_coordinator));
+    dc->listen_fd = dc->wake[0] = dc->wake[1] = -1;
+
+    /* Sanity check */
+    if (unit_records == 0) {
+        errno = EINVAL;
+        return DIST_E_SYSTEM;
+    }
+
+    /* Set defaults */
+    dc->total_records = total_records;
+    dc->unit_records = unit_records;
+    dc->lease_ms = lease_ms > 0 ? lease_ms : DIST_LEASE_MS;
+
+    /* Create the poll set, the listener and the wake pipe come first */
+    dc->conn_size = 8;
+    dc->conns = malloc(sizeof(dist_conn) * dc->conn_size);
+    dc->fds = malloc(sizeof(struct pollfd) * (dc->conn_size + 2));
+    if (dc->conns == NULL || dc->fds == NULL ||
+        pipe2(dc->wake, O_NONBLOCK | O_CLOEXEC) != 0) {
+        dist_coordinator_destroy(dc);
+        return DIST_E_SYSTEM;
+    }
+
+    /* Listen */
+    dc->listen_fd = dist_socket(address, 1, &(dc->unix_path));
+    if (dc->listen_fd < 0) {
+        int retval = dc->listen_fd;
+
+        dist_coordinator_destroy(dc);
+        return retval;
+    }
+    dc->fds[0].fd = dc->listen_fd;
+    dc->fds[0].events = POLLIN;
+    dc->fds[1].fd = dc->wake[0];
+    dc->fds[1].events = POLLIN;
+
+    return 0;
+}
+
+
+/** Destroys a coordinator.
+ *  Closes any connections left and stops listening.
+ *
+ *  @param[in] dc   The coordinator.
+ */
+void dist_coordinator_destroy(dist_coordinator *dc) {
+    int i;
+
+    #ifdef DEBUG
+    printf("dist_coordinator_destroy: START\n");
+    #endif
+
+    for (i = 0; i < dc->conn_count; i++) {
+        close(dc->conns[i].fd);
+        free(dc->conns[i].in);
+    }
+    if (dc->listen_fd >= 0) {
+        close(dc->listen_fd);
+    }
+    if (dc->unix_path != NULL) {
+        unlink(dc->unix_path);
+        free(dc->unix_path);
+    }
+    if (dc->wake[0] >= 0) {
+        close(dc->wake[0]);
+        close(dc->wake[1]);
+    }
+    free(dc->conns);
+    free(dc->fds);
+    free(dc->requeued);
+    free(dc->result);
+    memset(dc, 0, sizeof(dist_coordinator));
+    dc->listen_fd = dc->wake[0] = dc->wake[1] = -1;
+}
+
+
+/** Private method that checks if every unit is done.
+ *
+ *  @param[in] dc   The coordinator.
+ *
+ *  @return         Returns non-zero if every unit is done.
+ */
+static int dist_finished(dist_coordinator *dc) {
+    int i;
+
+    if (dc->next_record < dc->total_records || dc->requeued_count > 0) {
+        return 0;
+    }
+    for (i = 0; i < dc->conn_count; i++) {
+        if (dc->conns[i].id != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/** Private method that takes a unit back from a connection.
+ *  Puts the connection's unit, if it has one, on the list to lease again.
+ *
+ *  @param[in] dc   The coordinator.
+ *  @param[in] conn The connection.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int dist_release(dist_coordinator *dc, dist_conn *conn) {
+    uint64_t *requeued;
+
+    if (conn->id == 0) {
+        return 0;
+    }
+
+    /* Make room */
+    if (dc->requeued_count == dc->requeued_size) {
+        requeued = realloc(dc->requeued, sizeof(uint64_t) * 2 *
+                           (dc->requeued_size ? dc->requeued_size * 2 : 8));
+        if (requeued == NULL) {
+            return DIST_E_SYSTEM;
+        }
+        dc->requeued = requeued;
+        dc->requeued_size = dc->requeued_size ? dc->requeued_size * 2 : 8;
+    }
+
+    dc->requeued[dc->requeued_count * 2] = conn->first;
+    dc->requeued[dc->requeued_count * 2 + 1] = conn->count;
+    dc->requeued_count++;
+    dc->units_expired++;
+    conn->id = 0;
+
+    return 0;
+}
+
+
+/** Private method that closes a connection.
+ *  Takes back its unit, then moves the last connection into its place.
+ *
+ *  @param[in] dc   The coordinator.
+ *  @param[in] i    The connection's index.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int dist_close(dist_coordinator *dc, int i) {
+    int retval;
+
+    #ifdef DEBUG
+    printf("dist_close: closing connection %d\n", dc->conns[i].fd);
+    #endif
+
+    retval = dist_release(dc, &(dc->conns[i]));
+    close(dc->conns[i].fd);
+    free(dc->conns[i].in);
+
+    dc->conn_count--;
+    dc->conns[i] = dc->conns[dc->conn_count];
+    dc->fds[i + 2] = dc->fds[dc->conn_count + 2];
+
+    return retval;
+}
+
+
+/** Private method that accepts a new connection.
+ *
+ *  @param[in] dc   The coordinator.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int dist_accept(dist_coordinator *dc) {
+    dist_conn *conns;
+    struct pollfd *fds;
+    dist_conn *conn;
+    int one = 1;
+    int fd;
+
+    fd = accept4(dc->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        /* Not fatal, the worker can try again */
+        return 0;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    /* Make room */
+    if (dc->conn_count == dc->conn_size) {
+        conns = realloc(dc->conns, sizeof(dist_conn) * dc->conn_size * 2);
+        if (conns != NULL) {
+            dc->conns = conns;
+        }
+        fds = realloc(dc->fds, sizeof(struct pollfd) *
+                               (dc->conn_size * 2 + 2));
+        if (fds != NULL) {
+            dc->fds = fds;
+        }
+        if (conns == NULL || fds == NULL) {
+            close(fd);
+            return DIST_E_SYSTEM;
+        }
+        dc->conn_size *= 2;
+    }
+
+    /* Add the connection */
+    conn = &(dc->conns[dc->conn_count]);
+    memset(conn, 0, sizeof(dist_conn));
+    conn->fd = fd;
+    conn->in = malloc(sizeof(dist_msg_header) + DIST_MAX_PAYLOAD);
+    if (conn->in == NULL) {
+        close(fd);
+        return DIST_E_SYSTEM;
+    }
+    dc->fds[dc->conn_count + 2].fd = fd;
+    dc->fds[dc->conn_count + 2].events = POLLIN;
+    dc->fds[dc->conn_count + 2].revents = 0;
+    dc->conn_count++;
+
+    return 0;
+}
+
+
+/** Private method that leases a unit to a connection.
+ *  Units taken back from other workers go first.
+ *
+ *  @param[in] dc   The coordinator.
+ *  @param[in] conn The connection.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int dist_lease(dist_coordinator *dc, dist_conn *conn) {
+    dist_unit_msg unit;
+    uint32_t wait_ms;
+
+    /* Pick a unit */
+    if (dc->requeued_count > 0) {
+        dc->requeued_count--;
+        conn->first = dc->requeued[dc->requeued_count * 2];
+        conn->count = dc->requeued[dc->requeued_count * 2 + 1];
+    } else if (dc->next_record < dc->total_records) {
+        conn->first = dc->next_record;
+        conn->count = dc->total_records - dc->next_record;
+        if (conn->count > dc->unit_records) {
+            conn->count = dc->unit_records;
+        }
+        dc->next_record += conn->count;
+    } else {
+        /* Every unit is out, ask again later in case one comes back */
+        wait_ms = htobe32(DIST_WAIT_MS);
+        return dist_send(conn->fd, DIST_MSG_WAIT, &wait_ms, sizeof(wait_ms));
+    }
+    conn->id = ++dc->next_id;
+    conn->deadline = dist_now_ms() + dc->lease_ms;
+
+    #ifdef DEBUG
+    printf("dist_lease: unit %lu, records %lu+%lu\n", conn->id, conn->first,
+           conn->count);
+    #endif
+
+    /* Send it */
+    unit.id = htobe64(conn->id);
+    unit.first = htobe64(conn->first);
+    unit.count = htobe64(conn->count);
+    unit.lease_ms = htobe32(dc->lease_ms);
+    return dist_send(conn->fd, DIST_MSG_UNIT, &unit, sizeof(unit));
+}
+
+
+/** Private method that handles a message from a worker.
+ *
+ *  @param[in] dc       The coordinator.
+ *  @param[in] conn     The worker's connection.
+ *  @param[in] type     The DIST_MSG_* type.
+ *  @param[in] payload  The payload, still big endian.
+ *  @param[in] size     The payload size.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+static int dist_handle(dist_coordinator *dc, dist_conn *conn, uint32_t type,
+                       char *payload, uint32_t size) {
+    dist_done_msg done;
+    uint64_t id;
+    char *result;
+
+    if (type == DIST_MSG_GET && size == 0 && conn->id == 0) {
+        /* Lease a unit */
+        if (dc->stopping) {
+            return dist_send(conn->fd, DIST_MSG_STOP, NULL, 0);
+        }
+        return dist_lease(dc, conn);
+    } else if ((type == DIST_MSG_ALIVE || type == DIST_MSG_DONE) &&
+               size == sizeof(dist_done_msg)) {
+        memcpy(&done, payload, sizeof(done));
+        if (conn->id == 0 || be64toh(done.id) != conn->id) {
+            /* Not the unit this worker has, ignore it */
+            return 0;
+        }
+        if (type == DIST_MSG_ALIVE) {
+            /* Extend the lease */
+            conn->deadline = dist_now_ms() + dc->lease_ms;
+        } else {
+            /* The unit is done */
+            dc->records_done += conn->count;
+            dc->records_tested += be64toh(done.records_tested);
+            dc->units_done++;
+            conn->id = 0;
+            if (dist_finished(dc)) {
+                dc->stopping = 1;
+            }
+        }
+        return 0;
+    } else if (type == DIST_MSG_MATCH && size > sizeof(uint64_t)) {
+        memcpy(&id, payload, sizeof(id));
+
+        #ifdef DEBUG
+        printf("dist_handle: match in unit %lu\n", be64toh(id));
+        #endif
+
+        /* Keep the first answer and stop */
+        if (dc->result == NULL) {
+            result = malloc(size - sizeof(uint64_t));
+            if (result == NULL) {
+                return DIST_E_SYSTEM;
+            }
+            memcpy(result, payload + sizeof(uint64_t), size - sizeof(uint64_t));
+            dc->result = result;
+            dc->result_size = size - sizeof(uint64_t);
+        }
+        if (conn->id == be64toh(id)) {
+            conn->id = 0;
+        }
+        dc->stopping = 1;
+        return 0;
+    }
+
+    return DIST_E_PROTOCOL;
+}
+
+
+/** Private method that reads from a connection and handles its messages.
+ *
+ *  @param[in] dc   The coordinator.
+ *  @param[in] conn The connection.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int dist_read(dist_coordinator *dc, dist_conn *conn) {
+    dist_msg_header header;
+    size_t msg_size;
+    ssize_t n;
+    int retval;
+
+    n = read(conn->fd, conn->in + conn->in_size,
+             sizeof(dist_msg_header) + DIST_MAX_PAYLOAD - conn->in_size);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return 0;
+    } else if (n < 0) {
+        return DIST_E_SYSTEM;
+    } else if (n == 0) {
+        return DIST_E_CLOSED;
+    }
+    conn->in_size += n;
+
+    /* Handle every whole message */
+    while (conn->in_size >= sizeof(dist_msg_header)) {
+        memcpy(&header, conn->in, sizeof(header));
+        if (be32toh(header.size) > DIST_MAX_PAYLOAD) {
+            return DIST_E_PROTOCOL;
+        }
+        msg_size = sizeof(header) + be32toh(header.size);
+        if (conn->in_size < msg_size) {
+            break;
+        }
+
+        retval = dist_handle(dc, conn, be32toh(header.type),
+                             conn->in + sizeof(header), be32toh(header.size));
+        if (retval != 0) {
+            return retval;
+        }
+
+        conn->in_size -= msg_size;
+        memmove(conn->in, conn->in + msg_size, conn->in_size);
+    }
+
+    return 0;
+}
+
+
+/** Run a coordinator.
+ *  Leases units to workers until every unit is done, a worker finds the
+ *  answer, or dist_coordinator_stop is called, then tells every worker to
+ *  stop.  The answer, if any, is left in result.
+ *
+ *  @param[in] dc   The coordinator.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+int dist_coordinator_run(dist_coordinator *dc) {
+    uint64_t now;
+    uint64_t deadline;
+    int timeout;
+    char wake_buf[64];
+    int retval = 0;
+    int i;
+
+    #ifdef DEBUG
+    printf("dist_coordinator_run: START\n");
+    #endif
+
+    if (dist_finished(dc)) {
+        /* Nothing to lease */
+        dc->stopping = 1;
+    }
+
+    while (!dc->stopping && retval == 0) {
+        /* Sleep until the next lease runs out */
+        deadline = UINT64_MAX;
+        for (i = 0; i < dc->conn_count; i++) {
+            if (dc->conns[i].id != 0 && dc->conns[i].deadline < deadline) {
+                deadline = dc->conns[i].deadline;
+            }
+        }
+        now = dist_now_ms();
+        if (deadline == UINT64_MAX) {
+            timeout = -1;
+        } else {
+            timeout = deadline > now ? deadline - now : 0;
+        }
+        if (poll(dc->fds, dc->conn_count + 2, timeout) < 0 && errno != EINTR) {
+            retval = DIST_E_SYSTEM;
+            break;
+        }
+
+        /* Stop if asked to */
+        if (dc->fds[1].revents & POLLIN) {
+            while (read(dc->wake[0], wake_buf, sizeof(wake_buf)) > 0);
+            dc->stopping = 1;
+        }
+
+        /* Handle the workers, from the last so closing one does not skip
+           another, and take back units whose lease ran out */
+        now = dist_now_ms();
+        for (i = dc->conn_count - 1; i >= 0 && retval == 0; i--) {
+            if ((dc->fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                dist_read(dc, &(dc->conns[i])) != 0) {
+                retval = dist_close(dc, i);
+            } else if (dc->conns[i].id != 0 && dc->conns[i].deadline <= now) {
+                #ifdef DEBUG
+                printf("dist_coordinator_run: unit %lu lease ran out\n",
+                       dc->conns[i].id);
+                #endif
+                retval = dist_close(dc, i);
+            }
+        }
+
+        /* Take new workers */
+        if (retval == 0 && (dc->fds[0].revents & POLLIN)) {
+            retval = dist_accept(dc);
+        }
+    }
+
+    /* Stop every worker */
+    for (i = dc->conn_count - 1; i >= 0; i--) {
+        dist_send(dc->conns[i].fd, DIST_MSG_STOP, NULL, 0);
+        dc->conns[i].id = 0;
+        dist_close(dc, i);
+    }
+
+    return retval;
+}
+
+
+/** Stop a coordinator.
+ *  Makes dist_coordinator_run stop every worker and return, safe to call
+ *  from any thread or a signal handler.
+ *
+ *  @param[in] dc   The coordinator.
+ */
+void dist_coordinator_stop(dist_coordinator *dc) {
+    char c = 0;
+
+    if (write(dc->wake[1], &c, 1) < 0) {
+        /* The pipe is full, so a stop is already on its way */
+    }
+}
+
+
+/** Private method that is the callback for a worker's attack.
+ *  Wakes up the worker.
+ *
+ *  @param[in] attk_st  The attack object.
+ *
+ *  @return             Returns 0.
+ */
+static int dist_worker_callback(attack_st *attk_st) {
+    dist_worker *dw = attk_st->callback_data;
+    char c = 0;
+
+    if (write(dw->done[1], &c, 1) < 0) {
+        /* The worker also sees the attack stop when its lease is renewed */
+    }
+    return 0;
+}
+
+
+/** Initializes a worker.
+ *
+ *  @param[in] dw       The worker.
+ *  @param[in] setup    Sets up the attack and input file for a unit.
+ *  @param[in] teardown Destroys what setup made.
+ *  @param[in] data     Data passed to setup and teardown.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int dist_worker_init(dist_worker *dw,
+                     int (*setup)(attack_st *attk_st, file_st *file_in,
+                                  uint64_t first, uint64_t count, void *data),
+                     void (*teardown)(attack_st *attk_st, file_st *file_in,
+                                      void *data),
+                     void *data) {
+    #ifdef DEBUG
+    printf("dist_worker_init: START\n");
+    #endif
+
+    /* Clear the structure */
+    memset(dw, 0, sizeof(dist_worker));
+    dw->fd = -1;
+
+    /* Set defaults */
+    dw->setup = setup;
+    dw->teardown = teardown;
+    dw->data = data;
+
+    if (pipe2(dw->done, O_CLOEXEC) != 0) {
+        return DIST_E_SYSTEM;
+    }
+
+    return 0;
+}
+
+
+/** Destroys a worker.
+ *
+ *  @param[in] dw   The worker.
+ */
+void dist_worker_destroy(dist_worker *dw) {
+    #ifdef DEBUG
+    printf("dist_worker_destroy: START\n");
+    #endif
+
+    if (dw->fd >= 0) {
+        close(dw->fd);
+    }
+    close(dw->done[0]);
+    close(dw->done[1]);
+    free(dw->result);
+    memset(dw, 0, sizeof(dist_worker));
+    dw->fd = -1;
+}
+
+
+/** Private method that runs an attack on one unit.
+ *  Tells the coordinator it is alive while the attack runs, and stops the
+ *  attack if the coordinator says to.
+ *
+ *  @param[in] dw   The worker.
+ *  @param[in] unit The unit, still big endian.
+ *
+ *  @return         Returns 0 to ask for another unit, 1 if the coordinator
+ *                  said to stop, otherwise an error code.
+ */
+static int dist_worker_unit(dist_worker *dw, dist_unit_msg *unit) {
+    attack_st attk_st;
+    file_st file_in;
+    attack_status status;
+    struct pollfd fds[2];
+    dist_done_msg done;
+    char msg[sizeof(uint64_t) + DIST_MAX_PAYLOAD];
+    uint32_t type;
+    uint32_t size;
+    int interval;
+    int stopped = 0;
+    int retval = 0;
+    char c;
+
+    #ifdef DEBUG
+    printf("dist_worker_unit: unit %lu, records %lu+%lu\n", be64toh(unit->id),
+           be64toh(unit->first), be64toh(unit->count));
+    #endif
+
+    /* Set up the attack */
+    retval = dw->setup(&attk_st, &file_in, be64toh(unit->first),
+                       be64toh(unit->count), dw->data);
+    if (retval != 0) {
+        return retval;
+    }
+    attk_st.callback = dist_worker_callback;
+    attk_st.callback_data = dw;
+
+    /* Run it, saying we are alive three times a lease */
+    interval = be32toh(unit->lease_ms) / 3;
+    if (interval < 1) {
+        interval = 1;
+    }
+    done.id = unit->id;
+    fds[0].fd = dw->done[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = dw->fd;
+    fds[1].events = POLLIN;
+    if (start_attack(&attk_st) != 0) {
+        dw->teardown(&attk_st, &file_in, dw->data);
+        return DIST_E_SYSTEM;
+    }
+    while (1) {
+        if (poll(fds, stopped ? 1 : 2, interval) < 0 && errno != EINTR) {
+            /* Keep waiting for the attack, without the coordinator */
+            stopped = 1;
+            retval = DIST_E_SYSTEM;
+            stop_attack(&attk_st);
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            /* The attack is over */
+            if (read(dw->done[0], &c, 1) == 1) {
+                break;
+            }
+        } else if (!stopped && (fds[1].revents & (POLLIN | POLLHUP))) {
+            /* The coordinator said something, it can only be stop */
+            retval = dist_recv(dw->fd, &type, msg, sizeof(msg), &size);
+            if (retval == 0) {
+                retval = type == DIST_MSG_STOP ? 1 : DIST_E_PROTOCOL;
+            }
+            stopped = 1;
+            stop_attack(&attk_st);
+        } else if (!stopped) {
+            /* Still alive */
+            memset(&status, 0, sizeof(status));
+            check_attack(&attk_st, &status);
+            done.records_tested = htobe64(status.records_tested);
+            if (dist_send(dw->fd, DIST_MSG_ALIVE, &done, sizeof(done)) != 0) {
+                stopped = 1;
+                retval = DIST_E_SYSTEM;
+                stop_attack(&attk_st);
+            }
+        }
+    }
+    pthread_join(attk_st.main, NULL);
+
+    /* Report back, the answer has to fit in a message after the unit id */
+    memset(&status, 0, sizeof(status));
+    status.result = msg + sizeof(uint64_t);
+    status.result_size = file_in.record_size;
+    if (status.result_size > DIST_MAX_PAYLOAD - sizeof(uint64_t)) {
+        status.result_size = DIST_MAX_PAYLOAD - sizeof(uint64_t);
+    }
+    check_attack(&attk_st, &status);
+    dw->records_tested += status.records_tested;
+    if (status.result_size > 0) {
+        /* Send the answer, even if the coordinator is stopping */
+        if (dw->result == NULL) {
+            dw->result = malloc(status.result_size);
+            if (dw->result != NULL) {
+                memcpy(dw->result, status.result, status.result_size);
+                dw->result_size = status.result_size;
+            }
+        }
+        memcpy(msg, &(unit->id), sizeof(uint64_t));
+        if (dist_send(dw->fd, DIST_MSG_MATCH, msg,
+                      sizeof(uint64_t) + status.result_size) != 0 &&
+            retval == 0) {
+            retval = DIST_E_SYSTEM;
+        }
+
+        /* The coordinator stops every worker on an answer */
+        if (retval == 0) {
+            retval = dist_recv(dw->fd, &type, msg, sizeof(msg), &size);
+            if (retval == 0) {
+                retval = type == DIST_MSG_STOP ? 1 : DIST_E_PROTOCOL;
+            }
+        }
+    } else if (attk_st.error != 0 && retval == 0) {
+        /* Give up, the coordinator will lease the unit again */
+        retval = attk_st.error;
+    } else if (!stopped) {
+        /* The unit is done */
+        dw->units_done++;
+        done.records_tested = htobe64(status.records_tested);
+        retval = dist_send(dw->fd, DIST_MSG_DONE, &done, sizeof(done));
+    }
+    dw->teardown(&attk_st, &file_in, dw->data);
+
+    return retval;
+}
+
+
+/** Run a worker.
+ *  Connects to the coordinator at address and attacks the units it leases
+ *  until it says to stop.  The answer, if this worker found it, is left in
+ *  result.
+ *
+ *  @param[in] dw       The worker.
+ *  @param[in] address  The coordinator's address.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int dist_worker_run(dist_worker *dw, const char *address) {
+    char msg[DIST_MAX_PAYLOAD];
+    struct pollfd fds;
+    uint32_t type;
+    uint32_t size;
+    uint32_t wait_ms;
+    int retval;
+
+    #ifdef DEBUG
+    printf("dist_worker_run: START\n");
+    #endif
+
+    /* Connect */
+    dw->fd = dist_socket(address, 0, NULL);
+    if (dw->fd < 0) {
+        retval = dw->fd;
+        dw->fd = -1;
+        return retval;
+    }
+
+    do {
+        /* Ask for a unit */
+        retval = dist_send(dw->fd, DIST_MSG_GET, NULL, 0);
+        if (retval == 0) {
+            retval = dist_recv(dw->fd, &type, msg, sizeof(msg), &size);
+        }
+        if (retval != 0) {
+            break;
+        }
+
+        if (type == DIST_MSG_UNIT && size == sizeof(dist_unit_msg)) {
+            /* Attack it */
+            retval = dist_worker_unit(dw, (dist_unit_msg *)msg);
+        } else if (type == DIST_MSG_WAIT && size == sizeof(uint32_t)) {
+            /* Wait, unless the coordinator stops first */
+            memcpy(&wait_ms, msg, sizeof(wait_ms));
+            fds.fd = dw->fd;
+            fds.events = POLLIN;
+            if (poll(&fds, 1, be32toh(wait_ms)) > 0) {
+                retval = dist_recv(dw->fd, &type, msg, sizeof(msg), &size);
+                if (retval == 0) {
+                    retval = type == DIST_MSG_STOP ? 1 : DIST_E_PROTOCOL;
+                }
+            }
+        } else if (type == DIST_MSG_STOP) {
+            retval = 1;
+        } else {
+            retval = DIST_E_PROTOCOL;
+        }
+    } while (retval == 0);
+
+    close(dw->fd);
+    dw->fd = -1;
+
+    return retval == 1 ? 0 : retval;
+}
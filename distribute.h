@@ -0,0 +1,189 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef DISTRIBUTE_H
+#define DISTRIBUTE_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <poll.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "libattkthread.h"
+
+/** @addtogroup distribute
+ *  @{
+ */
+
+#define DIST_LEASE_MS       30000   /**< Default milliseconds a worker may go
+                                     *   quiet before its unit is leased again.
+                                     */
+#define DIST_WAIT_MS        1000    /**< Milliseconds a worker waits before
+                                     *   asking again when every unit is out.
+                                     */
+#define DIST_MAX_PAYLOAD    65536   /**< Largest message payload.          */
+#define DIST_BACKLOG        64      /**< Listen backlog.                   */
+
+/*** Messages ***/
+#define DIST_MSG_GET        1       /**< Worker asks for a unit, no payload. */
+#define DIST_MSG_UNIT       2       /**< Coordinator leases a unit, payload
+                                     *   is dist_unit_msg.
+                                     */
+#define DIST_MSG_WAIT       3       /**< Coordinator has no unit right now,
+                                     *   payload is the milliseconds to wait
+                                     *   as a uint32_t.
+                                     */
+#define DIST_MSG_ALIVE      4       /**< Worker is still on its unit, payload
+                                     *   is dist_done_msg.
+                                     */
+#define DIST_MSG_DONE       5       /**< Worker finished its unit, payload is
+                                     *   dist_done_msg.
+                                     */
+#define DIST_MSG_MATCH      6       /**< Worker found the answer, payload is
+                                     *   the unit id as a uint64_t followed by
+                                     *   the result record.
+                                     */
+#define DIST_MSG_STOP       7       /**< Coordinator is done, every worker
+                                     *   stops, no payload.
+                                     */
+
+/*** Errors ***/
+#define DIST_E_SYSTEM       -1      /**< A system error occurred, check
+                                     *   errno.
+                                     */
+#define DIST_E_ADDRESS      -2      /**< The address is not valid.         */
+#define DIST_E_PROTOCOL     -3      /**< The other side sent a message that
+                                     *   is not valid.
+                                     */
+#define DIST_E_CLOSED       -4      /**< The other side closed the
+                                     *   connection.
+                                     */
+
+/** Message header.
+ *  Followed by size bytes of payload, everything is big endian.
+ */
+typedef struct DIST_MSG_HEADER {
+    uint32_t type;              /**< DIST_MSG_* type.                         */
+    uint32_t size;              /**< Payload size.                            */
+} __attribute__ ((packed)) dist_msg_header;
+
+/** Unit message payload. */
+typedef struct DIST_UNIT_MSG {
+    uint64_t id;                /**< Unit id, unique for each lease.          */
+    uint64_t first;             /**< First record of the unit.                */
+    uint64_t count;             /**< Number of records in the unit.           */
+    uint32_t lease_ms;          /**< Milliseconds the worker may go quiet.    */
+} __attribute__ ((packed)) dist_unit_msg;
+
+/** Done and alive message payload. */
+typedef struct DIST_DONE_MSG {
+    uint64_t id;                /**< Unit id.                                 */
+    uint64_t records_tested;    /**< Records tested so far in the unit.       */
+} __attribute__ ((packed)) dist_done_msg;
+
+/** A coordinator's connection to one worker. */
+typedef struct DIST_CONN {
+    int fd;                     /**< Socket.                                  */
+    char *in;                   /**< Bytes read but not handled yet.          */
+    size_t in_size;             /**< Number of bytes in in.                   */
+    uint64_t id;                /**< Leased unit id, 0 for none.              */
+    uint64_t first;             /**< Leased unit's first record.              */
+    uint64_t count;             /**< Leased unit's record count.              */
+    uint64_t deadline;          /**< When the lease runs out, in ms.          */
+} dist_conn;
+
+/** A coordinator structure.
+ *  Splits the records of an input into units and leases them to workers.  A
+ *  unit whose worker goes quiet for longer than lease_ms, or disconnects, is
+ *  leased again.  The first match, or the last unit done, stops every
+ *  worker.
+ */
+typedef struct DIST_COORDINATOR {
+    int listen_fd;              /**< Listening socket.                        */
+    char *unix_path;            /**< Unix socket path to remove, or NULL.     */
+    int wake[2];                /**< Pipe that wakes the coordinator up.      */
+    uint64_t total_records;     /**< Records in the input.                    */
+    uint64_t unit_records;      /**< Records per unit.                        */
+    uint32_t lease_ms;          /**< Milliseconds before a quiet worker's
+                                 *   unit is leased again.
+                                 */
+    uint64_t next_record;       /**< First record not leased yet.             */
+    uint64_t *requeued;         /**< Units to lease again, pairs of the
+                                 *   first record and the count.
+                                 */
+    int requeued_count;         /**< Number of units to lease again.          */
+    int requeued_size;          /**< Units there is room for.                 */
+    uint64_t next_id;           /**< Next unit id.                            */
+    dist_conn *conns;           /**< Worker connections.                      */
+    struct pollfd *fds;         /**< Poll set, the listener, the wake pipe,
+                                 *   then a slot per connection.
+                                 */
+    int conn_count;             /**< Number of connections.                   */
+    int conn_size;              /**< Connections there is room for.           */
+    uint64_t records_done;      /**< Records in units that are done.          */
+    uint64_t records_tested;    /**< Records tested, from the workers.        */
+    uint64_t units_done;        /**< Units done.                              */
+    uint64_t units_expired;     /**< Units leased again after a worker went
+                                 *   quiet or disconnected.
+                                 */
+    char *result;               /**< The result record, or NULL.              */
+    size_t result_size;         /**< The result record size.                  */
+    int stopping;               /**< Set once the coordinator is stopping.    */
+} dist_coordinator;
+
+/** A worker structure.
+ *  Asks a coordinator for units and runs an attack on each one, until the
+ *  coordinator stops it.  setup builds the attack and its input file for a
+ *  unit, the worker owns the attack's callback and callback_data.
+ */
+typedef struct DIST_WORKER {
+    int (*setup)(attack_st *attk_st, file_st *file_in, uint64_t first,
+                 uint64_t count, void *data); /**< Sets up the attack and
+                                               *   input file for count
+                                               *   records from first,
+                                               *   returns 0 on success.
+                                               */
+    void (*teardown)(attack_st *attk_st, file_st *file_in,
+                     void *data);   /**< Destroys what setup made.         */
+    void *data;                 /**< Data passed to setup and teardown.       */
+    int fd;                     /**< Socket.                                  */
+    int done[2];                /**< Pipe the attack callback writes to.      */
+    uint64_t records_tested;    /**< Records tested over every unit.          */
+    uint64_t units_done;        /**< Units done.                              */
+    char *result;               /**< The result record, or NULL.              */
+    size_t result_size;         /**< The result record size.                  */
+} dist_worker;
+
+int dist_coordinator_init(dist_coordinator *dc, const char *address,
+                          uint64_t total_records, uint64_t unit_records,
+                          uint32_t lease_ms);
+void dist_coordinator_destroy(dist_coordinator *dc);
+int dist_coordinator_run(dist_coordinator *dc);
+void dist_coordinator_stop(dist_coordinator *dc);
+int dist_worker_init(dist_worker *dw,
+                     int (*setup)(attack_st *attk_st, file_st *file_in,
+                                  uint64_t first, uint64_t count, void *data),
+                     void (*teardown)(attack_st *attk_st, file_st *file_in,
+                                      void *data),
+                     void *data);
+void dist_worker_destroy(dist_worker *dw);
+int dist_worker_run(dist_worker *dw, const char *address);
+
+/** @} */
+
+#endif      /* DISTRIBUTE_H */
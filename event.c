@@ -0,0 +1,179 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event.h"
+
+/** @defgroup event event
+ *
+ *  A futex based wakeup event.
+ *
+ *  An event lets threads sleep until another thread changes something they
+ *  are waiting for, without a mutex on either side.  A waiter calls
+ *  event_prepare to get a key, checks its condition one more time, and then
+ *  calls event_wait with the key, or event_cancel if it no longer needs to
+ *  wait.  A waker changes the condition and then calls event_signal or
+ *  event_broadcast, which only enter the kernel when someone is waiting.
+ */
+
+/** Private method that calls the futex system call.
+ *
+ *  @param[in] addr     The futex word.
+ *  @param[in] op       The futex operation.
+ *  @param[in] val      The operation value.
+ *  @param[in] timeout  The relative timeout, NULL for none.
+ *
+ *  @return             Returns the system call result.
+ */
+static long event_futex(uint32_t *addr, int op, uint32_t val,
+                        struct timespec *timeout) {
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/** Initializes an event.
+ *
+ *  @param[in] ev The event to initialize.
+ */
+void event_init(event *ev) {
+    /* Clear the structure */
+    memset(ev, 0, sizeof(event));
+}
+
+/** Prepare to wait on an event.
+ *  Announces a waiter and returns the key to pass to event_wait.  The caller
+ *  must check its wait condition after this call, and must follow it with
+ *  either event_wait or event_cancel.
+ *
+ *  @param[in] ev The event.
+ *
+ *  @return       Returns the wait key.
+ */
+uint32_t event_prepare(event *ev) {
+    __atomic_add_fetch(&(ev->waiters), 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&(ev->seq), __ATOMIC_SEQ_CST);
+}
+
+/** Cancel a prepared wait.
+ *
+ *  @param[in] ev The event.
+ */
+void event_cancel(event *ev) {
+    __atomic_sub_fetch(&(ev->waiters), 1, __ATOMIC_SEQ_CST);
+}
+
+/** Private method that waits on an event.
+ *
+ *  @param[in] ev       The event.
+ *  @param[in] key      The key returned by event_prepare.
+ *  @param[in] ts       How long to wait, NULL for no limit.
+ *
+ *  @return             Returns 0 when signalled, otherwise ETIMEDOUT.
+ */
+static int event_wait_ts(event *ev, uint32_t key, struct timespec *ts) {
+    int retval = 0;
+
+    /* Sleep while the key is current, spurious wakeups just return */
+    if (__atomic_load_n(&(ev->seq), __ATOMIC_SEQ_CST) == key) {
+        if (event_futex(&(ev->seq), FUTEX_WAIT_PRIVATE, key, ts) == -1 &&
+            errno == ETIMEDOUT) {
+            retval = ETIMEDOUT;
+        }
+    }
+
+    event_cancel(ev);
+
+    return retval;
+}
+
+/** Wait on an event.
+ *  Sleeps until the event is signalled after the key was taken, or for up to
+ *  wait_sec seconds.  Returns early if the event was already signalled.
+ *
+ *  @param[in] ev       The event.
+ *  @param[in] key      The key returned by event_prepare.
+ *  @param[in] wait_sec Seconds to wait, EVENT_WAIT_FOREVER for no limit.
+ *
+ *  @return             Returns 0 when signalled, otherwise ETIMEDOUT.
+ */
+int event_wait(event *ev, uint32_t key, int wait_sec) {
+    struct timespec ts;
+
+    ts.tv_sec = wait_sec;
+    ts.tv_nsec = 0;
+    return event_wait_ts(ev, key, wait_sec >= 0 ? &ts : NULL);
+}
+
+/** Wait on an event, in milliseconds.
+ *  Same as event_wait, for up to wait_ms milliseconds.
+ *
+ *  @param[in] ev       The event.
+ *  @param[in] key      The key returned by event_prepare.
+ *  @param[in] wait_ms  Milliseconds to wait, EVENT_WAIT_FOREVER for no
+ *                      limit.
+ *
+ *  @return             Returns 0 when signalled, otherwise ETIMEDOUT.
+ */
+int event_wait_ms(event *ev, uint32_t key, int wait_ms) {
+    struct timespec ts;
+
+    ts.tv_sec = wait_ms / 1000;
+    ts.tv_nsec = (long)(wait_ms % 1000) * 1000000;
+    return event_wait_ts(ev, key, wait_ms >= 0 ? &ts : NULL);
+}
+
+/** Signal an event.
+ *  Wakes one waiter, if there are any.  The caller must have already made the
+ *  change the waiters are waiting for.
+ *
+ *  @param[in] ev The event.
+ */
+void event_signal(event *ev) {
+    /* Order the change before reading the waiter count */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(ev->waiters), __ATOMIC_SEQ_CST) == 0) {
+        return;
+    }
+
+    __atomic_add_fetch(&(ev->seq), 1, __ATOMIC_SEQ_CST);
+    event_futex(&(ev->seq), FUTEX_WAKE_PRIVATE, 1, NULL);
+}
+
+/** Broadcast an event.
+ *  Wakes every waiter, if there are any.  The caller must have already made
+ *  the change the waiters are waiting for.
+ *
+ *  @param[in] ev The event.
+ */
+void event_broadcast(event *ev) {
+    /* Order the change before reading the waiter count */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(ev->waiters), __ATOMIC_SEQ_CST) == 0) {
+        return;
+    }
+
+    __atomic_add_fetch(&(ev->seq), 1, __ATOMIC_SEQ_CST);
+    event_futex(&(ev->seq), FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
+}
@@ -0,0 +1,47 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+
+/** @addtogroup event
+ *  @{
+ */
+
+#define EVENT_WAIT_FOREVER  -1  /**< Wait until the event is signalled. */
+
+/** An event structure.
+ *  A futex based event count.  Waiters take a key, re-check whatever they are
+ *  waiting for, and then sleep until the key changes.
+ */
+typedef struct {
+    uint32_t seq;       /**< Event sequence number, the futex word. */
+    int waiters;        /**< Number of threads preparing to wait.   */
+} event;
+
+void event_init(event *ev);
+uint32_t event_prepare(event *ev);
+void event_cancel(event *ev);
+int event_wait(event *ev, uint32_t key, int wait_sec);
+int event_wait_ms(event *ev, uint32_t key, int wait_ms);
+void event_signal(event *ev);
+void event_broadcast(event *ev);
+
+/** @} */
+
+#endif      /* EVENT_H */
@@ -0,0 +1,177 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string.h>
+
+#include "histogram.h"
+
+/** @defgroup histogram histogram
+ *
+ *  Log-linear histograms.
+ *
+ *  A histogram counts values in buckets that are exact below
+ *  2^(HISTOGRAM_SUB_BITS + 1), above that each power of two is split into
+ *  2^HISTOGRAM_SUB_BITS buckets.  Recording a value is a few shifts and
+ *  three relaxed stores, with no locks, so a thread can time every block it
+ *  handles.  Each thread records into its own histograms, a reader merges
+ *  them, and sees each counter as it was at some point while it read.
+ */
+
+/** Private method that finds a value's bucket.
+ *
+ *  @param[in] value    The value.
+ *
+ *  @return             Returns the bucket.
+ */
+static int histogram_bucket(uint64_t value) {
+    int bits;
+
+    if (value < (2 << HISTOGRAM_SUB_BITS)) {
+        return value;
+    }
+    if (value >= (1ULL << HISTOGRAM_MAX_BITS)) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+
+    /* The top HISTOGRAM_SUB_BITS + 1 bits pick the bucket in the value's
+       power of two */
+    bits = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return (bits << HISTOGRAM_SUB_BITS) + (int)(value >> bits);
+}
+
+
+/** Private method that finds the largest value in a bucket.
+ *
+ *  @param[in] bucket   The bucket.
+ *
+ *  @return             Returns the value.
+ */
+static uint64_t histogram_bucket_max(int bucket) {
+    int bits;
+
+    if (bucket < (2 << HISTOGRAM_SUB_BITS)) {
+        return bucket;
+    }
+
+    bits = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    return (((uint64_t)(bucket & ((1 << HISTOGRAM_SUB_BITS) - 1)) +
+             (1 << HISTOGRAM_SUB_BITS) + 1) << bits) - 1;
+}
+
+
+/** Initializes a histogram.
+ *  Clears every count.
+ *
+ *  @param[in] h    The histogram.
+ */
+void histogram_init(histogram *h) {
+    memset(h, 0, sizeof(histogram));
+}
+
+
+/** Records a value.
+ *  Only one thread may record into a histogram.
+ *
+ *  @param[in] h        The histogram.
+ *  @param[in] value    The value.
+ */
+void histogram_record(histogram *h, uint64_t value) {
+    int bucket = histogram_bucket(value);
+
+    __atomic_store_n(&(h->buckets[bucket]), h->buckets[bucket] + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&(h->sum), h->sum + value, __ATOMIC_RELAXED);
+    if (value > h->max) {
+        __atomic_store_n(&(h->max), value, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&(h->count), h->count + 1, __ATOMIC_RELAXED);
+}
+
+
+/** Adds one histogram into another.
+ *  The source may be recorded into while it is added.
+ *
+ *  @param[in,out] dst  The histogram to add to.
+ *  @param[in]     src  The histogram to add.
+ */
+void histogram_merge(histogram *dst, const histogram *src) {
+    uint64_t max;
+    int i;
+
+    dst->count += __atomic_load_n(&(src->count), __ATOMIC_RELAXED);
+    dst->sum += __atomic_load_n(&(src->sum), __ATOMIC_RELAXED);
+    max = __atomic_load_n(&(src->max), __ATOMIC_RELAXED);
+    if (max > dst->max) {
+        dst->max = max;
+    }
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dst->buckets[i] += __atomic_load_n(&(src->buckets[i]),
+                                           __ATOMIC_RELAXED);
+    }
+}
+
+
+/** Finds a quantile.
+ *  Finds the value that quantile of the recorded values are at or below, to
+ *  within its bucket's precision.
+ *
+ *  @param[in] h        The histogram.
+ *  @param[in] quantile The quantile, from 0.0 to 1.0.
+ *
+ *  @return             Returns the largest value in the quantile's bucket,
+ *                      no more than the largest value recorded, the largest
+ *                      value recorded for the last bucket, or 0 if nothing
+ *                      was recorded.
+ */
+uint64_t histogram_quantile(const histogram *h, double quantile) {
+    uint64_t total = 0;
+    uint64_t rank;
+    uint64_t seen = 0;
+    uint64_t value;
+    int i;
+
+    /* Count the buckets rather than trusting count, they may be a little
+       apart while a thread is recording */
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        total += h->buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    /* Find the bucket holding the value at that rank */
+    if (quantile < 0.0) {
+        quantile = 0.0;
+    } else if (quantile > 1.0) {
+        quantile = 1.0;
+    }
+    rank = (uint64_t)(quantile * total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    value = histogram_bucket_max(i);
+    if (i == HISTOGRAM_BUCKETS - 1 || value > h->max) {
+        return h->max;
+    }
+    return value;
+}
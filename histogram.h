@@ -0,0 +1,54 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/** @addtogroup histogram
+ *  @{
+ */
+
+#define HISTOGRAM_SUB_BITS  4   /**< Bits of each value kept exactly, values
+                                 *   are bucketed to within 1 part in 16.
+                                 */
+#define HISTOGRAM_MAX_BITS  48  /**< Bits in the largest value, larger values
+                                 *   are counted as the largest.
+                                 */
+#define HISTOGRAM_BUCKETS   ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << \
+                             HISTOGRAM_SUB_BITS) /**< Number of buckets. */
+
+/** A histogram.
+ *  Counts values in buckets that grow with the value, so each bucket is
+ *  within 1 part in 2^HISTOGRAM_SUB_BITS of the values in it.  Only one
+ *  thread may record into a histogram, any thread may read it while it does.
+ */
+typedef struct HISTOGRAM {
+    uint64_t count;             /**< Number of values recorded.               */
+    uint64_t sum;               /**< Sum of the values recorded.              */
+    uint64_t max;               /**< Largest value recorded.                  */
+    uint64_t buckets[HISTOGRAM_BUCKETS]; /**< Values counted per bucket.      */
+} histogram;
+
+void histogram_init(histogram *h);
+void histogram_record(histogram *h, uint64_t value);
+void histogram_merge(histogram *dst, const histogram *src);
+uint64_t histogram_quantile(const histogram *h, double quantile);
+
+/** @} */
+
+#endif      /* HISTOGRAM_H */
@@ -14,13 +14,27 @@
  * GNU General Public License for more details.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
 
 #include "libattkthread.h"
+#include "block_pool.h"
+#include "checkpoint.h"
+#include "event.h"
+#include "histogram.h"
 #include "queue.h"
+#include "result_store.h"
+#include "topology.h"
+#include "work_queue.h"
 #include "../config.h"
 
 /** @defgroup libattkthread libattkthread
@@ -32,60 +46,1290 @@
  *  attack library.
  */
 
+/** Shared arguments for the client threads.
+ *  The arguments shared by all attack client threads.
+ */
+struct attack_t_args {
+    attack_st *attk_st;   /**< The main thread's argument list. */
+    work_queue q;         /**< The queue.                       */
+    block_pool *pools;    /**< The block pools, one per lane when
+                           *   there is a lane per NUMA node.
+                           */
+    int pool_count;       /**< Number of block pools.           */
+    int pooled;           /**< Set if blocks come from the pool. */
+    int file_buffers;     /**< Set if the input file allocates
+                           *   the record buffers.
+                           */
+    size_t block_size;    /**< Size of a block, with its records
+                           *   unless the input file allocates
+                           *   them.
+                           */
+    int block_min;        /**< Fewest records per tuned block.  */
+    int block_max;        /**< Most records per tuned block.    */
+    attack_placement placement; /**< How client threads are placed. */
+    topology topo;        /**< CPU and NUMA node layout, when
+                           *   placing client threads.
+                           */
+    struct attack_client_args *clients; /**< Every client thread
+                                         *   started, for joining.
+                                         */
+    struct attack_client_args **slots; /**< The running client for
+                                        *   each client number.
+                                        */
+    int slot_count;       /**< Number of client slots.          */
+    int started;          /**< Set once clients may be started. */
+    int closed;           /**< Set once no more clients may be
+                           *   started.
+                           */
+    int checkpointing;    /**< Set if finished blocks go into
+                           *   the checkpoint.
+                           */
+    int resumed;          /**< Set if the checkpoint was loaded
+                           *   with records already done.
+                           */
+    uint64_t checkpoint_due; /**< When the next checkpoint is due,
+                              *   in nanoseconds.
+                              */
+    queue out_q;          /**< Full output buffers for the
+                           *   writer thread.
+                           */
+    queue out_free;       /**< Written output buffers to reuse. */
+    size_t out_size;      /**< Size of an output buffer.        */
+    int out_packed;       /**< Set if the output file is packed. */
+    size_t out_head;      /**< Bytes before the first output
+                           *   record in an output buffer, room
+                           *   for the packed block header.
+                           */
+    size_t out_stride;    /**< Distance between the output
+                           *   records in an output buffer.
+                           */
+    int writing;          /**< Set if the writer thread is
+                           *   running.
+                           */
+    pthread_t writer;     /**< The writer thread.               */
+    struct attack_shard *writer_shard; /**< The writer thread's
+                                        *   counters.
+                                        */
+    int ordered;          /**< Set if the writer puts the output
+                           *   in input order.
+                           */
+    uint64_t order_window; /**< Blocks that may be checked ahead
+                            *   of the next one to write.
+                            */
+    uint64_t order_next;  /**< The next block to write.         */
+    event order_ev;       /**< Signalled when order_next moves
+                           *   on, or the attack stops.
+                           */
+    struct attack_out **held; /**< Output held back until its turn,
+                               *   a list per block, indexed by
+                               *   the block's sequence number
+                               *   modulo order_window.
+                               */
+    int progressing;      /**< Set if the progress thread is
+                           *   running.
+                           */
+    int progress_stop;    /**< Set when the progress thread
+                           *   should stop.
+                           */
+    pthread_t progress;   /**< The progress thread.             */
+    event progress_ev;    /**< Signalled when progress_stop is
+                           *   set.
+                           */
+    int stop __attribute__ ((aligned (CACHE_LINE_SIZE))); /**< Set by
+                           *   stop_attack, client threads give
+                           *   up on their blocks when they see
+                           *   it.  On its own cache line, as it
+                           *   is read every few records.
+                           */
+};
+
+/** Thread counters.
+ *  Progress counters and the block pool cache for one client or producer
+ *  thread, kept on their own cache lines.  Only the owning thread writes to
+ *  them, check_attack adds them all up without taking any locks.  Shards stay
+ *  on attack_st's list until attack_st_destroy so their counts outlive the
+ *  threads.
+ */
+struct attack_shard {
+    uint64_t records_tested;        /**< Records tested by the thread.  */
+    uint64_t blocks;                /**< Blocks timed by the thread.    */
+    uint64_t check_records;         /**< Records in the timed blocks.   */
+    uint64_t check_ns;              /**< Time spent checking them.      */
+    uint64_t wait_ns;               /**< Time spent waiting for them.   */
+    uint64_t write_stall_ns;        /**< Time spent waiting for the
+                                     *   writer thread.
+                                     */
+    block_pool_cache cache;         /**< The thread's block pool cache. */
+    block_pool *pool;               /**< The pool the cache belongs to. */
+    attack_stats *stats;            /**< Stage timings, NULL unless
+                                     *   stage_stats is set.
+                                     */
+    double rate;                    /**< Records tested per second, a
+                                     *   decaying average.
+                                     */
+    double rate_weight;             /**< How much of rate is real rather
+                                     *   than its starting 0.
+                                     */
+    uint64_t rate_ns;               /**< When rate was last updated.    */
+    uint64_t records_read;          /**< Records read by a producer.    */
+    int client;                     /**< Client thread number plus one,
+                                     *   0 for other threads.
+                                     */
+    int running;                    /**< Set while the client thread
+                                     *   runs.
+                                     */
+    struct attack_shard *next;      /**< Next shard in the list.        */
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+/** A block of records.
+ *  What the producers hand to the client threads through the queue.  Blocks
+ *  come from the block pools, with room for the records right after the
+ *  block unless the input file allocates them.
+ */
+struct attack_block {
+    char *buf;                      /**< The records.                   */
+    size_t size;                    /**< Size of the records.           */
+    uint64_t first;                 /**< Number of the first record in
+                                     *   the whole input.
+                                     */
+    uint64_t seq;                   /**< Sequence number, the order the
+                                     *   block was read in, when writing
+                                     *   output in order.
+                                     */
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+/** An output buffer.
+ *  What the client threads hand to the writer thread, with room for the
+ *  output records right after it.
+ */
+struct attack_out {
+    uint64_t seq;                   /**< Sequence number of the block the
+                                     *   output is from.
+                                     */
+    int last;                       /**< Set if it is the block's last
+                                     *   output.
+                                     */
+    size_t size;                    /**< Size of the output.            */
+    struct attack_out *next;        /**< Next output held back for the
+                                     *   same block.
+                                     */
+};
+
+/** Block size tuning state.
+ *  A producer's view of the client timings the last time it sized blocks.
+ */
+struct attack_tuner {
+    uint64_t blocks;                /**< Blocks timed.                  */
+    uint64_t check_records;         /**< Records in the timed blocks.   */
+    uint64_t check_ns;              /**< Time spent checking them.      */
+    uint64_t wait_ns;               /**< Time spent waiting for them.   */
+    uint64_t ns_per_krecord;        /**< Smoothed time to check 1024
+                                     *   records.
+                                     */
+    int records;                    /**< Current records per block.     */
+    int countdown;                  /**< Blocks until the next resize.  */
+};
+
 /** Arguments for a client thread.
- *  The arguments for attack client threads.
+ *  The arguments for one attack client thread.
+ */
+struct attack_client_args {
+    struct attack_t_args *t_args; /**< The shared client arguments.     */
+    struct attack_shard *shard;   /**< The client's counters.           */
+    int id;                       /**< The client's number.             */
+    int lane;                     /**< The client's queue lane.         */
+    pthread_t thread;             /**< The client thread.               */
+    struct attack_client_args *next; /**< Next client started.          */
+};
+
+/** Arguments for a producer thread.
+ *  The arguments for one attack producer thread.
+ */
+struct attack_producer_args {
+    struct attack_t_args *t_args; /**< The shared thread arguments.     */
+    struct attack_shard **shards; /**< The producer's counters, one per
+                                   *   block pool.
+                                   */
+    file_st *file;                /**< The input file part to read.     */
+    pthread_t thread;             /**< The producer thread.             */
+};
+
+
+/** Private method that creates a counter shard.
+ *  Allocates a cleared shard, with stage timings if stage_stats is set, and
+ *  adds it to the attack's shard list.
+ *
+ *  @param[in] attk_st  The attack object.
+ *
+ *  @return             Returns the new shard, NULL on error.
+ */
+static struct attack_shard *attack_shard_new(attack_st *attk_st) {
+    struct attack_shard *shard;
+
+    if (posix_memalign((void **)&shard, CACHE_LINE_SIZE,
+                       sizeof(struct attack_shard)) != 0) {
+        return NULL;
+    }
+    memset(shard, 0, sizeof(struct attack_shard));
+    if (attk_st->stage_stats) {
+        shard->stats = calloc(1, sizeof(attack_stats));
+        if (shard->stats == NULL) {
+            free(shard);
+            return NULL;
+        }
+    }
+
+    /* Publish it to check_attack */
+    shard->next = __atomic_load_n(&(attk_st->_shards), __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&(attk_st->_shards), &(shard->next),
+                                        shard, 1, __ATOMIC_RELEASE,
+                                        __ATOMIC_ACQUIRE));
+
+    return shard;
+}
+
+
+/** Private method that creates a producer's counter shards.
+ *  A producer fills blocks from every block pool, so it gets a shard, and
+ *  with it a block pool cache, for each one.
+ *
+ *  @param[in] attk_st  The attack object.
+ *  @param[in] t_args   The shared thread arguments.
+ *
+ *  @return             Returns the shards, one per block pool, NULL on error.
+ */
+static struct attack_shard **attack_producer_shards(
+    attack_st *attk_st, struct attack_t_args *t_args) {
+    struct attack_shard **shards;
+    int i;
+
+    shards = malloc(sizeof(struct attack_shard *) * t_args->pool_count);
+    if (shards == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < t_args->pool_count; i++) {
+        shards[i] = attack_shard_new(attk_st);
+        if (shards[i] == NULL) {
+            /* The shards made so far stay on attack_st's list */
+            free(shards);
+            return NULL;
+        }
+        shards[i]->pool = t_args->pooled ? &(t_args->pools[i]) : NULL;
+    }
+
+    return shards;
+}
+
+
+/** Private method that is done with a producer's counter shards.
+ *  Gives the cached blocks back to their pools.  The shards themselves stay
+ *  on attack_st's list.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *  @param[in] shards   The producer's shards.
+ */
+static void attack_producer_shards_free(struct attack_t_args *t_args,
+                                        struct attack_shard **shards) {
+    int i;
+
+    for (i = 0; i < t_args->pool_count; i++) {
+        if (shards[i]->pool != NULL) {
+            block_pool_flush(shards[i]->pool, &(shards[i]->cache));
+        }
+    }
+    free(shards);
+}
+
+
+/** Private method that reads the monotonic clock.
+ *
+ *  @return             Returns the time in nanoseconds.
+ */
+static uint64_t attack_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/** Private method that adds a block to a client thread's rate.
+ *  The rate decays by ATTACK_RATE_MS / (ATTACK_RATE_MS + time since the last
+ *  block) and the block's records are added in, so a steady rate is kept
+ *  steady however big the blocks are.  The weight goes through the same
+ *  steps as a rate that was always 1, dividing by it takes out the starting
+ *  0.  Only the shard's thread calls it.
+ *
+ *  @param[in] shard    The client thread's shard.
+ *  @param[in] records  Records tested in the block.
+ *  @param[in] now      When the block was done.
+ */
+static void attack_rate_add(struct attack_shard *shard, uint64_t records,
+                            uint64_t now) {
+    double tau = ATTACK_RATE_MS * 1e6;
+    double dt = now > shard->rate_ns ? now - shard->rate_ns : 0;
+    double rate;
+    double weight;
+
+    rate = (shard->rate * tau + records * 1e9) / (tau + dt);
+    weight = (shard->rate_weight * tau + dt) / (tau + dt);
+    __atomic_store(&(shard->rate), &rate, __ATOMIC_RELAXED);
+    __atomic_store(&(shard->rate_weight), &weight, __ATOMIC_RELAXED);
+    __atomic_store_n(&(shard->rate_ns), now, __ATOMIC_RELAXED);
+}
+
+
+/** Private method that reads a client thread's rate.
+ *  Decays the rate to now, as if no records were tested since its last
+ *  block, so a stalled thread's rate falls off.
+ *
+ *  @param[in] shard    The client thread's shard.
+ *  @param[in] now      The time to read the rate at.
+ *
+ *  @return             Returns the records tested per second.
+ */
+static double attack_rate_read(struct attack_shard *shard, uint64_t now) {
+    double tau = ATTACK_RATE_MS * 1e6;
+    double rate;
+    double weight;
+    uint64_t rate_ns;
+    double age;
+
+    __atomic_load(&(shard->rate), &rate, __ATOMIC_RELAXED);
+    __atomic_load(&(shard->rate_weight), &weight, __ATOMIC_RELAXED);
+    rate_ns = __atomic_load_n(&(shard->rate_ns), __ATOMIC_RELAXED);
+    age = now > rate_ns ? now - rate_ns : 0;
+
+    rate = rate * tau / (tau + age);
+    weight = (weight * tau + age) / (tau + age);
+    return weight > 0 ? rate / weight : 0;
+}
+
+
+/** Private method that adds up the thread counters.
+ *  Fills in the records tested, block pool counters and rates of an attack
+ *  status.  The rates are only summed over the client threads still running,
+ *  as of now.
+ *
+ *  @param[in]  attk_st      The attack object.
+ *  @param[out] status       The attack status.
+ *  @param[in]  now          The time to read the rates at.
+ *  @param[out] records_read The records read by the producers.
+ */
+static void attack_sum_shards(attack_st *attk_st, attack_status *status,
+                              uint64_t now, uint64_t *records_read) {
+    struct attack_shard *shard;
+    int thread_rates_size = 0;
+    double rate;
+    int client;
+
+    status->records_tested = __atomic_load_n(&(attk_st->_s.records_tested),
+                                             __ATOMIC_RELAXED);
+    status->pool_hits = status->pool_misses = status->write_stall_ns = 0;
+    status->rate = 0;
+    *records_read = 0;
+    if (status->thread_rates != NULL) {
+        memset(status->thread_rates, 0,
+               sizeof(double) * status->thread_rates_size);
+    }
+    shard = __atomic_load_n(&(attk_st->_shards), __ATOMIC_ACQUIRE);
+    while (shard != NULL) {
+        status->records_tested += __atomic_load_n(&(shard->records_tested),
+                                                  __ATOMIC_RELAXED);
+        status->write_stall_ns += __atomic_load_n(&(shard->write_stall_ns),
+                                                  __ATOMIC_RELAXED);
+        status->pool_hits += __atomic_load_n(&(shard->cache.hits),
+                                             __ATOMIC_RELAXED);
+        status->pool_misses += __atomic_load_n(&(shard->cache.misses),
+                                               __ATOMIC_RELAXED);
+        *records_read += __atomic_load_n(&(shard->records_read),
+                                         __ATOMIC_RELAXED);
+
+        /* Add in the client thread's rate, a retired thread's slot may have
+           a new thread in it */
+        if (__atomic_load_n(&(shard->running), __ATOMIC_ACQUIRE)) {
+            rate = attack_rate_read(shard, now);
+            status->rate += rate;
+            client = shard->client - 1;
+            if (status->thread_rates != NULL &&
+                client < status->thread_rates_size) {
+                status->thread_rates[client] = rate;
+                if (client >= thread_rates_size) {
+                    thread_rates_size = client + 1;
+                }
+            }
+        }
+        shard = shard->next;
+    }
+    status->thread_rates_size = thread_rates_size;
+}
+
+
+/** Private method that sizes the next blocks.
+ *  Every ATTACK_TUNE_BLOCKS blocks, works out how long the client threads
+ *  took per record since the last resize and sizes blocks to take
+ *  block_target_us to check.  If the client threads waited for blocks, the
+ *  blocks grow by up to twice as much again so each one carries more work
+ *  through the queue.  Block sizes stay within block_min and block_max.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *  @param[in] tuner    The producer's tuning state.
+ *
+ *  @return             Returns the number of records for the next block.
+ */
+static int attack_tune_block(struct attack_t_args *t_args,
+                             struct attack_tuner *tuner) {
+    attack_st *attk_st = t_args->attk_st;
+    struct attack_shard *shard;
+    uint64_t blocks = 0;
+    uint64_t check_records = 0;
+    uint64_t check_ns = 0;
+    uint64_t wait_ns = 0;
+    uint64_t ns_per_krecord;
+    uint64_t wait_per_block;
+    uint64_t target_ns;
+    uint64_t records;
+
+    if (--tuner->countdown > 0) {
+        return tuner->records;
+    }
+    tuner->countdown = ATTACK_TUNE_BLOCKS;
+
+    /* Add up the client timings */
+    shard = __atomic_load_n(&(attk_st->_shards), __ATOMIC_ACQUIRE);
+    while (shard != NULL) {
+        blocks += __atomic_load_n(&(shard->blocks), __ATOMIC_RELAXED);
+        check_records += __atomic_load_n(&(shard->check_records),
+                                         __ATOMIC_RELAXED);
+        check_ns += __atomic_load_n(&(shard->check_ns), __ATOMIC_RELAXED);
+        wait_ns += __atomic_load_n(&(shard->wait_ns), __ATOMIC_RELAXED);
+        shard = shard->next;
+    }
+    if (blocks <= tuner->blocks || check_records <= tuner->check_records) {
+        /* Nothing new was checked */
+        return tuner->records;
+    }
+
+    /* Time per record and wait per block since the last resize */
+    ns_per_krecord = ((check_ns - tuner->check_ns) * 1024) /
+                     (check_records - tuner->check_records);
+    wait_per_block = (wait_ns - tuner->wait_ns) / (blocks - tuner->blocks);
+    tuner->blocks = blocks;
+    tuner->check_records = check_records;
+    tuner->check_ns = check_ns;
+    tuner->wait_ns = wait_ns;
+    if (ns_per_krecord == 0) {
+        ns_per_krecord = 1;
+    }
+
+    /* Smooth out the noise */
+    if (tuner->ns_per_krecord == 0) {
+        tuner->ns_per_krecord = ns_per_krecord;
+    } else {
+        tuner->ns_per_krecord = (3 * tuner->ns_per_krecord + ns_per_krecord)
+                                / 4;
+    }
+
+    /* Size blocks to the target time */
+    target_ns = (uint64_t)attk_st->block_target_us * 1000;
+    records = (target_ns * 1024) / tuner->ns_per_krecord;
+    if (wait_per_block > target_ns) {
+        wait_per_block = target_ns;
+    }
+    records += (records * wait_per_block) / target_ns;
+    if (records < t_args->block_min) {
+        records = t_args->block_min;
+    } else if (records > t_args->block_max) {
+        records = t_args->block_max;
+    }
+
+    tuner->records = records;
+    __atomic_store_n(&(attk_st->_s.records_per_block), tuner->records,
+                     __ATOMIC_RELAXED);
+
+    return tuner->records;
+}
+
+
+/** Private method that gets an empty block.
+ *  Takes a block from the calling thread's block pool, or allocates one if
+ *  there are no pools.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *  @param[in] shard    The calling thread's counters.
+ *
+ *  @return             Returns the block, NULL on error.
+ */
+static struct attack_block *attack_get_block(struct attack_t_args *t_args,
+                                             struct attack_shard *shard) {
+    struct attack_block *block;
+
+    if (shard->pool != NULL) {
+        block = block_pool_get(shard->pool, &(shard->cache));
+    } else if (posix_memalign((void **)&block, CACHE_LINE_SIZE,
+                              t_args->block_size) != 0) {
+        block = NULL;
+    }
+    if (block == NULL) {
+        return NULL;
+    }
+
+    block->buf = t_args->file_buffers ? NULL : (char *)(block + 1);
+    block->size = 0;
+    block->first = 0;
+    block->seq = 0;
+
+    return block;
+}
+
+
+/** Private method that gives a block back.
+ *  Frees the block's records through the file if the file allocated them,
+ *  then puts the block back into the block pool.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *  @param[in] shard    The calling thread's counters.
+ *  @param[in] file     The file the block came from.
+ *  @param[in] block    The block.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+static int attack_release_block(struct attack_t_args *t_args,
+                                struct attack_shard *shard, file_st *file,
+                                struct attack_block *block) {
+    int retval = 0;
+
+    if (t_args->file_buffers && block->buf != NULL) {
+        retval = file->free_block(file, block->buf, block->size);
+    }
+    if (shard->pool != NULL) {
+        block_pool_put(shard->pool, &(shard->cache), block);
+    } else {
+        free(block);
+    }
+
+    return retval;
+}
+
+
+/** Private method that counts the records in a block.
+ *
+ *  @param[in] file     The input file.
+ *  @param[in] block    The block.
+ *
+ *  @return             Returns the number of records.
+ */
+static uint64_t attack_block_records(file_st *file,
+                                     struct attack_block *block) {
+    if (block->size == 0) {
+        return 0;
+    } else if (file->flags & FILE_PACKED) {
+        return ATTK_PACKED_COUNT(block->buf);
+    }
+    return block->size / file->record_size;
+}
+
+
+/** Private method that copies a packed record out to check it.
+ *  Only clears the part of the buffer the last record used, the rest is
+ *  already 0.
+ *
+ *  @param[in]     block        The packed block.
+ *  @param[in]     i            The record's index in the block.
+ *  @param[in,out] record_buf   The record sized buffer to copy it to.
+ *  @param[in,out] pad_len      Bytes of record_buf the last record used.
+ *  @param[out]    len          The record's length.
+ *
+ *  @return                     Returns record_buf.
+ */
+static char *attack_packed_copy(const char *block, uint32_t i,
+                                char *record_buf, size_t *pad_len,
+                                size_t *len) {
+    *len = ATTK_PACKED_LEN(block, i);
+    memcpy(record_buf, ATTK_PACKED_RECORD(block, i), *len);
+    if (*pad_len > *len) {
+        memset(record_buf + *len, 0, *pad_len - *len);
+    }
+    *pad_len = *len;
+
+    return record_buf;
+}
+
+
+/** Private method that marks a block done in the checkpoint.
+ *  Merges the block's records into the checkpoint, then saves the checkpoint
+ *  if one is due.  Only one thread gets to save each time one is due.  On an
+ *  error it sets the attack error and stops the attack.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *  @param[in] block    The block, every record in it checked.
+ */
+static void attack_block_done(struct attack_t_args *t_args,
+                              struct attack_block *block) {
+    attack_st *attk_st = t_args->attk_st;
+    uint64_t due;
+    uint64_t now;
+    int retval;
+
+    retval = checkpoint_add(attk_st->_checkpoint, block->first,
+                            attack_block_records(attk_st->file_in, block));
+
+    /* Save a checkpoint, if one is due */
+    if (retval == 0) {
+        due = __atomic_load_n(&(t_args->checkpoint_due), __ATOMIC_RELAXED);
+        now = attack_now_ns();
+        if (now >= due &&
+            __atomic_compare_exchange_n(
+                &(t_args->checkpoint_due), &due,
+                now + (uint64_t)(attk_st->checkpoint_ms ?
+                                 attk_st->checkpoint_ms :
+                                 ATTACK_CHECKPOINT_MS) * 1000000, 0,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            retval = checkpoint_save(attk_st->_checkpoint,
+                                     attk_st->checkpoint_path);
+        }
+    }
+
+    if (retval != 0) {
+        /* Set an error and stop the attack */
+        pthread_mutex_lock(&(attk_st->mut));
+        if (attk_st->error == 0) {
+            attk_st->error = E_ATTK_SYSTEM;
+            attk_st->e_state = E_STATE_CHECKPOINT;
+        }
+        pthread_mutex_unlock(&(attk_st->mut));
+        stop_attack(attk_st);
+    }
+}
+
+
+/** Private method that marks an attack as stopping.
+ *  Moves an attack that has not stopped yet to the stopping state, so the main
+ *  thread stops adding blocks.  Blocks already in the queue are still checked.
+ *
+ *  @param[in] attk_st  The attack object.
+ */
+static void attack_stopping(attack_st *attk_st) {
+    pthread_mutex_lock(&(attk_st->mut));
+    if (attk_st->state != ATTACK_STATE_STOPPED) {
+        attk_st->state = ATTACK_STATE_STOPPING;
+    }
+    pthread_mutex_unlock(&(attk_st->mut));
+}
+
+
+/** Private method that gets an output buffer.
+ *  Reuses a buffer the writer thread is done with, or allocates one.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *
+ *  @return             Returns the buffer, or NULL on error.
+ */
+static char *attack_out_get(struct attack_t_args *t_args) {
+    struct attack_out *out;
+    size_t size;
+
+    if (!t_args->writing ||
+        queue_try_pop(&(t_args->out_free), (void **)&out, &size) != 0) {
+        out = malloc(sizeof(struct attack_out) + t_args->out_size);
+        if (out == NULL) {
+            return NULL;
+        }
+    }
+    return (char *)(out + 1);
+}
+
+
+/** Private method that gives back an output buffer.
+ *  Keeps it for reuse, unless there are already enough spare buffers.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *  @param[in] buf      The buffer.
+ */
+static void attack_out_put(struct attack_t_args *t_args, char *buf) {
+    struct attack_out *out = (struct attack_out *)buf - 1;
+
+    if (!t_args->writing ||
+        queue_try_push(&(t_args->out_free), out, t_args->out_size) != 0) {
+        free(out);
+    }
+}
+
+
+/** Private method that sets the length of a packed output record.
+ *  Kept in the output buffer's offsets until the buffer is packed.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *  @param[in] fout_buf The output buffer.
+ *  @param[in] out_p    The output record.
+ *  @param[in] len      The length of the record it is from.
+ */
+static void attack_out_len(struct attack_t_args *t_args, char *fout_buf,
+                           char *out_p, size_t len) {
+    size_t max = t_args->out_stride - 1;
+
+    ATTK_PACKED_OFFSETS(fout_buf)[
+        (out_p - fout_buf - t_args->out_head) / t_args->out_stride + 1] =
+        len < max ? len : max;
+}
+
+
+/** Private method that packs an output buffer.
+ *  Moves each output record down to just after the last, followed by a 0,
+ *  and fills in the packed block header.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *  @param[in] fout_buf The output buffer.
+ *  @param[in] size     Bytes used in the output buffer.
+ *
+ *  @return             Returns the size of the packed block, 0 if it is
+ *                      empty.
+ */
+static size_t attack_out_pack(struct attack_t_args *t_args, char *fout_buf,
+                              size_t size) {
+    uint32_t *offsets = ATTK_PACKED_OFFSETS(fout_buf);
+    size_t count = (size - t_args->out_head) / t_args->out_stride;
+    char *src = fout_buf + t_args->out_head;
+    char *dst = fout_buf + ATTK_PACKED_HEADER(count);
+    uint32_t len;
+    size_t i;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    /* Each record's length is where the next one's offset goes */
+    for (i = 0; i < count; i++) {
+        len = offsets[i + 1];
+        memmove(dst, src, len);
+        dst[len] = '\0';
+        offsets[i] = dst - fout_buf;
+        dst += len + 1;
+        src += t_args->out_stride;
+    }
+    offsets[count] = dst - fout_buf;
+    ATTK_PACKED_COUNT(fout_buf) = count;
+
+    return dst - fout_buf;
+}
+
+
+/** Private method that writes out a client's output buffer.
+ *  Hands the filled part of a client's output buffer to the writer thread and
+ *  gives the client an empty buffer back, the client only waits if the writer
+ *  has fallen a whole queue behind.  Without a writer thread it writes the
+ *  buffer itself.  On an error it sets the attack error and stops the queue.
+ *
+ *  @param[in]     t_args   The shared thread arguments.
+ *  @param[in]     shard    The calling thread's counters.
+ *  @param[in,out] fout_buf The output buffer.
+ *  @param[in]     size     The number of bytes of the buffer used.
+ *  @param[in]     seq      Sequence number of the block the output is from.
+ *  @param[in]     last     Set if it is the block's last output.
+ *
+ *  @return                 Returns 0 on success, otherwise an error code.
+ */
+static int attack_write_out(struct attack_t_args *t_args,
+                            struct attack_shard *shard, char **fout_buf,
+                            size_t size, uint64_t seq, int last) {
+    attack_st *attk_st = t_args->attk_st;
+    file_st *file_out = attk_st->file_out;
+    struct attack_out *out;
+    ssize_t fout_retval = 0;
+    uint64_t backlog;
+    uint64_t start;
+    char *buf;
+
+    if (t_args->out_packed) {
+        size = attack_out_pack(t_args, *fout_buf, size);
+    }
+
+    if (t_args->writing) {
+        /* Tag the buffer with its place in the output */
+        out = (struct attack_out *)*fout_buf - 1;
+        out->seq = seq;
+        out->last = last;
+        out->size = size;
+
+        /* Hand the buffer over, waiting if the writer is behind */
+        backlog = __atomic_add_fetch(&(attk_st->_s.write_backlog), 1,
+                                     __ATOMIC_RELAXED);
+        if (shard->stats != NULL) {
+            histogram_record(&(shard->stats->write_depth), backlog);
+        }
+        if (queue_try_push(&(t_args->out_q), out,
+                           sizeof(struct attack_out) + size) != 0) {
+            start = attack_now_ns();
+            if (queue_push(&(t_args->out_q), out,
+                           sizeof(struct attack_out) + size,
+                           QUEUE_WAIT_FOREVER) != 0) {
+                __atomic_sub_fetch(&(attk_st->_s.write_backlog), 1,
+                                   __ATOMIC_RELAXED);
+                fout_retval = E_ATTK_SYSTEM;
+            }
+            __atomic_store_n(&(shard->write_stall_ns),
+                             shard->write_stall_ns + attack_now_ns() - start,
+                             __ATOMIC_RELAXED);
+        }
+
+        /* Get an empty one back */
+        if (fout_retval == 0) {
+            buf = attack_out_get(t_args);
+            if (buf == NULL) {
+                fout_retval = E_ATTK_SYSTEM;
+            } else {
+                *fout_buf = buf;
+            }
+        }
+    } else {
+        start = shard->stats != NULL ? attack_now_ns() : 0;
+        pthread_mutex_lock(&(file_out->mut));
+        fout_retval = file_out->next_block(file_out, fout_buf, size);
+        pthread_mutex_unlock(&(file_out->mut));
+        if (shard->stats != NULL) {
+            histogram_record(&(shard->stats->stages[ATTACK_STAGE_WRITE]),
+                             attack_now_ns() - start);
+        }
+    }
+
+    if (fout_retval < 0) {
+        /* Set an error */
+        pthread_mutex_lock(&(attk_st->mut));
+        if (attk_st->error == 0) {
+            attk_st->error = fout_retval;
+            attk_st->e_state = E_STATE_OUTPUT_FILE;
+        }
+        pthread_mutex_unlock(&(attk_st->mut));
+
+        /* Stop the queue */
+        work_queue_stop(&(t_args->q));
+
+        return fout_retval;
+    }
+
+    return 0;
+}
+
+
+/** Private method that writes one output buffer for the writer thread.
+ *  Writes the buffer, unless a write already failed, then passes it back for
+ *  reuse.  On an error it sets the attack error and stops the queue.
+ *
+ *  @param[in] t_args       The shared thread arguments.
+ *  @param[in] out          The output buffer.
+ *  @param[in] fout_retval  The last write's return value.
+ *
+ *  @return                 Returns the write's return value.
+ */
+static ssize_t attack_writer_write(struct attack_t_args *t_args,
+                                   struct attack_out *out,
+                                   ssize_t fout_retval) {
+    attack_st *attk_st = t_args->attk_st;
+    file_st *file_out = attk_st->file_out;
+    attack_stats *stats = t_args->writer_shard->stats;
+    char *buf = (char *)(out + 1);
+    uint64_t start = 0;
+
+    if (fout_retval >= 0 && out->size > 0) {
+        if (stats != NULL) {
+            start = attack_now_ns();
+        }
+        pthread_mutex_lock(&(file_out->mut));
+        fout_retval = file_out->next_block(file_out, &buf, out->size);
+        pthread_mutex_unlock(&(file_out->mut));
+        if (stats != NULL) {
+            histogram_record(&(stats->stages[ATTACK_STAGE_WRITE]),
+                             attack_now_ns() - start);
+        }
+        if (fout_retval < 0) {
+            /* Set an error and stop the queue */
+            pthread_mutex_lock(&(attk_st->mut));
+            if (attk_st->error == 0) {
+                attk_st->error = fout_retval;
+                attk_st->e_state = E_STATE_OUTPUT_FILE;
+            }
+            pthread_mutex_unlock(&(attk_st->mut));
+            work_queue_stop(&(t_args->q));
+            event_broadcast(&(t_args->order_ev));
+        }
+    }
+
+    attack_out_put(t_args, buf);
+
+    return fout_retval;
+}
+
+
+/** Private method that writes the output held back for a block.
+ *  Writes the block's output the writer thread held back, in the order it
+ *  was handed over.
+ *
+ *  @param[in]     t_args       The shared thread arguments.
+ *  @param[in]     seq          The block's sequence number.
+ *  @param[in,out] fout_retval  The last write's return value.
+ *
+ *  @return                     Returns 1 if the block's last output was
+ *                              written, otherwise 0.
+ */
+static int attack_writer_held(struct attack_t_args *t_args, uint64_t seq,
+                              ssize_t *fout_retval) {
+    struct attack_out **held = &(t_args->held[seq % t_args->order_window]);
+    struct attack_out *out;
+    int last = 0;
+
+    while (*held != NULL) {
+        out = *held;
+        *held = out->next;
+        last = out->last;
+        *fout_retval = attack_writer_write(t_args, out, *fout_retval);
+    }
+
+    return last;
+}
+
+
+/** The output writer thread.
+ *  Writes the output buffers the client threads hand over and passes them
+ *  back for reuse.  Buffers are written in the order they were handed over,
+ *  or when writing output in order, in the order their blocks were read,
+ *  holding back any that are early.  Keeps taking buffers after an error so
+ *  no client waits forever.  Runs until the output queue is stopped and
+ *  empty, then writes whatever is still held back, skipping the blocks that
+ *  were never checked.
+ *
+ *  @param[in] fargs The shared thread arguments.
+ *
+ *  @return          Returns NULL.
+ */
+static void *attack_writer_t(void *fargs) {
+    struct attack_t_args *t_args = fargs;
+    attack_st *attk_st = t_args->attk_st;
+    ssize_t fout_retval = 0;
+    struct attack_out *out;
+    struct attack_out **held;
+    uint64_t next = 0;
+    uint64_t i;
+    int last;
+    size_t size;
+
+    #ifdef DEBUG
+    printf("attack_writer_t: START (%p)\n", pthread_self());
+    #endif
+
+    while (queue_pop(&(t_args->out_q), (void **)&out, &size,
+                     QUEUE_WAIT_FOREVER) == 0) {
+        __atomic_sub_fetch(&(attk_st->_s.write_backlog), 1, __ATOMIC_RELAXED);
+
+        if (!t_args->ordered) {
+            fout_retval = attack_writer_write(t_args, out, fout_retval);
+            continue;
+        }
+
+        if (out->seq != next) {
+            /* Early, hold it back until its block is next */
+            assert(out->seq > next && out->seq < next + t_args->order_window);
+            out->next = NULL;
+            held = &(t_args->held[out->seq % t_args->order_window]);
+            while (*held != NULL) {
+                held = &((*held)->next);
+            }
+            *held = out;
+            continue;
+        }
+
+        /* Write it, then any held back output that is now next */
+        last = out->last;
+        fout_retval = attack_writer_write(t_args, out, fout_retval);
+        while (last) {
+            next += 1;
+            __atomic_store_n(&(t_args->order_next), next, __ATOMIC_RELEASE);
+            event_broadcast(&(t_args->order_ev));
+            last = attack_writer_held(t_args, next, &fout_retval);
+        }
+    }
+
+    /* Write what is left, the attack stopped before the blocks in between
+       were checked */
+    if (t_args->ordered) {
+        for (i = 0; i < t_args->order_window; i++) {
+            attack_writer_held(t_args, next + i, &fout_retval);
+        }
+    }
+
+    return NULL;
+}
+
+
+/** The progress thread.
+ *  Calls the attack's progress function with its status every progress_ms,
+ *  and whenever another progress_records records have been tested, until the
+ *  main thread stops it.  The status comes from check_attack, so it takes no
+ *  locks.  Runs at the lowest priority, it should not slow down the client
+ *  threads.
+ *
+ *  @param[in] fargs The shared thread arguments.
+ *
+ *  @return          Returns NULL.
+ */
+static void *attack_progress_t(void *fargs) {
+    struct attack_t_args *t_args = fargs;
+    attack_st *attk_st = t_args->attk_st;
+    attack_status status;
+    char *result;
+    double *thread_rates;
+    uint64_t interval_ns;
+    uint64_t last_ns;
+    uint64_t last_records = 0;
+    uint64_t now;
+    uint32_t key;
+    int wait_ms;
+
+    #ifdef DEBUG
+    printf("attack_progress_t: START (%p)\n", pthread_self());
+    #endif
+
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+
+    result = malloc(attk_st->file_in->record_size);
+    thread_rates = malloc(sizeof(double) * MAX_THREADS);
+    interval_ns = (uint64_t)(attk_st->progress_ms ? attk_st->progress_ms :
+                             ATTACK_PROGRESS_MS) * 1000000;
+    wait_ms = interval_ns / 1000000;
+    if (attk_st->progress_records > 0 && wait_ms > ATTACK_PROGRESS_POLL_MS) {
+        wait_ms = ATTACK_PROGRESS_POLL_MS;
+    }
+    last_ns = attack_now_ns();
+
+    while (result != NULL && thread_rates != NULL) {
+        /* Sleep until the next look, or until told to stop */
+        key = event_prepare(&(t_args->progress_ev));
+        if (__atomic_load_n(&(t_args->progress_stop), __ATOMIC_ACQUIRE)) {
+            event_cancel(&(t_args->progress_ev));
+            break;
+        }
+        event_wait_ms(&(t_args->progress_ev), key, wait_ms);
+        if (__atomic_load_n(&(t_args->progress_stop), __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        /* Take a snapshot, and hand it over if one is due */
+        memset(&status, 0, sizeof(attack_status));
+        status.result = result;
+        status.result_size = attk_st->file_in->record_size;
+        status.thread_rates = thread_rates;
+        status.thread_rates_size = MAX_THREADS;
+        check_attack(attk_st, &status);
+        now = attack_now_ns();
+        if (now - last_ns >= interval_ns ||
+            (attk_st->progress_records > 0 &&
+             status.records_tested - last_records >=
+             attk_st->progress_records)) {
+            attk_st->progress(attk_st, &status);
+            last_ns = now;
+            last_records = status.records_tested;
+        }
+    }
+
+    free(result);
+    free(thread_rates);
+
+    return NULL;
+}
+
+
+/** Private method that sets the attack result.
+ *  Claims the result slot and publishes the result, unless another thread
+ *  already has.
+ *
+ *  @param[in] attk_st  The attack object.
+ *  @param[in] result   The result, record_size bytes.  On success the attack
+ *                      owns it.
+ *
+ *  @return             Returns 1 if the result was set, otherwise 0.
+ */
+static int attack_set_result(attack_st *attk_st, char *result) {
+    size_t result_size = 0;
+
+    if (__atomic_compare_exchange_n(&(attk_st->_s.result_size), &result_size,
+                                    attk_st->file_in->record_size, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&(attk_st->_s.result), result, __ATOMIC_RELEASE);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/** Private method that collects a match.
+ *  Adds the record to the collected results.  The first result collected is
+ *  also the attack result check_attack reports.  On an error it sets the
+ *  attack error and stops the attack.
+ *
+ *  @param[in] attk_st  The attack object.
+ *  @param[in] record   The matching record.
+ *
+ *  @return             Returns 1 if max_results have been collected and the
+ *                      attack should stop, otherwise 0.
+ */
+static int attack_collect(attack_st *attk_st, char *record) {
+    int64_t slot;
+    char *result;
+
+    slot = result_store_add(attk_st->_results, record);
+    if (slot == RESULT_STORE_E_FULL) {
+        /* Other threads filled it first */
+        return 1;
+    } else if (slot < 0) {
+        /* Set an error and stop the attack */
+        pthread_mutex_lock(&(attk_st->mut));
+        if (attk_st->error == 0) {
+            attk_st->error = E_ATTK_SYSTEM;
+            attk_st->e_state = E_STATE_RESULTS;
+        }
+        pthread_mutex_unlock(&(attk_st->mut));
+        stop_attack(attk_st);
+        return 0;
+    }
+
+    if (slot == 1) {
+        result = malloc(attk_st->file_in->record_size);
+        if (result != NULL) {
+            memcpy(result, record, attk_st->file_in->record_size);
+            if (!attack_set_result(attk_st, result)) {
+                free(result);
+            }
+        }
+    }
+
+    return attk_st->max_results > 0 && (uint64_t)slot >= attk_st->max_results;
+}
+
+
+/** Private method that checks if a client thread should retire.
+ *  Called between blocks once the client's number is at or above the
+ *  attack's thread count.  The count is checked again under the attack
+ *  mutex, so a client is never both retired and kept by set_attack_threads.
+ *
+ *  @param[in] arg_list The client thread arguments.
+ *
+ *  @return             Returns 1 if the client should exit, otherwise 0.
  */
-struct attack_t_args {
-    attack_st *attk_st;   /**< The main thread's argument list. */
-    queue q;              /**< The queue.                       */
-};
+static int attack_retire_client(struct attack_client_args *arg_list) {
+    attack_st *attk_st = arg_list->t_args->attk_st;
+    int retire = 0;
+
+    pthread_mutex_lock(&(attk_st->mut));
+    if (arg_list->id >= attk_st->threads) {
+        /* Free the slot, a new client takes it if the count grows again */
+        arg_list->t_args->slots[arg_list->id] = NULL;
+        retire = 1;
+    }
+    pthread_mutex_unlock(&(attk_st->mut));
+
+    return retire;
+}
 
 
 /** A client thread.
  *  Attack client thread, removes a block of records from the queue and
- *  processes them, calling attack_check for each record.
+ *  processes them, calling attack_check for each record, or attack_check_batch
+ *  for as many records at a time as the output buffer has room for.
  *
  *  @param[in] fargs The attack client thread arguments.
  *
  *  @return          Returns 0 on success, otherwise an error code.
  */
 void *attack_client_t(void *fargs) {
-    struct attack_t_args *arg_list; /* passed argument                       */
+    struct attack_client_args *arg_list; /* passed argument                  */
+    struct attack_shard *shard;     /* client counters                       */
     attack_st *attk_st;             /* main attack_st                        */
     file_st *file_in;               /* input file structure                  */
     file_st *file_out;              /* output file structure                 */
-    char *fout_buf;                 /* output file buffer                    */
-    size_t fout_buf_size;           /* size of output file buffer            */
-    char *fout_buf_p;               /* output file buffer pointer            */
-    queue *q;                       /* data queue                            */
+    char *fout_buf = NULL;          /* output file buffer                    */
+    size_t fout_buf_size = 0;       /* size of output file buffer            */
+    char *fout_buf_p = NULL;        /* output file buffer pointer            */
+    size_t fout_record_size = 0;    /* output record size                    */
+    size_t fout_stride = 0;         /* distance between output records       */
+    size_t fout_head = 0;           /* output buffer bytes before the records*/
+    char *out_p;                    /* compacted output buffer pointer       */
+    work_queue *q;                  /* data queue                            */
+    struct attack_block *block;     /* record block                          */
     char *buf = NULL;               /* record buffer                         */
     size_t buf_size;                /* size of the buffer                    */
-    size_t buf_p;                   /* current buffer position               */
+    int complete;                   /* set if every record was checked       */
+    int packed;                     /* set if the input blocks are packed    */
     char *record;                   /* an individual record                  */
+    size_t record_len;              /* length of the record                  */
+    char *record_buf = NULL;        /* a packed record, padded with 0s       */
+    size_t pad_len = 0;             /* bytes of record_buf not yet cleared   */
+    attack_records packed_records;  /* a batch of packed records             */
     char *result;                   /* The result buffer                     */
+    uint64_t *results = NULL;       /* batch results bitmap                  */
+    size_t results_count = 0;       /* records the results bitmap can hold   */
+    size_t rec_count;               /* records in the current block          */
+    size_t rec_i;                   /* current record in the block           */
+    size_t count;                   /* records in the current batch          */
+    size_t room;                    /* records the output buffer has room for*/
+    size_t invalid;                 /* invalid records in the current batch  */
+    size_t j;                       /* generic counter                       */
+    int r;                          /* a single batch result                 */
     uint64_t records_tested;        /* records tested for the current block  */
-    struct timespec ts;             /* conditional timeout                   */
+    int queue_retval;               /* queue pop return value                */
     int check_retval;               /* attack check return value             */
+    int batch_retval;               /* attack check batch return value       */
     int free_block_retval;          /* input file free_block return value    */
-    int fout_retval;                /* file out return value                 */
+    int fout_retval = 0;            /* file out return value                 */
+    uint64_t wait_start = 0;        /* when the queue pop started            */
+    uint64_t check_start = 0;       /* when the block check started          */
+    uint64_t now = 0;               /* when the block check ended            */
+    int timed;                      /* set if blocks are timed               */
+    int stop_records;               /* records between stop flag looks       */
+    int stop_left;                  /* records until the next look           */
 
     #ifdef DEBUG
     printf("attack_client_t: START (%p)\n", pthread_self());
     #endif
 
     /* Set defaults */
-    arg_list = (struct attack_t_args *)fargs;
-    attk_st = arg_list->attk_st;
+    arg_list = (struct attack_client_args *)fargs;
+    attk_st = arg_list->t_args->attk_st;
+    shard = arg_list->shard;
     file_in = attk_st->file_in;
-    if (attk_st->file_out != NULL) {
-        file_out = attk_st->file_out;
-        fout_buf_size = file_out->record_size * file_in->records_per_block;
-        fout_buf = malloc(fout_buf_size);
+    file_out = attk_st->file_out;
+    if (file_out != NULL) {
+        fout_record_size = file_out->record_size;
+        fout_stride = arg_list->t_args->out_stride;
+        fout_head = arg_list->t_args->out_head;
+        fout_buf_size = arg_list->t_args->out_size;
+        fout_buf = attack_out_get(arg_list->t_args);
+    }
+    q = &(arg_list->t_args->q);
+    if (file_out != NULL && fout_buf == NULL) {
+        /* Set an error */
+        pthread_mutex_lock(&(attk_st->mut));
+        if (attk_st->error == 0) {
+            attk_st->error = E_ATTK_SYSTEM;
+            attk_st->e_state = E_STATE_OUTPUT_FILE;
+        }
+        pthread_mutex_unlock(&(attk_st->mut));
+
+        /* Stop the queue, this client checks nothing */
+        work_queue_stop(q);
+        fout_retval = E_ATTK_SYSTEM;
+    } else if (file_out != NULL) {
         memset(fout_buf, 0, fout_buf_size);
-        fout_buf_p = fout_buf;
+        fout_buf_p = fout_buf + fout_head;
     }
-    q = &(arg_list->q);
     check_retval = E_ATTK_RECORD_INVALID;
+    timed = attk_st->block_target_us > 0 || shard->stats != NULL;
+    stop_records = attk_st->stop_records > 0 ? attk_st->stop_records :
+                   ATTACK_STOP_RECORDS;
+
+    /* Start the rate, and let check_attack see it */
+    __atomic_store_n(&(shard->rate_ns), attack_now_ns(), __ATOMIC_RELAXED);
+    __atomic_store_n(&(shard->client), arg_list->id + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&(shard->running), 1, __ATOMIC_RELEASE);
 
     /* Set the result buffer to be the same size as a record */
     #ifdef DEBUG
@@ -94,100 +1338,280 @@ void *attack_client_t(void *fargs) {
     result = malloc(file_in->record_size);
     memset(result, 0, file_in->record_size);
 
+    /* Packed records are copied out to a record sized buffer for checking */
+    packed = (file_in->flags & FILE_PACKED) != 0;
+    if (packed) {
+        record_buf = calloc(1, file_in->record_size);
+    }
+
     /* Loop while the queue is active, grabbing blocks of records from the
        queue and checking each record.*/
-    while (q->state != QUEUE_STATE_STOPPED) {
-        /* Get a record block from the queue */
-        pthread_mutex_lock(&(q->mut));
-        while (q->empty && q->state != QUEUE_STATE_STOPPED) {
-            /* Wait for the queue to have something, or for
-               QUEUE_EMPTY_WAIT_SEC seconds */
-            clock_gettime(CLOCK_REALTIME, &ts);
-            ts.tv_sec += QUEUE_EMPTY_WAIT_SEC;
-            pthread_cond_timedwait(&(q->not_empty), &(q->mut), &ts);
-            continue; /* We still need to make sure the queue is not empty */
-        }
-
-        if (q->state == QUEUE_STATE_STOPPED) {
+    while (fout_retval >= 0 &&
+           work_queue_get_state(q) != QUEUE_STATE_STOPPED) {
+        /* Retire, between blocks, if there are too many client threads */
+        if (arg_list->id >= __atomic_load_n(&(attk_st->threads),
+                                            __ATOMIC_RELAXED) &&
+            attack_retire_client(arg_list)) {
+            break;
+        }
+
+        /* Get a record block from our lane of the queue, or steal one from
+           another lane, sleeping until the queue has something or is
+           stopped */
+        if (timed) {
+            wait_start = attack_now_ns();
+        }
+        queue_retval = work_queue_pop(q, arg_list->lane, (void **)&block,
+                                      &buf_size, QUEUE_WAIT_FOREVER);
+        if (timed) {
+            check_start = attack_now_ns();
+        }
+
+        if (queue_retval == QUEUE_E_STOPPED) {
             /* Time to shut down */
-            pthread_mutex_unlock(&(q->mut));
             break;
-        } else {
-            /* Grab a record block */
-            queue_pop(q, (void **)&buf, &buf_size);
-            pthread_mutex_unlock(&(q->mut));
-            pthread_cond_signal(&(q->not_full));
+        } else if (queue_retval != 0) {
+            /* We still need to make sure the queue is not empty */
+            continue;
+        }
+
+        buf = block->buf;
+        rec_count = attack_block_records(file_in, block);
+        if (attk_st->attack_check_batch != NULL) {
+            /* Make sure the results bitmap can hold the whole block */
+            if (rec_count > results_count) {
+                free(results);
+                results_count = rec_count;
+                results = malloc(ATTK_BATCH_WORDS(results_count) *
+                                 sizeof(uint64_t));
+                if (results == NULL) {
+                    /* Set an error */
+                    pthread_mutex_lock(&(attk_st->mut));
+                    if (attk_st->error == 0) {
+                        attk_st->error = E_ATTK_SYSTEM;
+                        attk_st->e_state = E_STATE_ATTACK_CHECK;
+                    }
+                    pthread_mutex_unlock(&(attk_st->mut));
+
+                    /* Stop the queue, the block is given back unchecked */
+                    work_queue_stop(q);
+                    results_count = 0;
+                    fout_retval = E_ATTK_SYSTEM;
+                }
+            }
+
+            /* Loop over the record buffer one batch at a time */
+            rec_i = records_tested = 0;
+            check_retval = E_ATTK_RECORD_NO_MATCH;
+            while (results != NULL && rec_i < rec_count) {
+                /* Give up on the block if the attack is stopping */
+                if (__atomic_load_n(&(arg_list->t_args->stop),
+                                    __ATOMIC_RELAXED)) {
+                    break;
+                }
+
+                /* Check as many records as the output buffer can take, only
+                   a few at a time if stop_records was set, so a stop is seen
+                   soon */
+                count = rec_count - rec_i;
+                if (attk_st->stop_records > 0 &&
+                    count > (size_t)stop_records) {
+                    count = stop_records;
+                }
+                if (file_out != NULL) {
+                    room = (fout_buf + fout_buf_size - fout_buf_p) /
+                           fout_stride;
+                    if (count > room) {
+                        count = room;
+                    }
+                }
+                memset(results, 0, ATTK_BATCH_WORDS(count) * sizeof(uint64_t));
+                if (packed) {
+                    packed_records.block = buf;
+                    packed_records.offsets = ATTK_PACKED_OFFSETS(buf) + rec_i;
+                    record = (char *)&packed_records;
+                } else {
+                    record = buf + rec_i * file_in->record_size;
+                }
+                batch_retval = attk_st->attack_check_batch(
+                    record,
+                    count,
+                    packed ? 0 : file_in->record_size,
+                    fout_buf_p,
+                    fout_stride,
+                    results,
+                    attk_st->attack_data
+                );
+                if (batch_retval != 0) {
+                    /* Set an error */
+                    pthread_mutex_lock(&(attk_st->mut));
+                    assert(attk_st->error == 0);
+                    attk_st->error = batch_retval;
+                    attk_st->e_state = E_STATE_ATTACK_CHECK;
+                    pthread_mutex_unlock(&(attk_st->mut));
+
+                    /* Stop the queue */
+                    work_queue_stop(q);
+                    fout_retval = batch_retval;
+
+                    break;
+                }
+
+                /* Go over the results, dropping invalid records from the
+                   output buffer */
+                out_p = fout_buf_p;
+                invalid = 0;
+                for (j = 0; j < count; j++) {
+                    /* Skip a whole word of tested records that did not match,
+                       as long as nothing needs to move in the output buffer */
+                    if (j % ATTK_BATCH_PER_WORD == 0 &&
+                        j + ATTK_BATCH_PER_WORD <= count &&
+                        results[j / ATTK_BATCH_PER_WORD] == 0 &&
+                        (file_out == NULL ||
+                         (invalid == 0 && !arg_list->t_args->out_packed))) {
+                        j += ATTK_BATCH_PER_WORD - 1;
+                        continue;
+                    }
+
+                    r = ATTK_BATCH_GET(results, j);
+                    if (r == ATTK_BATCH_INVALID) {
+                        invalid += 1;
+                        continue;
+                    }
+
+                    if (file_out != NULL && invalid > 0) {
+                        memmove(fout_buf_p + (j - invalid) * fout_stride,
+                                fout_buf_p + j * fout_stride,
+                                fout_stride);
+                    }
+                    if (file_out != NULL && arg_list->t_args->out_packed) {
+                        attack_out_len(arg_list->t_args, fout_buf,
+                                       fout_buf_p + (j - invalid) * fout_stride,
+                                       packed ? ATTK_PACKED_LEN(buf, rec_i + j) :
+                                                file_in->record_size);
+                    }
+
+                    if (r == ATTK_BATCH_MATCH && check_retval != 0) {
+                        /* We have an answer! */
+                        if (packed) {
+                            record = attack_packed_copy(buf, rec_i + j,
+                                                        record_buf, &pad_len,
+                                                        &record_len);
+                        } else {
+                            record = buf + (rec_i + j) * file_in->record_size;
+                        }
+                        #ifdef DEBUG
+                        printf("Answer found: (%s) (%i)\n", record,
+                               file_in->record_size);
+                        #endif
+                        if (!attk_st->collect_results ||
+                            attack_collect(attk_st, record)) {
+                            memcpy(result, record, file_in->record_size);
+                            check_retval = 0;
+                        }
+                    }
+                }
+                records_tested += count - invalid;
+                rec_i += count;
+
+                /* Advance the file out pointer */
+                if (file_out != NULL) {
+                    out_p = fout_buf_p + (count - invalid) * fout_stride;
+                    memset(out_p, 0, invalid * fout_stride);
+                    fout_buf_p = out_p;
+
+                    /* Is the file out buffer full? */
+                    if (fout_buf_p >= (fout_buf + fout_buf_size)) {
+                        fout_retval = attack_write_out(arg_list->t_args, shard,
+                                                       &fout_buf,
+                                                       fout_buf_size,
+                                                       block->seq, 0);
+                        if (fout_retval < 0) {
+                            break;
+                        }
+                        memset(fout_buf, 0, fout_buf_size);
+                        fout_buf_p = fout_buf + fout_head;
+                    }
+                }
 
+                if (check_retval == 0) {
+                    /* Stop processing the current read block */
+                    break;
+                }
+            }
+            complete = rec_i >= rec_count;
+        } else {
             /* Loop over the record buffer one record at a time */
-            buf_p = records_tested = 0;
-            while (buf_p < buf_size) {
-                /* Get the next record */
-                record = (char *)(buf + buf_p);
-                buf_p += file_in->record_size;
+            rec_i = records_tested = 0;
+            stop_left = stop_records;
+            while (rec_i < rec_count) {
+                /* Give up on the block if the attack is stopping, looking
+                   every stop_records records */
+                if (--stop_left == 0) {
+                    stop_left = stop_records;
+                    if (__atomic_load_n(&(arg_list->t_args->stop),
+                                        __ATOMIC_RELAXED)) {
+                        break;
+                    }
+                }
 
-                /* Check the record */
-                if (attk_st->file_out != NULL) {
-                    check_retval = attk_st->attack_check(
-                        record,
-                        file_in->record_size,
-                        fout_buf_p,
-                        file_out->record_size,
-                        attk_st->attack_data
-                    );
+                /* Get the next record */
+                if (packed) {
+                    record = attack_packed_copy(buf, rec_i, record_buf,
+                                                &pad_len, &record_len);
                 } else {
-                    check_retval = attk_st->attack_check(
-                        record,
-                        file_in->record_size,
-                        NULL,
-                        0,
-                        attk_st->attack_data
-                    );
+                    record = (char *)(buf + rec_i * file_in->record_size);
+                    record_len = file_in->record_size;
                 }
+                rec_i++;
+
+                /* Check the record */
+                check_retval = attk_st->attack_check(
+                    record,
+                    record_len,
+                    fout_buf_p,
+                    fout_record_size,
+                    attk_st->attack_data
+                );
 
                 if (check_retval != E_ATTK_RECORD_INVALID) {
                     /* Update records tested */
                     records_tested += 1;
 
                     /* Advance the file out pointer */
-                    if (attk_st->file_out != NULL) {
-                        fout_buf_p += file_out->record_size;
+                    if (file_out != NULL) {
+                        if (arg_list->t_args->out_packed) {
+                            attack_out_len(arg_list->t_args, fout_buf,
+                                           fout_buf_p, record_len);
+                        }
+                        fout_buf_p += fout_stride;
 
                         /* Is the file out buffer full? */
-                        if (fout_buf_p >=
-                            (fout_buf + fout_buf_size)) {
-                            pthread_mutex_lock(&(file_out->mut));
-                            fout_retval = file_out->next_block(
-                                file_out,
-                                &fout_buf,
-                                fout_buf_size
-                            );
+                        if (fout_buf_p >= (fout_buf + fout_buf_size)) {
+                            fout_retval = attack_write_out(arg_list->t_args,
+                                                           shard, &fout_buf,
+                                                           fout_buf_size,
+                                                           block->seq, 0);
                             if (fout_retval < 0) {
-                                /* Set an error */
-                                pthread_mutex_lock(&(attk_st->mut));
-                                assert(attk_st->error == 0);
-                                attk_st->error = fout_retval;
-                                attk_st->e_state = E_STATE_OUTPUT_FILE;
-                                pthread_mutex_unlock(&(attk_st->mut));
-
-                                /* Stop the queue */
-                                pthread_mutex_lock(&(q->mut));
-                                queue_stop(q);
-                                pthread_mutex_unlock(&(q->mut));
-
                                 break;
                             }
-                            pthread_mutex_unlock(&(file_out->mut));
                             memset(fout_buf, 0, fout_buf_size);
-                            fout_buf_p = fout_buf;
+                            fout_buf_p = fout_buf + fout_head;
                         }
                     }
 
                     if (check_retval == 0) {
-                        /* We have the answer! */
+                        /* We have an answer! */
                         #ifdef DEBUG
                         printf("Answer found: (%s) (%i)\n", record,
                                file_in->record_size);
                         #endif
+                        if (attk_st->collect_results &&
+                            !attack_collect(attk_st, record)) {
+                            /* Keep going */
+                            check_retval = E_ATTK_RECORD_NO_MATCH;
+                            continue;
+                        }
                         memcpy(result, record, file_in->record_size);
 
                         /* Stop processing the current read block */
@@ -195,83 +1619,534 @@ void *attack_client_t(void *fargs) {
                     }
                 }
             }
+            complete = rec_i >= rec_count;
+        }
+
+        /* Hand over the block's output, even if there is none, when the
+           writer puts the output in order */
+        if (arg_list->t_args->ordered && fout_retval >= 0) {
+            fout_retval = attack_write_out(arg_list->t_args, shard, &fout_buf,
+                                           fout_buf_p - fout_buf, block->seq,
+                                           1);
+            if (fout_retval == 0) {
+                memset(fout_buf, 0, fout_buf_size);
+                fout_buf_p = fout_buf + fout_head;
+            }
+        }
+
+        /* Update the records tested counter, we are its only writer */
+        __atomic_store_n(&(shard->records_tested),
+                         shard->records_tested + records_tested,
+                         __ATOMIC_RELAXED);
+
+        /* Mark the block done, if every record in it was checked */
+        if (arg_list->t_args->checkpointing && complete) {
+            attack_block_done(arg_list->t_args, block);
+        }
+
+        /* Update the rate, and the block timings the producers size blocks
+           from */
+        now = attack_now_ns();
+        attack_rate_add(shard, records_tested, now);
+        if (attk_st->block_target_us > 0) {
+            __atomic_store_n(&(shard->wait_ns),
+                             shard->wait_ns + (check_start - wait_start),
+                             __ATOMIC_RELAXED);
+            __atomic_store_n(&(shard->check_ns),
+                             shard->check_ns + (now - check_start),
+                             __ATOMIC_RELAXED);
+            __atomic_store_n(&(shard->check_records),
+                             shard->check_records + rec_count,
+                             __ATOMIC_RELAXED);
+            __atomic_store_n(&(shard->blocks), shard->blocks + 1,
+                             __ATOMIC_RELAXED);
+        }
+        if (shard->stats != NULL) {
+            histogram_record(&(shard->stats->stages[ATTACK_STAGE_QUEUE_POP]),
+                             check_start - wait_start);
+            histogram_record(&(shard->stats->stages[ATTACK_STAGE_CHECK]),
+                             now - check_start);
+        }
 
-            /* Update the records tested counter */
+        /* Free the record block */
+        free_block_retval = attack_release_block(arg_list->t_args, shard,
+                                                 file_in, block);
+        if (shard->stats != NULL) {
+            histogram_record(&(shard->stats->stages[ATTACK_STAGE_FREE]),
+                             attack_now_ns() - now);
+        }
+        if (free_block_retval != 0) {
+            /* Set an error */
             pthread_mutex_lock(&(attk_st->mut));
-            attk_st->_s.records_tested += records_tested;
+            assert(attk_st->error == 0);
+            attk_st->error = free_block_retval;
+            attk_st->e_state = E_STATE_INPUT_FILE;
             pthread_mutex_unlock(&(attk_st->mut));
 
-            /* Free the record block */
-            pthread_mutex_lock(&(file_in->mut));
-            free_block_retval = file_in->free_block(file_in, buf, buf_size);
-            pthread_mutex_unlock(&(file_in->mut));
-            if (free_block_retval != 0) {
-                /* Set an error */
-                pthread_mutex_lock(&(attk_st->mut));
-                assert(attk_st->error == 0);
-                attk_st->error = free_block_retval;
-                attk_st->e_state = E_STATE_INPUT_FILE;
-                pthread_mutex_unlock(&(attk_st->mut));
+            /* Stop the queue */
+            work_queue_stop(q);
 
-                /* Stop the queue */
-                pthread_mutex_lock(&(q->mut));
-                queue_stop(q);
-                pthread_mutex_unlock(&(q->mut));
+            break;
+        }
 
-                break;
-            }
+        if (check_retval == 0 || fout_retval < 0) {
+            /* We have the answer, or an error - Stop processing the queue */
+            break;
+        }
+    }
+    free(results);
+    free(record_buf);
+    if (shard->pool != NULL) {
+        block_pool_flush(shard->pool, &(shard->cache));
+    }
 
-            if (check_retval == 0) {
-                /* We have the answer! - Stop processing the queue */
-                break;
+    /* Write out any remaining file output buffer contents */
+    if (file_out != NULL) {
+        if (fout_retval == 0 && fout_buf_p > fout_buf + fout_head) {
+            attack_write_out(arg_list->t_args, shard, &fout_buf,
+                             fout_buf_p - fout_buf, 0, 0);
+        }
+        if (fout_buf != NULL) {
+            attack_out_put(arg_list->t_args, fout_buf);
+        }
+    }
+
+    /* Set the answer, if we have it */
+    if (check_retval == 0) {
+        /* Claim the result slot, then publish the result */
+        if (!attack_set_result(attk_st, result)) {
+            /* We already have an answer, free the result buffer */
+            free(result);
+        }
+
+        /* Stop the attack, this wakes everyone up */
+        stop_attack(attk_st);
+    } else {
+        /* No answer, free the result buffer */
+        free(result);
+    }
+
+    /* Wake the producer if it is waiting on the writer, the queue may have
+       been stopped */
+    if (arg_list->t_args->ordered) {
+        event_broadcast(&(arg_list->t_args->order_ev));
+    }
+
+    __atomic_store_n(&(shard->running), 0, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&(attk_st->_s.threads), 1, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+
+/** Private method that starts a client thread.
+ *  Starts a client thread with the given number, pinned to its CPU when
+ *  client threads are placed, and fed from its node's lane when there is a
+ *  lane per NUMA node.  The caller holds the attack mutex.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *  @param[in] id       The client's number.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+static int attack_start_client(struct attack_t_args *t_args, int id) {
+    attack_st *attk_st = t_args->attk_st; /* main attack_st                   */
+    struct attack_client_args *c_args;  /* client thread arguments            */
+    pthread_attr_t attr;                /* client thread attributes           */
+    cpu_set_t cpu_set;                  /* CPU for the client to run on       */
+    int cpu;                            /* CPU for the client                 */
+    int node = 0;                       /* NUMA node index for the client     */
+    int retval = -1;                    /* pthread_create return value        */
+
+    c_args = malloc(sizeof(struct attack_client_args));
+    if (c_args == NULL) {
+        return E_ATTK_SYSTEM;
+    }
+    c_args->t_args = t_args;
+    c_args->shard = attack_shard_new(attk_st);
+    if (c_args->shard == NULL) {
+        free(c_args);
+        return E_ATTK_SYSTEM;
+    }
+    c_args->id = id;
+    c_args->lane = id;
+
+    /* Pick the client's CPU, and its node's lane */
+    if (t_args->placement != ATTACK_PLACE_NONE) {
+        topology_place(&(t_args->topo), id,
+                       t_args->placement == ATTACK_PLACE_SPREAD, &cpu, &node);
+        if (t_args->pool_count > 1) {
+            c_args->lane = node;
+        }
+    }
+    c_args->shard->pool = t_args->pooled ?
+                          &(t_args->pools[node % t_args->pool_count]) : NULL;
+
+    /* Start the thread, pinned to its CPU */
+    __atomic_add_fetch(&(attk_st->_s.threads), 1, __ATOMIC_RELAXED);
+    if (t_args->placement != ATTACK_PLACE_NONE) {
+        pthread_attr_init(&attr);
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpu_set);
+        retval = pthread_create(&(c_args->thread), &attr, attack_client_t,
+                                (void *)c_args);
+        pthread_attr_destroy(&attr);
+    }
+    if (retval != 0) {
+        /* Not placing threads, or the CPU may have gone away, run it
+           anywhere */
+        retval = pthread_create(&(c_args->thread), NULL, attack_client_t,
+                                (void *)c_args);
+    }
+    if (retval != 0) {
+        __atomic_sub_fetch(&(attk_st->_s.threads), 1, __ATOMIC_RELAXED);
+        free(c_args);
+        return E_ATTK_SYSTEM;
+    }
+
+    /* Keep track of it */
+    c_args->next = t_args->clients;
+    t_args->clients = c_args;
+    t_args->slots[id] = c_args;
+
+    return 0;
+}
+
+
+/** Private method that starts client threads up to the thread count.
+ *  Starts a client for each free slot below the attack's thread count.
+ *  Slots still held by a running client are left alone, that client keeps
+ *  going.  The caller holds the attack mutex.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+static int attack_start_clients(struct attack_t_args *t_args) {
+    attack_st *attk_st = t_args->attk_st;
+    struct attack_client_args **slots;
+    int slot_count;
+    int retval;
+    int i;
+
+    if (!t_args->started || t_args->closed) {
+        return 0;
+    }
+
+    /* Make room for the new slots */
+    if (attk_st->threads > t_args->slot_count) {
+        slot_count = t_args->slot_count * 2;
+        if (slot_count < attk_st->threads) {
+            slot_count = attk_st->threads;
+        }
+        slots = realloc(t_args->slots,
+                        sizeof(struct attack_client_args *) * slot_count);
+        if (slots == NULL) {
+            return E_ATTK_SYSTEM;
+        }
+        memset(slots + t_args->slot_count, 0,
+               sizeof(struct attack_client_args *) *
+               (slot_count - t_args->slot_count));
+        t_args->slots = slots;
+        t_args->slot_count = slot_count;
+    }
+
+    /* Fill the free slots */
+    for (i = 0; i < attk_st->threads; i++) {
+        if (t_args->slots[i] == NULL) {
+            retval = attack_start_client(t_args, i);
+            if (retval != 0) {
+                return retval;
             }
         }
     }
 
-    /* Write out any remaining file output buffer contents */
-    if (attk_st->file_out != NULL) {
-        if (fout_buf_p > fout_buf) {
-            pthread_mutex_lock(&(file_out->mut));
-            fout_retval = file_out->next_block(file_out, &fout_buf,
-                                               fout_buf_p - fout_buf);
-            if (fout_retval < 0) {
+    return 0;
+}
+
+
+/** Private method that waits for a block's turn to be checked.
+ *  When writing output in order, waits until the block is no more than
+ *  order_window blocks ahead of the next one to write, so the writer never
+ *  holds back more than that.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *  @param[in] seq      The block's sequence number.
+ *
+ *  @return             Returns 0 on success, QUEUE_E_STOPPED if the queue
+ *                      stopped.
+ */
+static int attack_order_wait(struct attack_t_args *t_args, uint64_t seq) {
+    uint32_t key;
+
+    while (seq >= __atomic_load_n(&(t_args->order_next), __ATOMIC_ACQUIRE) +
+                  t_args->order_window) {
+        /* Wait for the writer to move on */
+        key = event_prepare(&(t_args->order_ev));
+        if (work_queue_get_state(&(t_args->q)) != QUEUE_STATE_ACTIVE) {
+            event_cancel(&(t_args->order_ev));
+            return QUEUE_E_STOPPED;
+        }
+        if (seq < __atomic_load_n(&(t_args->order_next), __ATOMIC_ACQUIRE) +
+                  t_args->order_window) {
+            event_cancel(&(t_args->order_ev));
+            break;
+        }
+        event_wait(&(t_args->order_ev), key, QUEUE_WAIT_FOREVER);
+    }
+
+    return 0;
+}
+
+
+/** Private method that fills the queue from a file.
+ *  Adds blocks from the file to the queue until the file runs out, the queue
+ *  stops, or the attack stops.  On an error it sets the attack error and
+ *  marks the attack as stopping, so any other producers stop too.
+ *
+ *  With a block pool per NUMA node, blocks go to each node's lane in turn,
+ *  filled from that node's pool.
+ *
+ *  On a resumed attack, records the checkpoint has as done are skipped, by
+ *  seeking past them if the file can seek, otherwise by reading and dropping
+ *  them.
+ *
+ *  When writing output in order, blocks are numbered in the order they are
+ *  read and a block waits for its turn before going into the queue.
+ *
+ *  @param[in] t_args   The shared thread arguments.
+ *  @param[in] shards   The calling thread's counters, one per block pool.
+ *  @param[in] file     The file, or file part, to read blocks from.
+ */
+static void attack_produce(struct attack_t_args *t_args,
+                           struct attack_shard **shards, file_st *file) {
+    attack_st *attk_st = t_args->attk_st; /* main attack_st                   */
+    struct attack_shard *shard;         /* counters for the current lane      */
+    int lane = 0;                       /* the current lane                   */
+    struct attack_tuner tuner;          /* block size tuning state            */
+    int records_per_block;              /* the file's own records per block   */
+    struct attack_block *block;         /* record block                       */
+    uint64_t records;                   /* records to put in the block        */
+    uint64_t next_record;               /* the next record in the file        */
+    uint64_t gap;                       /* the next record not done yet       */
+    uint64_t gap_end;                   /* the end of the records not done    */
+    uint64_t seq = 0;                   /* the next block sequence number     */
+    uint64_t start = 0;                 /* when the current stage started     */
+    int skip;                           /* set if the block is already done   */
+    ssize_t buf_size;                   /* record buffer size                 */
+    int queue_retval;                   /* queue push return value            */
+    int free_block_retval;              /* file free_block return value       */
+
+    /* Start tuning from the file's own block size */
+    records_per_block = file->records_per_block;
+    memset(&tuner, 0, sizeof(struct attack_tuner));
+    tuner.records = records_per_block;
+    if (tuner.records < t_args->block_min) {
+        tuner.records = t_args->block_min;
+    } else if (tuner.records > t_args->block_max) {
+        tuner.records = t_args->block_max;
+    }
+    tuner.countdown = ATTACK_TUNE_BLOCKS;
+    __atomic_store_n(&(attk_st->_s.records_per_block), tuner.records,
+                     __ATOMIC_RELAXED);
+    next_record = file->first_record;
+
+    while (attk_st->state == ATTACK_STATE_ACTIVE) {
+        shard = shards[lane];
+        skip = 0;
+        buf_size = 0;
+
+        /* Size the block */
+        if (attk_st->block_target_us > 0) {
+            attack_tune_block(t_args, &tuner);
+            records = tuner.records;
+        } else {
+            records = t_args->block_max;
+        }
+
+        /* Skip past the records the checkpoint has as done */
+        if (t_args->resumed) {
+            gap = checkpoint_next(attk_st->_checkpoint, next_record, &gap_end);
+            if (gap > next_record && file->seek != NULL) {
+                pthread_mutex_lock(&(file->mut));
+                buf_size = file->seek(file, gap - file->first_record);
+                pthread_mutex_unlock(&(file->mut));
+                next_record = gap;
+            } else if (gap > next_record) {
+                skip = 1;
+                gap_end = gap;
+            }
+            if (gap_end - next_record < records) {
+                records = gap_end - next_record;
+            }
+        }
+
+        /* Fill a block */
+        block = NULL;
+        if (buf_size == 0) {
+            block = attack_get_block(t_args, shard);
+            if (block == NULL) {
+                buf_size = E_ATTK_SYSTEM;
+            } else if (!t_args->file_buffers) {
+                buf_size = file->record_size * records;
+            }
+        }
+        if (block != NULL) {
+            if (shard->stats != NULL) {
+                start = attack_now_ns();
+            }
+            pthread_mutex_lock(&(file->mut));
+            if (t_args->file_buffers) {
+                file->records_per_block = records;
+            }
+            buf_size = file->next_block(file, &(block->buf), buf_size);
+            pthread_mutex_unlock(&(file->mut));
+            if (shard->stats != NULL) {
+                histogram_record(&(shard->stats->stages[ATTACK_STAGE_READ]),
+                                 attack_now_ns() - start);
+            }
+            block->size = buf_size > 0 ? buf_size : 0;
+            block->first = next_record;
+            records = attack_block_records(file, block);
+            next_record += records;
+            __atomic_store_n(&(shard->records_read),
+                             shard->records_read + records, __ATOMIC_RELAXED);
+        }
+        if (block != NULL && (buf_size <= 0 || skip)) {
+            /* Nothing to check, give the block back */
+            free_block_retval = attack_release_block(t_args, shard, file,
+                                                     block);
+            if (buf_size >= 0 && free_block_retval != 0) {
+                buf_size = free_block_retval;
+            }
+        }
+        if (buf_size < 0) {
+            /* Set an error and stop the attack */
+            pthread_mutex_lock(&(attk_st->mut));
+            if (attk_st->error == 0) {
+                attk_st->error = buf_size;
+                attk_st->e_state = E_STATE_INPUT_FILE;
+            }
+            pthread_mutex_unlock(&(attk_st->mut));
+            attack_stopping(attk_st);
+            break;
+        } else if (buf_size == 0) {
+            /* No more pieces */
+            break;
+        } else if (skip) {
+            /* Already checked */
+            continue;
+        }
+
+        /* Number the block, waiting for its turn, then add it to the queue,
+           sleeping until the queue has free space or is stopped */
+        queue_retval = 0;
+        if (t_args->ordered) {
+            queue_retval = attack_order_wait(t_args, seq);
+            block->seq = seq++;
+        }
+        if (shard->stats != NULL) {
+            start = attack_now_ns();
+        }
+        if (queue_retval == 0 && t_args->pool_count > 1) {
+            queue_retval = work_queue_push_lane(&(t_args->q), lane, block,
+                                                block->size,
+                                                QUEUE_WAIT_FOREVER);
+            lane = (lane + 1) % t_args->pool_count;
+        } else if (queue_retval == 0) {
+            queue_retval = work_queue_push(&(t_args->q), block, block->size,
+                                           QUEUE_WAIT_FOREVER);
+        }
+        if (shard->stats != NULL && queue_retval == 0) {
+            histogram_record(&(shard->stats->stages[ATTACK_STAGE_QUEUE_PUSH]),
+                             attack_now_ns() - start);
+            histogram_record(&(shard->stats->queue_depth),
+                             work_queue_count(&(t_args->q)));
+        }
+        if (queue_retval != 0) {
+            /* Queue is inactive, time to stop */
+
+            /* Free the block */
+            free_block_retval = attack_release_block(t_args, shard, file,
+                                                     block);
+            if (free_block_retval != 0) {
                 /* Set an error */
                 pthread_mutex_lock(&(attk_st->mut));
-                assert(attk_st->error == 0);
-                attk_st->error = fout_retval;
-                attk_st->e_state = E_STATE_OUTPUT_FILE;
+                if (attk_st->error == 0) {
+                    attk_st->error = free_block_retval;
+                    attk_st->e_state = E_STATE_INPUT_FILE;
+                }
                 pthread_mutex_unlock(&(attk_st->mut));
-
-                /* Stop the queue */
-                pthread_mutex_lock(&(q->mut));
-                queue_stop(q);
-                pthread_mutex_unlock(&(q->mut));
             }
-            pthread_mutex_unlock(&(file_out->mut));
+
+            /* Stop the attack */
+            break;
+        }
+    }
+
+    /* Put back the file's own block size */
+    pthread_mutex_lock(&(file->mut));
+    file->records_per_block = records_per_block;
+    pthread_mutex_unlock(&(file->mut));
+}
+
+
+/** A producer thread.
+ *  Attack producer thread, opens one part of a split input file, adds its
+ *  blocks to the queue, and closes it.
+ *
+ *  @param[in] fargs The attack producer thread arguments.
+ *
+ *  @return          Returns NULL.
+ */
+void *attack_producer_t(void *fargs) {
+    struct attack_producer_args *arg_list; /* passed argument                */
+    attack_st *attk_st;             /* main attack_st                        */
+    file_st *file;                  /* input file part                       */
+    int retval;                     /* file return value                     */
+
+    #ifdef DEBUG
+    printf("attack_producer_t: START (%p)\n", pthread_self());
+    #endif
+
+    /* Set defaults */
+    arg_list = (struct attack_producer_args *)fargs;
+    attk_st = arg_list->t_args->attk_st;
+    file = arg_list->file;
+
+    /* Open the part */
+    pthread_mutex_lock(&(file->mut));
+    retval = file->open_file(file);
+    pthread_mutex_unlock(&(file->mut));
+    if (retval != 0) {
+        /* Set an error and stop the attack */
+        pthread_mutex_lock(&(attk_st->mut));
+        if (attk_st->error == 0) {
+            attk_st->error = retval;
+            attk_st->e_state = E_STATE_INPUT_FILE;
         }
-        free(fout_buf);
+        pthread_mutex_unlock(&(attk_st->mut));
+        stop_attack(attk_st);
+        return NULL;
     }
 
-    /* Set the answer, if we have it */
-    if (check_retval == 0) {
-        /* Update result status */
+    /* Fill the queue */
+    attack_produce(arg_list->t_args, arg_list->shards, file);
+    attack_producer_shards_free(arg_list->t_args, arg_list->shards);
+
+    /* Close the part */
+    pthread_mutex_lock(&(file->mut));
+    retval = file->close_file(file);
+    pthread_mutex_unlock(&(file->mut));
+    if (retval != 0) {
+        /* Set an error */
         pthread_mutex_lock(&(attk_st->mut));
-        if (attk_st->_s.result_size == 0) {
-            attk_st->_s.result = result;
-            attk_st->_s.result_size = file_in->record_size;
-        } else {
-            /* We already have an answer, free the result buffer */
-            free(result);
+        if (attk_st->error == 0) {
+            attk_st->error = retval;
+            attk_st->e_state = E_STATE_INPUT_FILE;
         }
         pthread_mutex_unlock(&(attk_st->mut));
-
-        /* Stop the queue */
-        pthread_mutex_lock(&(q->mut));
-        queue_stop(q);
-        pthread_mutex_unlock(&(q->mut));
-    } else {
-        /* No answer, free the result buffer */
-        free(result);
     }
 
     return NULL;
@@ -290,19 +2165,26 @@ void *attack_main_t(void *fargs) {
     attack_st *attk_st;                 /* main attack_st                     */
     file_st *file_in;                   /* input file structure               */
     file_st *file_out;                  /* output file structure              */
-    queue *q;                           /* data queue                         */
-    struct attack_t_args t_args;        /* client thread arguments            */
+    work_queue *q;                      /* data queue                         */
+    struct attack_t_args t_args;        /* shared client thread arguments     */
+    struct attack_client_args *c_args;  /* client thread arguments            */
+    struct attack_shard **shards;       /* main thread counters               */
     int i;                              /* generic counter                    */
-    pthread_t client_t[MAX_THREADS];    /* client threads                     */
-    char *buf;                          /* record buffer                      */
-    ssize_t buf_size;                   /* record buffer size                 */
-    char *temp_buf;                     /* temporary buffer                   */
+    int lanes;                          /* number of queue lanes              */
+    int node_count = 1;                 /* number of block pools              */
+    int start_retval;                   /* client start return value          */
+    struct attack_producer_args *p_args; /* producer thread arguments         */
+    int p_started;                      /* number of producers started        */
+    file_st **parts = NULL;             /* input file parts                   */
+    int part_count = 0;                 /* number of input file parts         */
+    struct attack_block *temp_block;    /* temporary block                    */
+    struct attack_out *temp_out;        /* temporary output buffer            */
     size_t temp_size;                   /* temporary buffer size              */
-    struct timespec ts;                 /* conditional timeout                */
     int in_file_retval;                 /* input open file return value       */
     int out_file_retval;                /* output open file return value      */
     int free_block_retval;              /* file free_block return value       */
-    int total_records;                  /* Temporary holder for total records */
+    uint64_t total_records;             /* Temporary holder for total records */
+    result_store *results;              /* collected results                  */
 
     #ifdef DEBUG
     printf("attack_main_t: START (%p)\n", pthread_self());
@@ -312,19 +2194,55 @@ void *attack_main_t(void *fargs) {
     attk_st = (attack_st *)fargs;
     file_in = attk_st->file_in;
     file_out = attk_st->file_out;
+    memset(&t_args, 0, sizeof(struct attack_t_args));
     t_args.attk_st = attk_st;
+    event_init(&(t_args.order_ev));
+    event_init(&(t_args.progress_ev));
     q = &(t_args.q);
     in_file_retval = out_file_retval = 0;
 
-    /* Create the queue */
-    queue_init(q);
+    /* Find the CPUs and NUMA nodes to place the client threads on */
+    t_args.placement = attk_st->placement;
+    if (t_args.placement == ATTACK_PLACE_NONE && attk_st->numa_lanes) {
+        t_args.placement = ATTACK_PLACE_SPREAD;
+    }
+    if (t_args.placement != ATTACK_PLACE_NONE &&
+        topology_init(&(t_args.topo), attk_st->cpus) != 0) {
+        t_args.placement = ATTACK_PLACE_NONE;
+    }
+    if (t_args.placement != ATTACK_PLACE_NONE && attk_st->numa_lanes) {
+        node_count = t_args.topo.node_count;
+    }
 
-    /* Start the threads */
-    assert(attk_st->threads <= MAX_THREADS);
-    for (i = 0; i < attk_st->threads; i++) {
-        pthread_create(&client_t[i], NULL, attack_client_t, (void *)&t_args);
+    /* Create the queue, with a lane per NUMA node, or a lane per client
+       thread if they steal */
+    if (t_args.placement != ATTACK_PLACE_NONE && attk_st->numa_lanes) {
+        lanes = node_count;
+    } else if (attk_st->queue_mode == ATTACK_QUEUE_STEAL) {
+        lanes = attk_st->threads;
+    } else {
+        lanes = 1;
+    }
+    if (work_queue_init(q, lanes, attk_st->queue_size) != 0) {
+        if (t_args.placement != ATTACK_PLACE_NONE) {
+            topology_destroy(&(t_args.topo));
+        }
+        /* Set an error and give up */
+        pthread_mutex_lock(&(attk_st->mut));
+        attk_st->error = E_ATTK_SYSTEM;
+        pthread_mutex_unlock(&(attk_st->mut));
+        __atomic_store_n(&(attk_st->_stop_ns), attack_now_ns(),
+                         __ATOMIC_RELAXED);
+        attk_st->callback(attk_st);
+        attk_st->state = ATTACK_STATE_STOPPED;
+        return NULL;
     }
 
+    /* Let stop_attack find the queue */
+    pthread_mutex_lock(&(attk_st->mut));
+    attk_st->_t_args = &t_args;
+    pthread_mutex_unlock(&(attk_st->mut));
+
     /* Open the input file */
     pthread_mutex_lock(&(file_in->mut));
     in_file_retval = file_in->open_file(file_in);
@@ -339,9 +2257,8 @@ void *attack_main_t(void *fargs) {
         pthread_mutex_unlock(&(attk_st->mut));
         stop_attack(attk_st);
     } else {
-        pthread_mutex_lock(&(attk_st->mut));
-        attk_st->_s.total_records += total_records;
-        pthread_mutex_unlock(&(attk_st->mut));
+        __atomic_add_fetch(&(attk_st->_s.total_records), total_records,
+                           __ATOMIC_RELEASE);
     }
 
     /* Open the output file */
@@ -360,89 +2277,300 @@ void *attack_main_t(void *fargs) {
         }
     }
 
-    /* Add blocks to the queue */
-    while (attk_st->state == ATTACK_STATE_ACTIVE) {
-        buf = NULL;
-        buf_size = 0;
+    /* Start the writer thread, without it the client threads write their own
+       output, unless it has to be in order */
+    if (file_out != NULL) {
+        /* A packed output buffer is filled a record sized slot at a time,
+           with room for the 0 after each record and the header in front,
+           then packed as it is written */
+        t_args.out_stride = file_out->record_size;
+        if (file_out->flags & FILE_PACKED) {
+            t_args.out_packed = 1;
+            t_args.out_stride += 1;
+            t_args.out_head = ATTK_PACKED_HEADER(file_in->records_per_block);
+        }
+        t_args.out_size = t_args.out_head +
+                          t_args.out_stride * file_in->records_per_block;
+        if (attk_st->ordered_output) {
+            t_args.ordered = 1;
+            t_args.order_window = attk_st->ordered_blocks > 0 ?
+                                  attk_st->ordered_blocks :
+                                  ATTACK_ORDERED_BLOCKS;
+            t_args.held = calloc(t_args.order_window,
+                                 sizeof(struct attack_out *));
+        }
+    }
+    if (in_file_retval == 0 && file_out != NULL && out_file_retval == 0) {
+        t_args.writer_shard = attack_shard_new(attk_st);
+    }
+    if (t_args.writer_shard != NULL &&
+        (!t_args.ordered || t_args.held != NULL)) {
+        if (queue_init(&(t_args.out_q), attk_st->queue_size) == 0) {
+            if (queue_init(&(t_args.out_free), attk_st->queue_size) == 0) {
+                t_args.writing = pthread_create(&(t_args.writer), NULL,
+                                                attack_writer_t,
+                                                (void *)&t_args) == 0;
+                if (!t_args.writing) {
+                    queue_stop(&(t_args.out_free));
+                    queue_destroy(&(t_args.out_free));
+                }
+            }
+            if (!t_args.writing) {
+                queue_stop(&(t_args.out_q));
+                queue_destroy(&(t_args.out_q));
+            }
+        }
+    }
+    if (in_file_retval == 0 && file_out != NULL && out_file_retval == 0 &&
+        t_args.ordered && !t_args.writing) {
+        /* Set an error and stop the attack */
+        pthread_mutex_lock(&(attk_st->mut));
+        if (attk_st->error == 0) {
+            attk_st->error = E_ATTK_SYSTEM;
+            attk_st->e_state = E_STATE_THREAD;
+        }
+        pthread_mutex_unlock(&(attk_st->mut));
+        stop_attack(attk_st);
+    }
 
-        /* Get the next block */
-        pthread_mutex_lock(&(file_in->mut));
-        buf_size = file_in->next_block(file_in, &buf, 0);
-        pthread_mutex_unlock(&(file_in->mut));
-        if (buf_size < 0) {
+    /* Create the result store, once the record size is known, and only let
+       next_attack_result see it once it is set up */
+    if (in_file_retval == 0 && attk_st->collect_results &&
+        attk_st->_results == NULL) {
+        results = malloc(sizeof(result_store));
+        if (results != NULL &&
+            result_store_init(results, file_in->record_size,
+                              attk_st->max_results,
+                              attk_st->results_path) == 0) {
+            __atomic_store_n(&(attk_st->_results), results, __ATOMIC_RELEASE);
+        } else {
             /* Set an error and stop the attack */
+            free(results);
             pthread_mutex_lock(&(attk_st->mut));
-            assert(attk_st->error == 0);
-            attk_st->error = buf_size;
-            attk_st->e_state = E_STATE_INPUT_FILE;
+            if (attk_st->error == 0) {
+                attk_st->error = E_ATTK_SYSTEM;
+                attk_st->e_state = E_STATE_RESULTS;
+            }
             pthread_mutex_unlock(&(attk_st->mut));
-            break;
-        } else if (buf_size == 0) {
-            /* No more pieces */
-            break;
+            stop_attack(attk_st);
         }
+    }
 
-        /* Add the block to the queue */
-        pthread_mutex_lock(&(q->mut));
-        while (q->full && q->state == QUEUE_STATE_ACTIVE) {
-            /* Wait for the queue to have free space, or for
-               QUEUE_EMPTY_WAIT_SEC seconds */
-            clock_gettime(CLOCK_REALTIME, &ts);
-            ts.tv_sec += QUEUE_FULL_WAIT_SEC;
-            pthread_cond_timedwait(&(q->not_full), &(q->mut), &ts);
-            continue; /* We still need to make sure the queue is not full */
+    /* Set up the checkpoint, a resumed attack's checkpoint must be for the
+       same input */
+    if (in_file_retval == 0 && attk_st->checkpoint_path != NULL) {
+        if (attk_st->_checkpoint == NULL) {
+            attk_st->_checkpoint = malloc(sizeof(checkpoint));
+            if (attk_st->_checkpoint != NULL &&
+                checkpoint_init(attk_st->_checkpoint) != 0) {
+                free(attk_st->_checkpoint);
+                attk_st->_checkpoint = NULL;
+            }
         }
-        if (q->state != QUEUE_STATE_ACTIVE) {
-            /* Queue is inactive, time to stop */
-            pthread_mutex_unlock(&(q->mut));
+        if (attk_st->_checkpoint == NULL ||
+            (attk_st->_checkpoint->total_records != 0 &&
+             attk_st->_checkpoint->total_records != total_records)) {
+            /* Set an error and stop the attack */
+            pthread_mutex_lock(&(attk_st->mut));
+            if (attk_st->error == 0) {
+                attk_st->error = attk_st->_checkpoint == NULL ?
+                                 E_ATTK_SYSTEM : E_ATTK_FILE_INVALID;
+                attk_st->e_state = E_STATE_CHECKPOINT;
+            }
+            pthread_mutex_unlock(&(attk_st->mut));
+            stop_attack(attk_st);
+        } else {
+            attk_st->_checkpoint->total_records = total_records;
+            t_args.checkpointing = 1;
+            t_args.resumed = attk_st->_checkpoint->count > 0;
+            t_args.checkpoint_due = attack_now_ns() +
+                (uint64_t)(attk_st->checkpoint_ms ? attk_st->checkpoint_ms :
+                           ATTACK_CHECKPOINT_MS) * 1000000;
+        }
+    }
 
-            /* Free the block */
-            free_block_retval = file_in->free_block(file_in, buf, buf_size);
-            if (free_block_retval != 0) {
-                /* Set an error */
-                assert(attk_st->error == 0);
-                attk_st->error = free_block_retval;
-                attk_st->e_state = E_STATE_INPUT_FILE;
+    /* Work out the block size bounds when tuning */
+    t_args.block_min = t_args.block_max = file_in->records_per_block;
+    if (attk_st->block_target_us > 0) {
+        t_args.block_min = attk_st->block_min_records > 0 ?
+                           attk_st->block_min_records :
+                           file_in->records_per_block / 16;
+        t_args.block_max = attk_st->block_max_records > 0 ?
+                           attk_st->block_max_records :
+                           file_in->records_per_block * 16;
+        if (t_args.block_min < 1) {
+            t_args.block_min = 1;
+        }
+        if (t_args.block_max < t_args.block_min) {
+            t_args.block_max = t_args.block_min;
+        }
+    }
+
+    /* Create the block pools, one per NUMA node when the queue has a lane
+       per node, now that the block size is known, the records follow each
+       block's descriptor unless the input file hands out its own blocks */
+    t_args.file_buffers = (file_in->flags &
+                           (FILE_OWN_BLOCKS | FILE_PACKED)) != 0;
+    t_args.block_size = sizeof(struct attack_block);
+    if (!t_args.file_buffers) {
+        t_args.block_size += file_in->record_size * t_args.block_max;
+    }
+    t_args.pooled = 0;
+    t_args.pool_count = node_count;
+    t_args.pools = malloc(sizeof(block_pool) * node_count);
+    if (t_args.pools != NULL && in_file_retval == 0) {
+        for (i = 0; i < node_count; i++) {
+            if (block_pool_init(
+                    &(t_args.pools[i]), t_args.block_size,
+                    CACHE_LINE_SIZE,
+                    (attk_st->queue_size ? attk_st->queue_size : QUEUE_SIZE) +
+                    (attk_st->threads + attk_st->producers + 1) *
+                    BLOCK_POOL_CACHE_SIZE,
+                    node_count > 1 ? t_args.topo.node_ids[i] : -1) != 0) {
+                break;
+            }
+        }
+        if (i == node_count) {
+            t_args.pooled = 1;
+        } else {
+            /* Fall back to plain allocation */
+            while (i-- > 0) {
+                block_pool_destroy(&(t_args.pools[i]));
             }
+        }
+    }
+    shards = attack_producer_shards(attk_st, &t_args);
+    if (shards == NULL) {
+        /* Set an error and stop the attack */
+        pthread_mutex_lock(&(attk_st->mut));
+        if (attk_st->error == 0) {
+            attk_st->error = E_ATTK_SYSTEM;
+            attk_st->e_state = E_STATE_THREAD;
+        }
+        pthread_mutex_unlock(&(attk_st->mut));
+        stop_attack(attk_st);
+    }
 
-            /* Stop the attack */
-            break;
+    /* Count the records a resumed attack has already checked */
+    if (t_args.resumed && shards != NULL) {
+        shards[0]->records_tested = checkpoint_done(attk_st->_checkpoint);
+    }
+
+    /* Start the threads, once the files are open, from here on
+       set_attack_threads can start more */
+    pthread_mutex_lock(&(attk_st->mut));
+    t_args.started = 1;
+    start_retval = attack_start_clients(&t_args);
+    pthread_mutex_unlock(&(attk_st->mut));
+    if (start_retval != 0) {
+        /* Set an error and stop the attack */
+        pthread_mutex_lock(&(attk_st->mut));
+        if (attk_st->error == 0) {
+            attk_st->error = start_retval;
+            attk_st->e_state = E_STATE_THREAD;
+        }
+        pthread_mutex_unlock(&(attk_st->mut));
+        stop_attack(attk_st);
+    }
+
+    /* Start the progress thread, if anyone wants progress, without it the
+       attack just goes on quietly */
+    if (attk_st->progress != NULL && start_retval == 0) {
+        t_args.progressing = pthread_create(&(t_args.progress), NULL,
+                                            attack_progress_t,
+                                            (void *)&t_args) == 0;
+    }
+
+    /* Split the input file between the producer threads, if it can be split
+       and the output does not have to be in order */
+    if (attk_st->state == ATTACK_STATE_ACTIVE && attk_st->producers > 1 &&
+        file_in->split != NULL && !t_args.ordered) {
+        parts = malloc(sizeof(file_st *) * attk_st->producers);
+        if (parts == NULL) {
+            part_count = E_ATTK_SYSTEM;
         } else {
-            /* Add a record block */
-            queue_push(q, buf, buf_size);
-            pthread_mutex_unlock(&(q->mut));
-            pthread_cond_signal(&(q->not_empty));
+            pthread_mutex_lock(&(file_in->mut));
+            part_count = file_in->split(file_in, attk_st->producers, parts);
+            pthread_mutex_unlock(&(file_in->mut));
+        }
+        if (part_count < 0) {
+            /* Set an error and stop the attack */
+            pthread_mutex_lock(&(attk_st->mut));
+            assert(attk_st->error == 0);
+            attk_st->error = part_count;
+            attk_st->e_state = E_STATE_INPUT_FILE;
+            pthread_mutex_unlock(&(attk_st->mut));
+            stop_attack(attk_st);
+            part_count = 0;
+        }
+    }
+
+    /* Add blocks to the queue */
+    if (part_count > 0) {
+        /* Start a producer thread for each part and wait for them to finish */
+        p_args = malloc(sizeof(struct attack_producer_args) * part_count);
+        for (i = 0; p_args != NULL && i < part_count; i++) {
+            p_args[i].t_args = &t_args;
+            p_args[i].shards = attack_producer_shards(attk_st, &t_args);
+            p_args[i].file = parts[i];
+            if (p_args[i].shards == NULL) {
+                break;
+            }
+            if (pthread_create(&(p_args[i].thread), NULL, attack_producer_t,
+                               (void *)&p_args[i]) != 0) {
+                attack_producer_shards_free(&t_args, p_args[i].shards);
+                break;
+            }
+        }
+        p_started = i;
+        if (p_started < part_count) {
+            /* Set an error and stop the attack, the producers already
+               started stop with it */
+            pthread_mutex_lock(&(attk_st->mut));
+            if (attk_st->error == 0) {
+                attk_st->error = E_ATTK_SYSTEM;
+                attk_st->e_state = E_STATE_THREAD;
+            }
+            pthread_mutex_unlock(&(attk_st->mut));
+            stop_attack(attk_st);
+        }
+        for (i = 0; i < p_started; i++) {
+            pthread_join(p_args[i].thread, NULL);
         }
+        free(p_args);
+
+        /* Free the parts */
+        pthread_mutex_lock(&(file_in->mut));
+        file_in->free_parts(file_in, part_count, parts);
+        pthread_mutex_unlock(&(file_in->mut));
+    } else if (shards != NULL) {
+        attack_produce(&t_args, shards, file_in);
     }
+    free(parts);
 
     /* Stop the attack */
     #ifdef DEBUG
     printf("attack_main_t: stopping attack\n");
     #endif
-    stop_attack(attk_st);
+    attack_stopping(attk_st);
 
     /* Stop the queue */
     #ifdef DEBUG
     printf("attack_main_t: stopping queue\n");
     #endif
-    pthread_mutex_lock(&(q->mut));
-    queue_stop(q);
-    pthread_mutex_unlock(&(q->mut));
+    work_queue_stop(q);
 
     /* Check and see if we have an answer */
     #ifdef DEBUG
     printf("attack_main_t: checking for answer\n");
     #endif
-    pthread_mutex_lock(&(attk_st->mut));
-    temp_size = attk_st->_s.result_size;
-    pthread_mutex_unlock(&(attk_st->mut));
-    if (temp_size > 0) {
+    temp_size = __atomic_load_n(&(attk_st->_s.result_size), __ATOMIC_ACQUIRE);
+    if (temp_size > 0 && !attk_st->collect_results) {
         /* We do have an answer, lets clear the queue */
-        pthread_mutex_lock(&(q->mut));
-        while (q->empty == 0) {
-            queue_pop(q, (void **)&temp_buf, &temp_size);
-            free_block_retval = file_in->free_block(file_in, temp_buf,
-                                                    temp_size);
+        while (work_queue_try_pop(q, 0, (void **)&temp_block, &temp_size)
+               == 0) {
+            free_block_retval = attack_release_block(&t_args, shards[0],
+                                                     file_in, temp_block);
             if (free_block_retval != 0) {
                 /* Set an error */
                 assert(attk_st->error == 0);
@@ -450,19 +2578,49 @@ void *attack_main_t(void *fargs) {
                 attk_st->e_state = E_STATE_INPUT_FILE;
             }
         }
-        pthread_mutex_unlock(&(q->mut));
     }
 
-    /* Wait for the threads to finish */
-    for (i = 0; i < attk_st->threads; i++) {
-        pthread_join(client_t[i], NULL);
+    /* Wait for the threads to finish, no more can start now */
+    pthread_mutex_lock(&(attk_st->mut));
+    t_args.closed = 1;
+    pthread_mutex_unlock(&(attk_st->mut));
+    while (t_args.clients != NULL) {
+        c_args = t_args.clients;
+        t_args.clients = c_args->next;
+        pthread_join(c_args->thread, NULL);
+        free(c_args);
+    }
+    free(t_args.slots);
+    if (t_args.placement != ATTACK_PLACE_NONE) {
+        topology_destroy(&(t_args.topo));
+    }
+
+    /* Wait for the writer thread to write everything handed to it */
+    if (t_args.writing) {
+        queue_stop(&(t_args.out_q));
+        pthread_join(t_args.writer, NULL);
+        queue_stop(&(t_args.out_free));
+        while (queue_try_pop(&(t_args.out_free), (void **)&temp_out,
+                             &temp_size) == 0) {
+            free(temp_out);
+        }
+        queue_destroy(&(t_args.out_q));
+        queue_destroy(&(t_args.out_free));
+    }
+    free(t_args.held);
+
+    /* Stop the progress thread, no more progress calls once the attack is
+       done */
+    if (t_args.progressing) {
+        __atomic_store_n(&(t_args.progress_stop), 1, __ATOMIC_RELEASE);
+        event_broadcast(&(t_args.progress_ev));
+        pthread_join(t_args.progress, NULL);
     }
 
     /* Make sure the queue is clear */
-    pthread_mutex_lock(&(q->mut));
-    while (q->empty == 0) {
-        queue_pop(q, (void **)&temp_buf, &temp_size);
-        free_block_retval = file_in->free_block(file_in, temp_buf, temp_size);
+    while (work_queue_try_pop(q, 0, (void **)&temp_block, &temp_size) == 0) {
+        free_block_retval = attack_release_block(&t_args, shards[0], file_in,
+                                                 temp_block);
         if (free_block_retval != 0) {
             /* Set an error */
             assert(attk_st->error == 0);
@@ -470,10 +2628,35 @@ void *attack_main_t(void *fargs) {
             attk_st->e_state = E_STATE_INPUT_FILE;
         }
     }
-    pthread_mutex_unlock(&(q->mut));
+
+    /* Save the final checkpoint, every checked block is in it by now */
+    if (t_args.checkpointing &&
+        checkpoint_save(attk_st->_checkpoint, attk_st->checkpoint_path) != 0) {
+        /* Set an error */
+        pthread_mutex_lock(&(attk_st->mut));
+        if (attk_st->error == 0) {
+            attk_st->error = E_ATTK_SYSTEM;
+            attk_st->e_state = E_STATE_CHECKPOINT;
+        }
+        pthread_mutex_unlock(&(attk_st->mut));
+    }
 
     /* Destroy the queue */
-    queue_destroy(q);
+    pthread_mutex_lock(&(attk_st->mut));
+    attk_st->_t_args = NULL;
+    pthread_mutex_unlock(&(attk_st->mut));
+    work_queue_destroy(q);
+
+    /* Destroy the block pools, every block is back by now */
+    if (shards != NULL) {
+        attack_producer_shards_free(&t_args, shards);
+    }
+    if (t_args.pooled) {
+        for (i = 0; i < t_args.pool_count; i++) {
+            block_pool_destroy(&(t_args.pools[i]));
+        }
+    }
+    free(t_args.pools);
 
     /* Close the input file */
     if (in_file_retval == 0) {
@@ -505,6 +2688,8 @@ void *attack_main_t(void *fargs) {
     #ifdef DEBUG
     printf("attack_main_t: calling callback\n");
     #endif
+    __atomic_store_n(&(attk_st->_stop_ns), attack_now_ns(),
+                     __ATOMIC_RELAXED);
     attk_st->callback(attk_st);
 
     attk_st->state = ATTACK_STATE_STOPPED;
@@ -521,18 +2706,19 @@ void *attack_main_t(void *fargs) {
  *  @param[in] file_out     A file structure to write records to, NULL if no
  *                          output.
  *  @param[in] threads      Number of client threads to use.
- *  @param[in] attack_check Function to call for each word.
+ *  @param[in] attack_check Function to call for each word, may be NULL if
+ *                          attack_check_batch is set before the attack starts.
  *  @param[in] callback     Callback when main thread completes.
  *  @param[in] attack_data  Data used by attack_check to check word.
  *
  *  @return                 Returns 0 on success, otherwise an error code.
  */
 int attack_st_init(attack_st *attk_st, file_st *file_in, file_st *file_out,
-                   uint16_t threads, int (*attack_check)(char *record,
-                                                         size_t record_size,
-                                                         char *ret_record,
-                                                         size_t return_size,
-                                                         void *attack_data),
+                   int threads, int (*attack_check)(char *record,
+                                                    size_t record_size,
+                                                    char *ret_record,
+                                                    size_t return_size,
+                                                    void *attack_data),
                    int (*callback)(attack_st *callback_args),
                    void *callback_data, void *attack_data) {
     #ifdef DEBUG
@@ -574,10 +2760,34 @@ int attack_st_init(attack_st *attk_st, file_st *file_in, file_st *file_out,
  *  @return             Returns 0 on success, otherwise an error code.
  */
 int attack_st_destroy(attack_st *attk_st) {
+    struct attack_shard *shard;
+
     #ifdef DEBUG
     printf("attack_st_destroy: START\n");
     #endif
 
+    /* Free the client counters */
+    while (attk_st->_shards != NULL) {
+        shard = attk_st->_shards;
+        attk_st->_shards = shard->next;
+        free(shard->stats);
+        free(shard);
+    }
+
+    /* Free the collected results */
+    if (attk_st->_results != NULL) {
+        result_store_destroy(attk_st->_results);
+        free(attk_st->_results);
+        attk_st->_results = NULL;
+    }
+
+    /* Free the checkpoint */
+    if (attk_st->_checkpoint != NULL) {
+        checkpoint_destroy(attk_st->_checkpoint);
+        free(attk_st->_checkpoint);
+        attk_st->_checkpoint = NULL;
+    }
+
     /* Free any stored result */
     if (attk_st->_s.result != NULL && attk_st->_s.result_size > 0) {
         free(attk_st->_s.result);
@@ -605,13 +2815,64 @@ int start_attack(attack_st *attk_st) {
     printf("start_attack: START\n");
     #endif
 
-    /* Start the main thread */
+    /* Start the clock, and the main thread */
+    attk_st->_start_ns = attack_now_ns();
+    attk_st->_stop_ns = 0;
     attk_st->state = ATTACK_STATE_ACTIVE;
     return pthread_create(&(attk_st->main), NULL, attack_main_t,
                           (void *)attk_st);
 }
 
 
+/** Resume an attack.
+ *  Loads the checkpoint at checkpoint_path and starts the attack, skipping the
+ *  records the checkpoint has as checked.  Starts from the beginning if there
+ *  is no checkpoint yet.  The input file must be set up the same way as the
+ *  attack that saved the checkpoint.
+ *
+ *  @param[in] attk_st  The attack object.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int resume_attack(attack_st *attk_st) {
+    int retval;
+
+    #ifdef DEBUG
+    printf("resume_attack: START\n");
+    #endif
+
+    /* Sanity check */
+    if (attk_st->checkpoint_path == NULL) {
+        return E_ATTK_FILE_INVALID;
+    }
+
+    /* Load the checkpoint */
+    if (attk_st->_checkpoint == NULL) {
+        attk_st->_checkpoint = malloc(sizeof(checkpoint));
+        if (attk_st->_checkpoint == NULL) {
+            return E_ATTK_SYSTEM;
+        }
+        if (checkpoint_init(attk_st->_checkpoint) != 0) {
+            free(attk_st->_checkpoint);
+            attk_st->_checkpoint = NULL;
+            return E_ATTK_SYSTEM;
+        }
+    }
+    retval = checkpoint_load(attk_st->_checkpoint, attk_st->checkpoint_path);
+    if (retval == CHECKPOINT_E_SYSTEM && errno == ENOENT) {
+        /* Nothing saved yet, start from the beginning */
+        retval = 0;
+    }
+    if (retval != 0) {
+        return retval == CHECKPOINT_E_SYSTEM ? E_ATTK_SYSTEM :
+                                               E_ATTK_FILE_INVALID;
+    }
+
+    /* Call start_attack */
+    return start_attack(attk_st);
+}
+
+
 /** Start an attack.
  *  This will start the main thread with the passed attack_st structure.  If
  *  callback is not NULL it will call callback when the main thread ends.
@@ -642,7 +2903,12 @@ int start_attack_c(attack_st *attk_st,
  *  Sets status to a copy of the current status. If result is not null also
  *  returns a copy of the result buffer.  status.result must be a buffer of
  *  status.result_size size, if there is no result to copy then
- *  status.result_size is set to 0.
+ *  status.result_size is set to 0.  If status.thread_rates is not null it
+ *  must be a buffer of status.thread_rates_size rates, one per client thread
+ *  number.  The rates are averaged over about ATTACK_RATE_MS, the ETA is
+ *  worked out from them and total_records, or from how much of the input file
+ *  has been read when the file does not know its total.  Does not take any
+ *  locks, so it can be polled often without slowing down the client threads.
  *
  *  @param[in]  attk_st The attack object.
  *  @param[out] status  The status object to fill.
@@ -650,51 +2916,235 @@ int start_attack_c(attack_st *attk_st,
  *  @return             Returns 0 on success, otherwise an error code.
  */
 int check_attack(attack_st *attk_st, attack_status *status) {
-    int ret_val;
+    char *result;
+    result_store *results;
+    uint64_t now = attack_now_ns();
+    uint64_t stop_ns;
+    uint64_t records_read;
+    uint64_t bytes_total;
+    uint64_t bytes_done;
+    uint64_t total;
     #ifdef DEBUG
-    printf("check_attack: START (%p) (%i) (%p)\n", attk_st, attk_st->mut,
-           &(attk_st->mut));
+    printf("check_attack: START (%p)\n", attk_st);
     #endif
 
-    if (attk_st->state != ATTACK_STATE_STOPPED) {
-        pthread_mutex_lock(&(attk_st->mut));
-        status->records_tested = attk_st->_s.records_tested;
-        status->total_records = attk_st->_s.total_records;
-        if (attk_st->_s.result != NULL) {
-            memset(status->result, 0, status->result_size);
-            if (attk_st->_s.result_size < status->result_size) {
-                status->result_size = attk_st->_s.result_size;
-            }
-            memcpy(status->result, attk_st->_s.result, status->result_size);
-        } else {
-            status->result_size = 0;
+    /* Add up the thread counters, nothing here takes a lock */
+    attack_sum_shards(attk_st, status, now, &records_read);
+    status->total_records = __atomic_load_n(&(attk_st->_s.total_records),
+                                            __ATOMIC_ACQUIRE);
+
+    /* Time the attack, and guess how long is left from the total, or from
+       how far through the input the producers are */
+    stop_ns = __atomic_load_n(&(attk_st->_stop_ns), __ATOMIC_RELAXED);
+    status->elapsed_ns = 0;
+    if (attk_st->_start_ns != 0) {
+        status->elapsed_ns = (stop_ns != 0 ? stop_ns : now) -
+                             attk_st->_start_ns;
+    }
+    total = status->total_records;
+    if (total == 0 && attk_st->file_in != NULL) {
+        bytes_total = __atomic_load_n(&(attk_st->file_in->bytes_total),
+                                      __ATOMIC_RELAXED);
+        bytes_done = __atomic_load_n(&(attk_st->file_in->bytes_done),
+                                     __ATOMIC_RELAXED);
+        if (bytes_total > 0 && bytes_done > 0) {
+            total = (uint64_t)((double)records_read * bytes_total /
+                               bytes_done);
         }
-        pthread_mutex_unlock(&(attk_st->mut));
+    }
+    status->eta_ns = ATTACK_ETA_UNKNOWN;
+    if (stop_ns != 0) {
+        status->eta_ns = 0;
+    } else if (total > 0 && status->rate > 0) {
+        status->eta_ns = total > status->records_tested ?
+                         (uint64_t)((total - status->records_tested) * 1e9 /
+                                    status->rate) : 0;
+    }
+    status->records_per_block = __atomic_load_n(
+        &(attk_st->_s.records_per_block), __ATOMIC_RELAXED);
+    status->threads = __atomic_load_n(&(attk_st->_s.threads),
+                                      __ATOMIC_RELAXED);
+    status->write_backlog = __atomic_load_n(&(attk_st->_s.write_backlog),
+                                            __ATOMIC_RELAXED);
+    status->results = 0;
+    results = __atomic_load_n(&(attk_st->_results), __ATOMIC_ACQUIRE);
+    if (results != NULL) {
+        status->results = result_store_count(results);
+    }
 
-        return 0;
+    /* Copy the result, once it is published it never changes */
+    result = __atomic_load_n(&(attk_st->_s.result), __ATOMIC_ACQUIRE);
+    if (result != NULL) {
+        memset(status->result, 0, status->result_size);
+        if (attk_st->_s.result_size < status->result_size) {
+            status->result_size = attk_st->_s.result_size;
+        }
+        memcpy(status->result, result, status->result_size);
     } else {
-        if (attk_st != NULL) {
-            status->records_tested = attk_st->_s.records_tested;
-            status->total_records = attk_st->_s.total_records;
-            if (attk_st->_s.result != NULL) {
-                memset(status->result, 0, status->result_size);
-                if (attk_st->_s.result_size < status->result_size) {
-                    status->result_size = attk_st->_s.result_size;
-                }
-                memcpy(status->result, attk_st->_s.result, status->result_size);
-            } else {
-                status->result_size = 0;
+        status->result_size = 0;
+    }
+
+    if (__atomic_load_n(&(attk_st->state), __ATOMIC_ACQUIRE)
+        == ATTACK_STATE_STOPPED) {
+        return E_ATTK_STOPPED;
+    }
+
+    return 0;
+}
+
+
+/** Get the stage statistics of an attack.
+ *  Sets stats to the histograms of every thread added together.  Stages are
+ *  only timed if stage_stats was set when the attack started, otherwise the
+ *  histograms are empty.  Like check_attack it does not take any locks, each
+ *  thread keeps its own histograms and they are only added up here.
+ *
+ *  @param[in]  attk_st The attack object.
+ *  @param[out] stats   The statistics object to fill.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int check_attack_stats(attack_st *attk_st, attack_stats *stats) {
+    struct attack_shard *shard;
+    int i;
+
+    memset(stats, 0, sizeof(attack_stats));
+    shard = __atomic_load_n(&(attk_st->_shards), __ATOMIC_ACQUIRE);
+    while (shard != NULL) {
+        if (shard->stats != NULL) {
+            for (i = 0; i < ATTACK_STAGE_COUNT; i++) {
+                histogram_merge(&(stats->stages[i]),
+                                &(shard->stats->stages[i]));
             }
+            histogram_merge(&(stats->queue_depth),
+                            &(shard->stats->queue_depth));
+            histogram_merge(&(stats->write_depth),
+                            &(shard->stats->write_depth));
         }
+        shard = shard->next;
+    }
 
+    if (__atomic_load_n(&(attk_st->state), __ATOMIC_ACQUIRE)
+        == ATTACK_STATE_STOPPED) {
         return E_ATTK_STOPPED;
     }
+
+    return 0;
+}
+
+
+/** Get the next collected result.
+ *  Copies the next result collected, in the order they were collected,
+ *  and moves the iterator past it.  Results can be read while the attack is
+ *  running, and until attack_st_destroy.  When there is no next result yet it
+ *  returns 0 and leaves the iterator alone, so it can be called again later.
+ *
+ *  @param[in]     attk_st  The attack object.
+ *  @param[in,out] iter     The iterator, set it to 0 to start from the first
+ *                          result.
+ *  @param[out]    buf      Buffer for the result, it is truncated to
+ *                          buf_size.
+ *  @param[in]     buf_size The size of buf.
+ *
+ *  @return                 Returns the size of the result copied, 0 if there
+ *                          is no next result yet, otherwise an error code.
+ */
+int next_attack_result(attack_st *attk_st, uint64_t *iter, char *buf,
+                       size_t buf_size) {
+    result_store *store = __atomic_load_n(&(attk_st->_results),
+                                          __ATOMIC_ACQUIRE);
+    char *result;
+    int retval;
+
+    if (store == NULL) {
+        return 0;
+    }
+
+    /* Copy straight into buf if it can hold a whole result */
+    result = buf;
+    if (buf_size < store->record_size) {
+        result = malloc(store->record_size);
+        if (result == NULL) {
+            return E_ATTK_SYSTEM;
+        }
+    }
+
+    /* Find the next result, skipping lost ones */
+    retval = 0;
+    while (*iter < result_store_slots(store)) {
+        retval = result_store_get(store, *iter, result);
+        if (retval == RESULT_STORE_E_LOST) {
+            *iter += 1;
+            retval = 0;
+            continue;
+        } else if (retval == RESULT_STORE_E_EMPTY) {
+            /* Still being filled */
+            retval = 0;
+        } else if (retval != 0) {
+            retval = E_ATTK_SYSTEM;
+        } else {
+            if (buf_size > store->record_size) {
+                buf_size = store->record_size;
+            }
+            if (result != buf) {
+                memcpy(buf, result, buf_size);
+            }
+            *iter += 1;
+            retval = buf_size;
+        }
+        break;
+    }
+    if (result != buf) {
+        free(result);
+    }
+
+    return retval;
+}
+
+
+/** Set the number of client threads.
+ *  Grows or shrinks the client threads of a running attack.  New client
+ *  threads start right away, surplus ones finish the block they are checking
+ *  and exit before taking another.  Before the attack starts this just sets
+ *  the thread count.
+ *
+ *  @param[in] attk_st  The attack object.
+ *  @param[in] threads  Number of client threads to use.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int set_attack_threads(attack_st *attk_st, int threads) {
+    int retval = 0;
+
+    #ifdef DEBUG
+    printf("set_attack_threads: START %i\n", threads);
+    #endif
+
+    if (threads < 1 || threads > MAX_THREADS) {
+        return E_ATTK_THREADS_INVALID;
+    }
+
+    pthread_mutex_lock(&(attk_st->mut));
+    if (attk_st->state == ATTACK_STATE_STOPPED ||
+        (attk_st->_t_args != NULL && attk_st->_t_args->closed)) {
+        retval = E_ATTK_STOPPED;
+    } else {
+        __atomic_store_n(&(attk_st->threads), threads, __ATOMIC_RELAXED);
+        if (attk_st->_t_args != NULL) {
+            retval = attack_start_clients(attk_st->_t_args);
+        }
+    }
+    pthread_mutex_unlock(&(attk_st->mut));
+
+    return retval;
 }
 
 
 /** Stop an attack.
  *  This will stop an ongoing attack as early as possible.  Callback will still
  *  be called if set.  Returns immediately, does not wait for threads to finish.
+ *  Threads waiting on the queue are woken up right away and blocks still in
+ *  the queue are dropped.
  *
  *  @param[in] attk_st  The attack object.
  */
@@ -708,6 +3158,14 @@ void stop_attack(attack_st *attk_st) {
     if (attk_st->state != ATTACK_STATE_STOPPED) {
         attk_st->state = ATTACK_STATE_STOPPING;
     }
+
+    /* Wake up the main and client threads, and have the client threads drop
+       what they are checking */
+    if (attk_st->_t_args != NULL) {
+        __atomic_store_n(&(attk_st->_t_args->stop), 1, __ATOMIC_RELAXED);
+        work_queue_abort(&(attk_st->_t_args->q));
+        event_broadcast(&(attk_st->_t_args->order_ev));
+    }
     pthread_mutex_unlock(&(attk_st->mut));
 }
 
@@ -21,23 +21,66 @@
 #define _GNU_SOURCE
 #endif
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <unistd.h>
 
+#include "histogram.h"
+
 /** @addtogroup libattkthread
  *  @{
  */
 
-#define QUEUE_EMPTY_WAIT_SEC          1 /**< Seconds to wait while queue is
-                                         *   empty before checking to see if
-                                         *   the queue is shut down.
+#define MAX_THREADS                4096 /**< Maximum number of client
+                                              *   threads.
+                                              */
+#define MAX_FILE_PATH_LEN           255 /**< Maximum file path length.  */
+#define ATTACK_TUNE_BLOCKS            4 /**< Blocks a producer adds between
+                                         *   block size adjustments.
                                          */
-#define QUEUE_FULL_WAIT_SEC           1 /**< Seconds to wait while queue is
-                                         *   full before checking to see if a
-                                         *   thread found an answer.
+#define ATTACK_CHECKPOINT_MS      60000 /**< Default milliseconds between
+                                         *   checkpoint saves.
+                                         */
+#define ATTACK_ORDERED_BLOCKS        64 /**< Default blocks that may be
+                                         *   checked ahead of the oldest one
+                                         *   not written yet, when writing
+                                         *   output in order.
+                                         */
+#define ATTACK_STOP_RECORDS          64 /**< Default records a client thread
+                                         *   checks between looks at whether
+                                         *   the attack is stopping.
+                                         */
+#define ATTACK_PROGRESS_MS         1000 /**< Default milliseconds between
+                                         *   progress calls.
+                                         */
+#define ATTACK_PROGRESS_POLL_MS      10 /**< Milliseconds between looks at
+                                         *   the records tested, when
+                                         *   progress is called every
+                                         *   progress_records records.
+                                         */
+#define ATTACK_RATE_MS             5000 /**< Milliseconds the records per
+                                         *   second averages are taken over.
+                                         */
+#define ATTACK_ETA_UNKNOWN   UINT64_MAX /**< ETA when the attack can not
+                                         *   estimate it.
+                                         */
+
+
+/*** File flags ***/
+#define FILE_OWN_BLOCKS             0x1 /**< The file's next_block always
+                                         *   returns its own blocks, so the
+                                         *   engine does not hand it pooled
+                                         *   blocks to fill.
+                                         */
+#define FILE_PACKED                 0x2 /**< The file's blocks are packed
+                                         *   blocks, see ATTK_PACKED_*, and
+                                         *   record_size is the most a record
+                                         *   takes, with its 0.  Packed input
+                                         *   files hand out their own blocks,
+                                         *   a packed output file gets each
+                                         *   output record cut to the length
+                                         *   of the record it is from.
                                          */
-#define MAX_THREADS                4096 /**< Maximum number of threads. */
-#define MAX_FILE_PATH_LEN           255 /**< Maximum file path length.  */
 
 
 /*** Errors ***/
@@ -63,14 +106,89 @@
 #define E_ATTK_FILE_INVALID          -6 /**< Error returned when an input or
                                          *   output file is invalid.
                                          */
+#define E_ATTK_THREADS_INVALID       -7 /**< Error returned when a thread
+                                         *   count is out of range.
+                                         */
+
+
+/*** Batch results ***/
+#define ATTK_BATCH_NO_MATCH           0 /**< Batch result, the record was
+                                         *   checked and was not a match.
+                                         */
+#define ATTK_BATCH_MATCH              1 /**< Batch result, the record was a
+                                         *   match.
+                                         */
+#define ATTK_BATCH_INVALID            2 /**< Batch result, the record was
+                                         *   invalid and was not checked.
+                                         */
+#define ATTK_BATCH_BITS               2 /**< Bits per record in a batch
+                                         *   results bitmap.
+                                         */
+#define ATTK_BATCH_PER_WORD          32 /**< Records per batch results bitmap
+                                         *   word.
+                                         */
+/** Number of uint64_t words a results bitmap needs for count records. */
+#define ATTK_BATCH_WORDS(count) \
+    (((count) + ATTK_BATCH_PER_WORD - 1) / ATTK_BATCH_PER_WORD)
+/** Set the result of record i in a results bitmap, which starts cleared. */
+#define ATTK_BATCH_SET(results, i, r) \
+    ((results)[(i) / ATTK_BATCH_PER_WORD] |= \
+     (uint64_t)(r) << (((i) % ATTK_BATCH_PER_WORD) * ATTK_BATCH_BITS))
+/** Get the result of record i from a results bitmap. */
+#define ATTK_BATCH_GET(results, i) \
+    ((int)(((results)[(i) / ATTK_BATCH_PER_WORD] >> \
+            (((i) % ATTK_BATCH_PER_WORD) * ATTK_BATCH_BITS)) & 3))
+
+
+/*** Packed blocks ***/
+/*  A packed block starts with its number of records, then an offset from the
+ *  start of the block for each record and one for the end of the block, all
+ *  uint32_t.  Record i runs from offset i to offset i + 1, its last byte is a
+ *  0 that is not part of the record, so records may hold any bytes and still
+ *  be used as strings.
+ */
+/** Number of records in a packed block. */
+#define ATTK_PACKED_COUNT(block)    (((uint32_t *)(block))[0])
+/** Offsets of the records in a packed block. */
+#define ATTK_PACKED_OFFSETS(block)  ((uint32_t *)(block) + 1)
+/** Record i of a packed block. */
+#define ATTK_PACKED_RECORD(block, i) \
+    ((char *)(block) + ATTK_PACKED_OFFSETS(block)[i])
+/** Length of record i of a packed block. */
+#define ATTK_PACKED_LEN(block, i) \
+    (ATTK_PACKED_OFFSETS(block)[(i) + 1] - ATTK_PACKED_OFFSETS(block)[i] - 1)
+/** Size of a packed block's header for count records. */
+#define ATTK_PACKED_HEADER(count)   (sizeof(uint32_t) * ((count) + 2))
+
+
+/** Packed records structure.
+ *  What attack_check_batch gets instead of records when the input file is
+ *  packed, part of a packed block.
+ */
+typedef struct ATTACK_RECORDS {
+    const char *block;          /**< The packed block.                     */
+    const uint32_t *offsets;    /**< Offsets of the records in the block,
+                                 *   one more than the number of records.
+                                 */
+} attack_records;
+/** Record i of an attack_records. */
+#define ATTK_RECORDS_RECORD(records, i) \
+    ((records)->block + (records)->offsets[i])
+/** Length of record i of an attack_records. */
+#define ATTK_RECORDS_LEN(records, i) \
+    ((records)->offsets[(i) + 1] - (records)->offsets[i] - 1)
 
 
 /** Attack error state enum.
  *  Indicates the where the error occured.
  */
 typedef enum {
-    E_STATE_INPUT_FILE = 1, /**< Error occured in input file.  */
-    E_STATE_OUTPUT_FILE,    /**< Error occured in output file. */
+    E_STATE_INPUT_FILE = 1, /**< Error occured in input file.         */
+    E_STATE_OUTPUT_FILE,    /**< Error occured in output file.        */
+    E_STATE_ATTACK_CHECK,   /**< Error occured in attack_check_batch. */
+    E_STATE_THREAD,         /**< Error occured starting a thread.     */
+    E_STATE_RESULTS,        /**< Error occured storing a result.      */
+    E_STATE_CHECKPOINT      /**< Error occured in the checkpoint.     */
 } error_state;
 
 
@@ -84,16 +202,103 @@ typedef enum {
 } attack_state;
 
 
+/** Attack queue mode enum.
+ *  Selects how blocks are handed out to the client threads.
+ */
+typedef enum {
+    ATTACK_QUEUE_SHARED = 0, /**< One queue shared by all client threads.   */
+    ATTACK_QUEUE_STEAL       /**< A queue lane per client thread, idle client
+                              *   threads steal from the other lanes.
+                              */
+} attack_queue_mode;
+
+
+/** Attack placement enum.
+ *  Selects how client threads are pinned to CPUs.
+ */
+typedef enum {
+    ATTACK_PLACE_NONE = 0,   /**< Let the scheduler place client threads.   */
+    ATTACK_PLACE_COMPACT,    /**< Pin client threads to CPUs, filling each
+                              *   NUMA node before the next.
+                              */
+    ATTACK_PLACE_SPREAD      /**< Pin client threads to CPUs, taking the
+                              *   NUMA nodes in turn.
+                              */
+} attack_placement;
+
+
+/** Attack stage enum.
+ *  The stages a block goes through, timed when stage_stats is set.
+ */
+typedef enum {
+    ATTACK_STAGE_READ = 0,   /**< A producer filling a block, next_block.   */
+    ATTACK_STAGE_QUEUE_PUSH, /**< A producer waiting for room in the queue. */
+    ATTACK_STAGE_QUEUE_POP,  /**< A client thread waiting for a block.      */
+    ATTACK_STAGE_CHECK,      /**< A client thread checking a block.         */
+    ATTACK_STAGE_FREE,       /**< A client thread giving a block back,
+                              *   free_block.
+                              */
+    ATTACK_STAGE_WRITE,      /**< Writing an output buffer, next_block.     */
+    ATTACK_STAGE_COUNT       /**< Number of stages.                         */
+} attack_stage;
+
+
 /** Attack status structure.
  *  Stores information about the current status of the attack.
  */
 typedef struct ATTACK_STATUS {
-    uint64_t records_tested;    /**< Number of records tested. */
-    uint64_t total_records;     /**< Total number of records.  */
-    char *result;               /**< The result.               */
-    size_t result_size;         /**< The length of the result. */
+    uint64_t records_tested;    /**< Number of records tested.             */
+    uint64_t total_records;     /**< Total number of records.              */
+    uint64_t pool_hits;         /**< Number of pooled blocks reused.       */
+    uint64_t pool_misses;       /**< Number of pooled blocks allocated.    */
+    int records_per_block;      /**< Records per block the producers are
+                                 *   currently adding.
+                                 */
+    int threads;                /**< Number of running client threads.     */
+    uint64_t write_backlog;     /**< Output buffers waiting for the writer
+                                 *   thread.
+                                 */
+    uint64_t write_stall_ns;    /**< Time client threads spent waiting for
+                                 *   the writer thread to catch up.
+                                 */
+    uint64_t results;           /**< Number of results collected.          */
+    uint64_t elapsed_ns;        /**< Time since the attack started, up to
+                                 *   when it stopped.
+                                 */
+    double rate;                /**< Records tested per second, averaged
+                                 *   over about ATTACK_RATE_MS.
+                                 */
+    uint64_t eta_ns;            /**< Estimated time to test the remaining
+                                 *   records, or ATTACK_ETA_UNKNOWN.
+                                 */
+    double *thread_rates;       /**< Records tested per second by each
+                                 *   client thread, NULL to skip them.
+                                 */
+    int thread_rates_size;      /**< The length of thread_rates, set to the
+                                 *   number of client threads filled in.
+                                 */
+    char *result;               /**< The result.                           */
+    size_t result_size;         /**< The length of the result.             */
 } attack_status;
 
+/** Attack stage statistics structure.
+ *  Histograms of the time spent in each stage and of the queue depths, see
+ *  check_attack_stats.
+ */
+typedef struct ATTACK_STATS {
+    histogram stages[ATTACK_STAGE_COUNT]; /**< Nanoseconds spent in each
+                                           *   stage, per block or output
+                                           *   buffer.
+                                           */
+    histogram queue_depth;      /**< Blocks in the queue, sampled as each
+                                 *   block is added.
+                                 */
+    histogram write_depth;      /**< Output buffers waiting for the writer
+                                 *   thread, sampled as each one is handed
+                                 *   over.
+                                 */
+} attack_stats;
+
 /** File attack structure.
  *  Structure that holds the file data for a threaded attack.
  */
@@ -102,17 +307,62 @@ struct FILE_ST {
     uint16_t record_size;                   /**< Record size.                 */
     int records_per_block;                  /**< Words to process per thread. */
     uint64_t total_records;                 /**< Total number of records.     */
+    uint64_t bytes_total;                   /**< Size of the input, set by
+                                             *   open_file when it does not
+                                             *   know total_records, 0 if
+                                             *   unknown.
+                                             */
+    uint64_t bytes_done;                    /**< Bytes of the input read so
+                                             *   far, kept up by next_block
+                                             *   when bytes_total is set.
+                                             */
+    uint64_t first_record;                  /**< Number of the first record
+                                             *   in the whole input, set by
+                                             *   split for each part.
+                                             */
+    int flags;                              /**< FILE_* flags.                */
 
     /* The file interface */
     int (*open_file)(struct FILE_ST *file); /**< Function to open the file.   */
     ssize_t (*next_block)(struct FILE_ST *file, char **buf,
                           size_t buf_size); /**< Function to read the next
                                              *   block.  Returns number of bytes
-                                             *   read, or 0 for EOF.
+                                             *   read, or 0 for EOF.  When
+                                             *   buf_size is not 0 it fills the
+                                             *   block passed in buf, which the
+                                             *   engine owns.
                                              */
     int (*free_block)(struct FILE_ST *file, char *buf,
-                       size_t buf_len);     /**< Function to free a block.    */
+                       size_t buf_len);     /**< Function to free a block.
+                                             *   Must be thread safe, client
+                                             *   threads call it without
+                                             *   holding the file mutex.
+                                             */
     int (*close_file)(struct FILE_ST *file);/**< Function to close the file.  */
+    int (*seek)(struct FILE_ST *file,
+                uint64_t record);           /**< Optional function to move an
+                                             *   open file so the next block
+                                             *   starts at a record, counting
+                                             *   from the file's first record.
+                                             *   Records past the end leave
+                                             *   nothing to read.
+                                             */
+    int (*split)(struct FILE_ST *file, int n,
+                 struct FILE_ST **parts);   /**< Optional function to split an
+                                             *   open file into at most n
+                                             *   unopened parts that together
+                                             *   hold the same records.  Blocks
+                                             *   from a part must be freeable
+                                             *   by the file's free_block.
+                                             *   Returns the number of parts,
+                                             *   0 if the file can not be
+                                             *   split, otherwise an error
+                                             *   code.
+                                             */
+    void (*free_parts)(struct FILE_ST *file, int n,
+                       struct FILE_ST **parts); /**< Function to free the parts
+                                                 *   made by split.
+                                                 */
 
     void *file_data;                        /**< Pointer to extra file data.  */
 
@@ -127,17 +377,136 @@ typedef struct FILE_ST file_st;
  *  Structure that holds the running data for a threaded attack.
  */
 struct ATTACK_ST {
-    int threads;            /**< Number of client threads.                    */
+    int threads;            /**< Number of client threads, change it with
+                             *   set_attack_threads once the attack starts.
+                             */
+    size_t queue_size;      /**< Number of blocks the queue can hold, 0 for
+                             *   QUEUE_SIZE.
+                             */
+    attack_queue_mode queue_mode; /**< How blocks are handed out to the
+                                   *   client threads.
+                                   */
+    int producers;          /**< Number of producer threads, only used if the
+                             *   input file can be split, 0 for one.
+                             */
+    uint32_t block_target_us; /**< Time for a client thread to check a block
+                               *   that block sizes are tuned towards, in
+                               *   microseconds, 0 to keep the input file's
+                               *   records_per_block.
+                               */
+    int block_min_records;  /**< Fewest records per block when tuning, 0 for
+                             *   the input file's records_per_block / 16.
+                             */
+    int block_max_records;  /**< Most records per block when tuning, 0 for
+                             *   the input file's records_per_block * 16.
+                             */
+    attack_placement placement; /**< How client threads are pinned to CPUs. */
+    cpu_set_t *cpus;        /**< CPUs to pin client threads to, NULL for the
+                             *   process's CPU affinity.
+                             */
+    int numa_lanes;         /**< Non-zero for a queue lane and block pool per
+                             *   NUMA node, each client thread is fed from its
+                             *   own node, implies ATTACK_PLACE_SPREAD if
+                             *   placement is not set.
+                             */
+    int collect_results;    /**< Non-zero to keep going after a match and
+                             *   collect every match, see next_attack_result.
+                             */
+    uint64_t max_results;   /**< Stop after collecting this many results, 0
+                             *   to never stop early.
+                             */
+    const char *results_path; /**< File to spill collected results to, NULL
+                               *   to keep them in memory.
+                               */
+    const char *checkpoint_path; /**< File to save the attack's progress to,
+                                  *   NULL for no checkpoints, see
+                                  *   resume_attack.
+                                  */
+    uint32_t checkpoint_ms; /**< Milliseconds between checkpoint saves, 0 for
+                             *   ATTACK_CHECKPOINT_MS.
+                             */
+    int ordered_output;     /**< Non-zero to write the output in the same
+                             *   order as the input, the input is then read
+                             *   by a single producer.
+                             */
+    int ordered_blocks;     /**< Most blocks that may be checked ahead of the
+                             *   oldest one not written yet, which caps the
+                             *   output held back at that many blocks' worth,
+                             *   0 for ATTACK_ORDERED_BLOCKS.
+                             */
+    int stage_stats;        /**< Non-zero to time each stage of every block,
+                             *   see check_attack_stats.
+                             */
+    int stop_records;       /**< Records a client thread checks between looks
+                             *   at whether the attack is stopping, 0 for
+                             *   ATTACK_STOP_RECORDS.  When set it is also
+                             *   the most records passed to
+                             *   attack_check_batch at once.  Set it to 1 for
+                             *   slow checks, so stop_attack does not wait on
+                             *   more than one.
+                             */
+    uint32_t progress_ms;   /**< Milliseconds between progress calls, 0 for
+                             *   ATTACK_PROGRESS_MS.
+                             */
+    uint64_t progress_records; /**< Records tested between progress calls, as
+                                *   well as every progress_ms, 0 to only go
+                                *   by time.
+                                */
     pthread_t main;         /**< Main thread.                                 */
 
     int (*attack_check)(char *record, size_t record_size,
                         char *ret_record, size_t return_size,
                         void *attack_data);   /**< The attack function to call
-                                               *   for each record.
+                                               *   for each record.  For a
+                                               *   packed input record_size
+                                               *   is the record's length,
+                                               *   the record is padded with
+                                               *   0s to the file's
+                                               *   record_size.
                                                */
+    int (*attack_check_batch)(char *records, size_t count, size_t stride,
+                              char *out_buf, size_t out_stride,
+                              uint64_t *results,
+                              void *attack_data); /**< Optional attack
+                                                   *   function to call for a
+                                                   *   batch of records, used
+                                                   *   instead of attack_check
+                                                   *   when set.  Sets each
+                                                   *   record's ATTK_BATCH_*
+                                                   *   result in the cleared
+                                                   *   results bitmap, writes
+                                                   *   output record i at
+                                                   *   out_buf + i * out_stride
+                                                   *   and returns 0, or an
+                                                   *   error code to stop the
+                                                   *   attack.  It is passed
+                                                   *   a whole block, or as
+                                                   *   much of it as the
+                                                   *   output buffer has room
+                                                   *   for, unless
+                                                   *   stop_records is set,
+                                                   *   then at most
+                                                   *   stop_records records.
+                                                   *   The attack is only seen
+                                                   *   to stop between calls.
+                                                   *   When the input
+                                                   *   file is packed stride
+                                                   *   is 0 and records points
+                                                   *   to an attack_records.
+                                                   */
     int (*callback)(struct ATTACK_ST *fargs); /**< Callback function, called
                                                *   upon completion.
                                                */
+    int (*progress)(struct ATTACK_ST *attk_st,
+                    attack_status *status);   /**< Optional function called
+                                               *   with the attack's status
+                                               *   every progress_ms, from
+                                               *   its own low priority
+                                               *   thread, until the attack
+                                               *   stops.  The status and
+                                               *   its buffers are only good
+                                               *   during the call.
+                                               */
 
     file_st *file_in;       /**< Pointer to input file structure.             */
     file_st *file_out;      /**< Pointer to output file structure.            */
@@ -146,6 +515,18 @@ struct ATTACK_ST {
 
     /* Private */
     attack_status _s;       /**< Private status data.                         */
+    struct attack_t_args *_t_args; /**< Private client thread data, set while
+                                    *   the main thread is running.
+                                    */
+    struct attack_shard *_shards;  /**< Private client thread counters.      */
+    struct RESULT_STORE *_results; /**< Private collected results.           */
+    struct CHECKPOINT *_checkpoint; /**< Private checkpoint, the records
+                                     *   checked so far.
+                                     */
+    uint64_t _start_ns;     /**< Private time the attack started.             */
+    uint64_t _stop_ns;      /**< Private time the attack stopped, 0 while it
+                             *   runs.
+                             */
 
     int error;              /**< Error value, if any.                         */
     error_state e_state;    /**< Error state, where the error occured.        */
@@ -168,10 +549,15 @@ int attack_st_init(attack_st *attk_st, file_st *file_in, file_st *file_out,
                    void *callback_data, void *attack_data);
 int attack_st_destroy(attack_st *attack_st);
 int start_attack(attack_st *attk_st);
+int resume_attack(attack_st *attk_st);
 int start_attack_c(attack_st *attk_st,
                    int (*callback)(attack_st *callback_args),
                    void *callback_data);
 int check_attack(attack_st *attk_st, attack_status *status);
+int check_attack_stats(attack_st *attk_st, attack_stats *stats);
+int set_attack_threads(attack_st *attk_st, int threads);
+int next_attack_result(attack_st *attk_st, uint64_t *iter, char *buf,
+                       size_t buf_size);
 void stop_attack(attack_st *attk_st);
 
 /** @} */
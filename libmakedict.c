@@ -14,6 +14,8 @@
  * GNU General Public License for more details.
  */
 
+#define _LARGEFILE64_SOURCE
+#include <arpa/inet.h>
 #include <assert.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -26,10 +28,12 @@
 #include <unistd.h>
 
 #include "libattkthread.h"
+#include "read_file.h"
 #include "read_word_list.h"
 #include "write_file.h"
 
 #define WORDS_PER_THREAD    4096
+#define BLOCK_TARGET_USEC   2000
 
 int do_make_dict(char *word, size_t word_size, char *ret_record,
                  size_t return_size, void *data) {
@@ -48,14 +52,33 @@ int do_make_dict(char *word, size_t word_size, char *ret_record,
 int make_dict_init(attack_st *attk_st, char *word_file_path,
                    char *dict_file_path, int threads,
                    int (*callback)(attack_st *callback_args),
-                   uint32_t file_order, size_t rec_size) {
+                   uint32_t file_order, size_t rec_size, int packed) {
     file_st *file_in;
     file_st *file_out;
+    read_file_header_st header;
+    int fp;
 
     file_in = malloc(sizeof(file_st));
     file_out = malloc(sizeof(file_st));
 
+    /* Words added to an existing dictionary go in its format, write_file
+       checks the rest of the header when it opens it */
+    fp = open(dict_file_path, O_RDONLY|O_LARGEFILE);
+    if (fp >= 0) {
+        if (read(fp, &header, sizeof(read_file_header_st)) ==
+            sizeof(read_file_header_st)) {
+            packed = ntohs(header.revision) == READ_FILE_REVISION_PACKED;
+        }
+        close(fp);
+    }
+
+    /* Pack the words if asked to, each then only takes its own length in
+       the dictionary, but the dictionary can not be counted, sought or
+       split */
     read_word_list_init(file_in, word_file_path, WORDS_PER_THREAD, rec_size);
+    if (packed) {
+        file_in->flags |= FILE_PACKED;
+    }
 
     /* Calculate record size */
     if (rec_size == 0) {
@@ -65,9 +88,18 @@ int make_dict_init(attack_st *attk_st, char *word_file_path,
 
     write_file_init(file_out, dict_file_path, "", file_order,
                     file_in->record_size);
+    if (packed) {
+        file_out->flags |= FILE_PACKED;
+    }
     attack_st_init(attk_st, file_in, file_out, threads, do_make_dict, callback,
                    NULL, NULL);
 
+    /* Tune the block size, starting from WORDS_PER_THREAD */
+    attk_st->block_target_us = BLOCK_TARGET_USEC;
+
+    /* Keep the dictionary in word list order */
+    attk_st->ordered_output = 1;
+
     return 0;
 }
 
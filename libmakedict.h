@@ -24,7 +24,7 @@
 int make_dict_init(attack_st *attk_st, char *word_file_path,
                    char *dict_file_path, int threads,
                    int (*callback)(attack_st *callback_args),
-                   uint32_t file_order, size_t rec_size);
+                   uint32_t file_order, size_t rec_size, int packed);
 int make_dict_destroy(attack_st *attack_st);
 
 #endif      /* LIBMAKEDICT_H */
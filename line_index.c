@@ -0,0 +1,447 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "line_index.h"
+
+/** @defgroup line_index line_index
+ *
+ *  Sampled line indexes of word lists.
+ *
+ *  A line index keeps where every stride'th word of a word list starts, so
+ *  the number of words is known without reading the list, and any word is
+ *  found by seeking to the sample before it and passing over at most
+ *  stride - 1 lines.  An index is built by threads each scanning their part
+ *  of the mapped list, and saved next to the list, with the list's size and
+ *  modify time so an index for an older list is not used.
+ */
+
+/** Private line index build part.
+ *  One thread's share of the word list, starting at a line.
+ */
+struct line_index_part {
+    const char *map;            /**< The mapped word list.                    */
+    uint64_t size;              /**< Size of the word list.                   */
+    uint64_t start;             /**< First line in the part.                  */
+    uint64_t end;               /**< Start of the next part.                  */
+    uint64_t words;             /**< Words in the part.                       */
+    uint32_t max_len;           /**< Longest word in the part.                */
+    uint64_t first_word;        /**< Number of the part's first word.         */
+    line_index *idx;            /**< Index to fill in, NULL to count.         */
+    pthread_t thread;           /**< The thread scanning the part.            */
+};
+
+
+/** Private method that scans a part of the word list.
+ *  Counts the words starting in the part, and finds the longest, or with
+ *  the counts known, fills in the samples that fall in the part.
+ *
+ *  @param[in] args The part.
+ *
+ *  @return         Returns NULL.
+ */
+static void *line_index_scan_t(void *args) {
+    struct line_index_part *part = args;
+    const char *nl;
+    uint64_t pos = part->start;
+    uint64_t line_end;
+    uint64_t word = part->first_word;
+    uint64_t len;
+    uint32_t stride = part->idx != NULL ? part->idx->stride : 0;
+
+    part->words = 0;
+    while (pos < part->end) {
+        /* Find the end of the line, it may run past the part */
+        nl = memchr(part->map + pos, '\n', part->size - pos);
+        line_end = nl != NULL ? (uint64_t)(nl - part->map) : part->size;
+        len = line_end - pos;
+        if (len > 0 && part->map[line_end - 1] == '\r') {
+            len--;
+        }
+
+        if (len > 0) {
+            if (stride > 0 && word % stride == 0) {
+                part->idx->offsets[word / stride] = pos;
+            }
+            if (len > part->max_len) {
+                part->max_len = len > UINT32_MAX ? UINT32_MAX : len;
+            }
+            word++;
+            part->words++;
+        }
+        pos = line_end + 1;
+    }
+
+    return NULL;
+}
+
+
+/** Private method that runs a scan of every part.
+ *
+ *  @param[in] parts    The parts.
+ *  @param[in] n        The number of parts.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+static int line_index_scan(struct line_index_part *parts, int n) {
+    int retval = 0;
+    int started;
+
+    for (started = 0; started < n; started++) {
+        if (pthread_create(&(parts[started].thread), NULL, line_index_scan_t,
+                           &(parts[started])) != 0) {
+            retval = LINE_INDEX_E_SYSTEM;
+            break;
+        }
+    }
+    while (started > 0) {
+        pthread_join(parts[--started].thread, NULL);
+    }
+
+    return retval;
+}
+
+
+/** Build a line index.
+ *  Maps the word list and counts its words with threads, each scanning its
+ *  own part, then fills in the samples the same way.
+ *
+ *  @param[in] idx      The line index.
+ *  @param[in] path     The word list.
+ *  @param[in] stride   Words per sample, 0 for LINE_INDEX_STRIDE.
+ *  @param[in] threads  Threads to scan with, 0 for one per CPU.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int line_index_build(line_index *idx, const char *path, uint32_t stride,
+                     int threads) {
+    struct line_index_part *parts;
+    struct stat file_stat;
+    const char *map = NULL;
+    const char *nl;
+    uint64_t start;
+    uint64_t words = 0;
+    int retval;
+    int fd;
+    int i;
+
+    memset(idx, 0, sizeof(line_index));
+    idx->stride = stride > 0 ? stride : LINE_INDEX_STRIDE;
+
+    /* Map the word list */
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return LINE_INDEX_E_SYSTEM;
+    }
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return LINE_INDEX_E_SYSTEM;
+    }
+    idx->file_size = file_stat.st_size;
+    idx->file_mtime = (uint64_t)file_stat.st_mtim.tv_sec * 1000000000 +
+                      file_stat.st_mtim.tv_nsec;
+    if (idx->file_size > 0) {
+        map = mmap(NULL, idx->file_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return LINE_INDEX_E_SYSTEM;
+    }
+
+    /* Split it into parts at line starts */
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > idx->file_size / LINE_INDEX_MIN_PART) {
+        threads = idx->file_size / LINE_INDEX_MIN_PART;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    parts = calloc(threads, sizeof(struct line_index_part));
+    if (parts == NULL) {
+        if (map != NULL) {
+            munmap((void *)map, idx->file_size);
+        }
+        return LINE_INDEX_E_SYSTEM;
+    }
+    for (i = 0; i < threads; i++) {
+        start = idx->file_size * i / threads;
+        if (start > 0) {
+            nl = memchr(map + start - 1, '\n', idx->file_size - start + 1);
+            start = nl != NULL ? (uint64_t)(nl - map) + 1 : idx->file_size;
+        }
+        parts[i].map = map;
+        parts[i].size = idx->file_size;
+        parts[i].start = start;
+        if (i > 0) {
+            parts[i - 1].end = start;
+        }
+    }
+    parts[threads - 1].end = idx->file_size;
+
+    /* Count the words */
+    retval = line_index_scan(parts, threads);
+    if (retval == 0) {
+        for (i = 0; i < threads; i++) {
+            parts[i].first_word = words;
+            words += parts[i].words;
+            if (parts[i].max_len > idx->max_len) {
+                idx->max_len = parts[i].max_len;
+            }
+        }
+        idx->words = words;
+        idx->count = (words + idx->stride - 1) / idx->stride;
+        idx->offsets = malloc(sizeof(uint64_t) * idx->count + 1);
+        if (idx->offsets == NULL) {
+            retval = LINE_INDEX_E_SYSTEM;
+        }
+    }
+
+    /* Fill in the samples */
+    if (retval == 0) {
+        for (i = 0; i < threads; i++) {
+            parts[i].idx = idx;
+        }
+        retval = line_index_scan(parts, threads);
+    }
+
+    if (map != NULL) {
+        munmap((void *)map, idx->file_size);
+    }
+    free(parts);
+    if (retval != 0) {
+        line_index_destroy(idx);
+    }
+
+    return retval;
+}
+
+
+/** Destroys a line index.
+ *  Frees its samples.
+ *
+ *  @param[in] idx  The line index.
+ */
+void line_index_destroy(line_index *idx) {
+    free(idx->offsets);
+    idx->offsets = NULL;
+    idx->count = 0;
+}
+
+
+/** Private method that names a word list's index.
+ *
+ *  @param[in] path The word list.
+ *
+ *  @return         Returns the index's path, to be freed, NULL if out of
+ *                  memory.
+ */
+static char *line_index_path(const char *path) {
+    char *index_path;
+
+    index_path = malloc(strlen(path) + strlen(LINE_INDEX_SUFFIX) + 1);
+    if (index_path != NULL) {
+        sprintf(index_path, "%s%s", path, LINE_INDEX_SUFFIX);
+    }
+
+    return index_path;
+}
+
+
+/** Save a line index.
+ *  Writes the index next to the word list, to a new file that is synced,
+ *  then renamed over any old index.
+ *
+ *  @param[in] idx  The line index.
+ *  @param[in] path The word list.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+int line_index_save(line_index *idx, const char *path) {
+    line_index_header_st header;
+    uint64_t *offsets;
+    size_t offsets_size = sizeof(uint64_t) * idx->count;
+    char *index_path;
+    char *tmp_path;
+    int fd;
+    int retval = LINE_INDEX_E_SYSTEM;
+    uint64_t i;
+
+    /* Put it in big endian order */
+    offsets = malloc(offsets_size + 1);
+    if (offsets == NULL) {
+        return LINE_INDEX_E_SYSTEM;
+    }
+    for (i = 0; i < idx->count; i++) {
+        offsets[i] = htobe64(idx->offsets[i]);
+    }
+    header.magic = htobe32(LINE_INDEX_MAGIC);
+    header.version = htobe32(LINE_INDEX_VERSION);
+    header.file_size = htobe64(idx->file_size);
+    header.file_mtime = htobe64(idx->file_mtime);
+    header.words = htobe64(idx->words);
+    header.stride = htobe32(idx->stride);
+    header.max_len = htobe32(idx->max_len);
+    header.count = htobe64(idx->count);
+
+    /* Write it out */
+    index_path = line_index_path(path);
+    tmp_path = index_path != NULL ? malloc(strlen(index_path) + 5) : NULL;
+    if (tmp_path != NULL) {
+        sprintf(tmp_path, "%s.tmp", index_path);
+        fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            if (write(fd, &header, sizeof(header)) == sizeof(header) &&
+                write(fd, offsets, offsets_size) == (ssize_t)offsets_size &&
+                fsync(fd) == 0) {
+                retval = 0;
+            }
+            if (close(fd) != 0) {
+                retval = LINE_INDEX_E_SYSTEM;
+            }
+            if (retval == 0 && rename(tmp_path, index_path) != 0) {
+                retval = LINE_INDEX_E_SYSTEM;
+            }
+            if (retval != 0) {
+                unlink(tmp_path);
+            }
+        }
+    }
+    free(tmp_path);
+    free(index_path);
+    free(offsets);
+
+    return retval;
+}
+
+
+/** Load a line index.
+ *  Reads the index saved next to the word list, checking it is for the list
+ *  as it is now.
+ *
+ *  @param[in] idx  The line index.
+ *  @param[in] path The word list.
+ *
+ *  @return         Returns 0 on success, LINE_INDEX_E_INVALID if there is
+ *                  no index, or it is stale or corrupt, otherwise an error
+ *                  code.
+ */
+int line_index_load(line_index *idx, const char *path) {
+    line_index_header_st header;
+    struct stat file_stat;
+    char *index_path;
+    size_t offsets_size;
+    int fd;
+    int retval = 0;
+    uint64_t i;
+
+    memset(idx, 0, sizeof(line_index));
+
+    /* Stat the word list to check the index against */
+    if (stat(path, &file_stat) != 0) {
+        return LINE_INDEX_E_SYSTEM;
+    }
+    index_path = line_index_path(path);
+    if (index_path == NULL) {
+        return LINE_INDEX_E_SYSTEM;
+    }
+    fd = open(index_path, O_RDONLY);
+    free(index_path);
+    if (fd < 0) {
+        return errno == ENOENT ? LINE_INDEX_E_INVALID : LINE_INDEX_E_SYSTEM;
+    }
+
+    /* Read the header */
+    if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+        be32toh(header.magic) != LINE_INDEX_MAGIC ||
+        be32toh(header.version) != LINE_INDEX_VERSION) {
+        close(fd);
+        return LINE_INDEX_E_INVALID;
+    }
+    idx->file_size = be64toh(header.file_size);
+    idx->file_mtime = be64toh(header.file_mtime);
+    idx->words = be64toh(header.words);
+    idx->stride = be32toh(header.stride);
+    idx->max_len = be32toh(header.max_len);
+    idx->count = be64toh(header.count);
+    if (idx->file_size != (uint64_t)file_stat.st_size ||
+        idx->file_mtime != (uint64_t)file_stat.st_mtim.tv_sec * 1000000000 +
+                           file_stat.st_mtim.tv_nsec ||
+        idx->stride == 0 ||
+        idx->count != (idx->words + idx->stride - 1) / idx->stride ||
+        idx->count > idx->file_size) {
+        close(fd);
+        idx->count = 0;
+        return LINE_INDEX_E_INVALID;
+    }
+
+    /* Read the samples, they must be in order and in the word list */
+    offsets_size = sizeof(uint64_t) * idx->count;
+    idx->offsets = malloc(offsets_size + 1);
+    if (idx->offsets == NULL) {
+        retval = LINE_INDEX_E_SYSTEM;
+    } else if (read(fd, idx->offsets, offsets_size) != (ssize_t)offsets_size) {
+        retval = LINE_INDEX_E_INVALID;
+    }
+    for (i = 0; retval == 0 && i < idx->count; i++) {
+        idx->offsets[i] = be64toh(idx->offsets[i]);
+        if (idx->offsets[i] >= idx->file_size ||
+            (i > 0 && idx->offsets[i] <= idx->offsets[i - 1])) {
+            retval = LINE_INDEX_E_INVALID;
+        }
+    }
+    close(fd);
+    if (retval != 0) {
+        line_index_destroy(idx);
+    }
+
+    return retval;
+}
+
+
+/** Find a word.
+ *  Finds the sample at or before a word.
+ *
+ *  @param[in]  idx     The line index.
+ *  @param[in]  word    The word, counting from 0.
+ *  @param[out] offset  The file offset of the sampled word, the end of the
+ *                      file if word is past the last word.
+ *
+ *  @return             Returns the number of the sampled word, the lines
+ *                      from offset up to word hold word minus it words.
+ */
+uint64_t line_index_find(const line_index *idx, uint64_t word,
+                         uint64_t *offset) {
+    if (word >= idx->words) {
+        *offset = idx->file_size;
+        return idx->words;
+    }
+
+    *offset = idx->offsets[word / idx->stride];
+    return word - word % idx->stride;
+}
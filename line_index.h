@@ -0,0 +1,81 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stdint.h>
+
+/** @addtogroup line_index
+ *  @{
+ */
+
+#define LINE_INDEX_MAGIC      0x4c494458 /**< Index file magic, "LIDX".       */
+#define LINE_INDEX_VERSION    1          /**< Index file version.             */
+#define LINE_INDEX_STRIDE     4096       /**< Default words per sample.       */
+#define LINE_INDEX_SUFFIX     ".idx"     /**< Added to the word list's path
+                                          *   to name its index.
+                                          */
+#define LINE_INDEX_MIN_PART   (1 << 20)  /**< Fewest bytes a thread scans
+                                          *   building an index.
+                                          */
+
+/*** Errors ***/
+#define LINE_INDEX_E_SYSTEM   -1 /**< A system error occurred, check errno.   */
+#define LINE_INDEX_E_INVALID  -2 /**< The index is not valid, or is not for
+                                  *   the word list as it is now.
+                                  */
+
+/** Index file header.
+ *  Followed by count sample offsets, all big endian.
+ */
+typedef struct LINE_INDEX_HEADER_ST {
+    uint32_t magic;             /**< LINE_INDEX_MAGIC.                        */
+    uint32_t version;           /**< LINE_INDEX_VERSION.                      */
+    uint64_t file_size;         /**< Size of the word list.                   */
+    uint64_t file_mtime;        /**< Word list's modify time, nanoseconds.    */
+    uint64_t words;             /**< Words in the word list.                  */
+    uint32_t stride;            /**< Words per sample.                        */
+    uint32_t max_len;           /**< Longest word.                            */
+    uint64_t count;             /**< Number of samples.                       */
+} __attribute__ ((packed)) line_index_header_st;
+
+/** A line index structure.
+ *  Where every stride'th word of a word list starts.  A word is a line that
+ *  is not empty once its LF, and a CR before it, are taken off, the same
+ *  words read_word_list hands out.
+ */
+typedef struct LINE_INDEX {
+    uint64_t file_size;         /**< Size of the word list.                   */
+    uint64_t file_mtime;        /**< Word list's modify time, nanoseconds.    */
+    uint64_t words;             /**< Words in the word list.                  */
+    uint32_t stride;            /**< Words per sample.                        */
+    uint32_t max_len;           /**< Longest word, without its CR or LF.      */
+    uint64_t count;             /**< Number of samples.                       */
+    uint64_t *offsets;          /**< File offset of word i * stride.          */
+} line_index;
+
+int line_index_build(line_index *idx, const char *path, uint32_t stride,
+                     int threads);
+void line_index_destroy(line_index *idx);
+int line_index_save(line_index *idx, const char *path);
+int line_index_load(line_index *idx, const char *path);
+uint64_t line_index_find(const line_index *idx, uint64_t word,
+                         uint64_t *offset);
+
+/** @} */
+
+#endif      /* LINE_INDEX_H */
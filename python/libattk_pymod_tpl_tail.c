@@ -74,6 +74,17 @@ static PyObject *libattk_check_attack(attack_class_st *self) {
     /* Add total records */
     PyDict_SetItemString(check_dict, "total_records",
                          Py_BuildValue("i", status.total_records));
+    /* Add rate, elapsed seconds and ETA seconds */
+    PyDict_SetItemString(check_dict, "rate",
+                         Py_BuildValue("d", status.rate));
+    PyDict_SetItemString(check_dict, "elapsed",
+                         Py_BuildValue("d", status.elapsed_ns / 1e9));
+    if (status.eta_ns != ATTACK_ETA_UNKNOWN) {
+        PyDict_SetItemString(check_dict, "eta",
+                             Py_BuildValue("d", status.eta_ns / 1e9));
+    } else {
+        PyDict_SetItemString(check_dict, "eta", Py_BuildValue(""));
+    }
     /* Add result */
     PyDict_SetItemString(check_dict, "result",
                          Py_BuildValue("s", result));
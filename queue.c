@@ -15,6 +15,8 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "queue.h"
@@ -25,145 +27,405 @@
  *
  *  A queue is a thread safe FIFO queue.  It accepts a pointer to any data,
  *  along with its size, and returns that data upon request.  It holds up to
- *  QUEUE_SIZE data pointers.
+ *  the number of data pointers it was initialized with.
+ *
+ *  The queue is a bounded ring of sequence numbered cells.  A producer claims
+ *  a cell by advancing enqueue_pos with a compare and swap, fills it, and then
+ *  publishes it by bumping the cell's sequence number.  Consumers do the same
+ *  with dequeue_pos.  The events are only used to sleep when the queue is
+ *  actually full or empty, and are only signalled in the kernel when someone
+ *  is asleep.
+ */
+
+/** Private method that finishes stopping a drained queue.
+ *  Moves a stopping queue to stopped once it is empty.
+ *
+ *  @param[in] q The queue.
+ */
+static void queue_check_stopped(queue *q) {
+    queue_state expected = QUEUE_STATE_STOPPING;
+
+    if (queue_empty(q)) {
+        __atomic_compare_exchange_n(&(q->state), &expected,
+                                    QUEUE_STATE_STOPPED, 0, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_SEQ_CST);
+    }
+}
+
+/** Private method that wakes consumers after a pop.
+ *  Wakes a producer, since there is free space now, and every consumer if the
+ *  pop stopped the queue.
+ *
+ *  @param[in] q The queue.
+ */
+static void queue_popped(queue *q) {
+    /* It is not full anymore */
+    event_signal(&(q->not_full));
+
+    /* Let any waiting consumers know the queue is stopped */
+    if (queue_get_state(q) == QUEUE_STATE_STOPPED) {
+        event_broadcast(&(q->not_empty));
+    }
+}
+
+/** Private method that adds data to the queue without waking anyone.
+ *
+ *  @param[in] q    The queue to add to.
+ *  @param[in] in   The data to push onto the queue.
+ *  @param[in] size The size of the data value.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
  */
+static int queue_do_push(queue *q, void *in, size_t size) {
+    queue_cell *cell;
+    uint64_t pos;
+    uint64_t seq;
+    int64_t dif;
+
+    if (__atomic_load_n(&(q->state), __ATOMIC_ACQUIRE) != QUEUE_STATE_ACTIVE) {
+        return QUEUE_E_STOPPED;
+    }
+
+    /* Claim a cell */
+    pos = __atomic_load_n(&(q->enqueue_pos), __ATOMIC_RELAXED);
+    while (1) {
+        cell = &(q->cells[pos % q->capacity]);
+        seq = __atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE);
+        dif = (int64_t)seq - (int64_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&(q->enqueue_pos), &pos, pos + 1,
+                                            1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            /* The cell has not been consumed yet, the queue is full */
+            return QUEUE_E_FULL;
+        } else {
+            pos = __atomic_load_n(&(q->enqueue_pos), __ATOMIC_RELAXED);
+        }
+    }
+
+    /* Fill and publish the cell */
+    cell->data = in;
+    cell->size = size;
+    __atomic_store_n(&(cell->seq), pos + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/** Private method that removes data from the queue without waking anyone.
+ *
+ *  @param[in]  q    The queue to remove from.
+ *  @param[out] out  The data to return.
+ *  @param[out] size The size of the data value.
+ *
+ *  @return          Returns 0 on success, QUEUE_E_EMPTY if the queue is empty
+ *                   or QUEUE_E_STOPPED if it is also stopped.
+ */
+static int queue_do_pop(queue *q, void **out, size_t *size) {
+    queue_cell *cell;
+    uint64_t pos;
+    uint64_t seq;
+    int64_t dif;
+
+    /* Claim a cell */
+    pos = __atomic_load_n(&(q->dequeue_pos), __ATOMIC_RELAXED);
+    while (1) {
+        cell = &(q->cells[pos % q->capacity]);
+        seq = __atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE);
+        dif = (int64_t)seq - (int64_t)(pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&(q->dequeue_pos), &pos, pos + 1,
+                                            1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            /* The cell has not been published yet, the queue is empty */
+            queue_check_stopped(q);
+            if (queue_get_state(q) == QUEUE_STATE_STOPPED) {
+                return QUEUE_E_STOPPED;
+            }
+            return QUEUE_E_EMPTY;
+        } else {
+            pos = __atomic_load_n(&(q->dequeue_pos), __ATOMIC_RELAXED);
+        }
+    }
+
+    /* Empty the cell and hand it back to the producers */
+    *out = cell->data;
+    *size = cell->size;
+    cell->data = NULL;
+    cell->size = 0;
+    __atomic_store_n(&(cell->seq), pos + q->capacity, __ATOMIC_RELEASE);
+
+    /* Stop the queue if that was the last of it */
+    queue_check_stopped(q);
+
+    return 0;
+}
 
 /** Initializes a queue.
- *  Clears a new queue, sets it to empty, makes it active, and sets up its
- *  thread mutex and contexts.
+ *  Clears a new queue, allocates its ring, makes it active, and sets up its
+ *  events.
+ *
+ *  @param[in] q    The queue to initialize.
+ *  @param[in] size The number of data pointers the queue can hold, 0 for
+ *                  QUEUE_SIZE.
  *
- *  @param[in] q The queue to initialize.
+ *  @return         Returns 0 on success, otherwise an error code.
  */
-void queue_init(queue *q) {
+int queue_init(queue *q, size_t size) {
+    size_t i;
+
     /* Clear the structure */
     memset(q, 0, sizeof(queue));
 
     /* Set defaults */
-    q->empty = 1;
+    if (size == 0) {
+        size = QUEUE_SIZE;
+    }
+    q->capacity = size;
     q->state = QUEUE_STATE_ACTIVE;
 
-    /* Initialize pthread objects */
-    pthread_mutex_init(&(q->mut), NULL);
-    pthread_cond_init(&(q->not_full), NULL);
-    pthread_cond_init(&(q->not_empty), NULL);
+    /* Create the ring, each cell starts out ready for its first push */
+    q->cells = malloc(sizeof(queue_cell) * size);
+    if (q->cells == NULL) {
+        return QUEUE_E_SYSTEM;
+    }
+    for (i = 0; i < size; i++) {
+        q->cells[i].seq = i;
+        q->cells[i].data = NULL;
+        q->cells[i].size = 0;
+    }
+
+    /* Initialize events */
+    event_init(&(q->not_full));
+    event_init(&(q->not_empty));
+
+    return 0;
 }
 
 
 /** Destroys a queue structure.
- *  Clears a queue struct, sets it to empty, makes it inactive, and destroys its
- *  thread mutex and contexts.  The queue must not be active and must be empty.
+ *  Frees a queue's ring and makes it inactive.  The queue must not be active
+ *  and must be empty.
  *
  *  @param[in] q The queue to destroy.
  */
 void queue_destroy(queue *q) {
     /* Sanity check */
     assert(q->state == QUEUE_STATE_STOPPED);
-    assert(q->empty == 1);
+    assert(queue_empty(q));
 
-    /* Destroy pthread objects */
-    pthread_mutex_destroy(&(q->mut));
-    pthread_cond_destroy(&(q->not_full));
-    pthread_cond_destroy(&(q->not_empty));
+    /* Free the ring */
+    free(q->cells);
 
     /* Clear the structure */
     memset(q, 0, sizeof(queue));
 
     /* Set defaults */
-    q->empty = 1;
     q->state = QUEUE_STATE_STOPPED;
 }
 
 
-/** Add data to the queue.
- *  Adds the data pointer and size of the data to the queue.  The queue must be
- *  active, the size must be greater than 0 and it can not be full.
+/** Try to add data to the queue.
+ *  Adds the data pointer and size of the data to the queue without blocking.
+ *  The size must be greater than 0.
  *
  *  @param[in] q    The queue to add to.
- *  @param[in] in   The data to push onto the stack.
+ *  @param[in] in   The data to push onto the queue.
  *  @param[in] size The size of the data value.
+ *
+ *  @return         Returns 0 on success, QUEUE_E_FULL if the queue is full or
+ *                  QUEUE_E_STOPPED if the queue is not active.
  */
-void queue_push(queue *q, void *in, size_t size) {
+int queue_try_push(queue *q, void *in, size_t size) {
+    int retval;
+
     /* Sanity check */
     assert(size > 0);
-    assert(q->state == QUEUE_STATE_ACTIVE);
-    assert(q->full == 0);
-
-    /* Push data onto the end of the queue */
-    q->stack[q->tail] = in;
-    q->stack_sizes[q->tail] = size;
 
-    /* Advance the tail */
-    q->tail++;
-    if (q->tail == QUEUE_SIZE) {
-        q->tail = 0;
+    retval = queue_do_push(q, in, size);
+    if (retval == 0) {
+        /* It is not empty anymore */
+        event_signal(&(q->not_empty));
     }
 
-    /* Check if the queue is full */
-    if (q->tail == q->head) {
-        q->full = 1;
-    }
-
-    /* It is not empty anymore */
-    q->empty = 0;
+    return retval;
 }
 
 
-/** Remove data from the queue.
- *  Removes the next data pointer and size of the data from the queue.  The
- *  queue must not be stopped and can not be empty.
+/** Try to remove data from the queue.
+ *  Removes the next data pointer and size of the data from the queue without
+ *  blocking.  Data is still returned from a stopping or stopped queue so that
+ *  it can be drained.
  *
- *  @param[in]  q    The queue to add to.
+ *  @param[in]  q    The queue to remove from.
  *  @param[out] out  The data to return.
  *  @param[out] size The size of the data value.
+ *
+ *  @return          Returns 0 on success, QUEUE_E_EMPTY if the queue is empty
+ *                   or QUEUE_E_STOPPED if it is also stopped.
  */
-void queue_pop(queue *q, void **out, size_t *size) {
-    /* Sanity check */
-    assert(q->state != QUEUE_STATE_STOPPED);
-    assert(q->empty == 0);
+int queue_try_pop(queue *q, void **out, size_t *size) {
+    int retval;
+
+    retval = queue_do_pop(q, out, size);
+    queue_popped(q);
+
+    return retval;
+}
 
-    /* Pop data off the head of the queue */
-    *out = q->stack[q->head];
-    *size = q->stack_sizes[q->head];
 
-    /* Clear the queue position */
-    q->stack[q->head] = NULL;
-    q->stack_sizes[q->head] = 0;
+/** Add data to the queue.
+ *  Adds the data pointer and size of the data to the queue, sleeping for up to
+ *  wait_sec seconds while the queue is full.
+ *
+ *  @param[in] q        The queue to add to.
+ *  @param[in] in       The data to push onto the queue.
+ *  @param[in] size     The size of the data value.
+ *  @param[in] wait_sec Seconds to wait for free space, 0 to not wait or
+ *                      QUEUE_WAIT_FOREVER to wait until there is free space or
+ *                      the queue is stopped.
+ *
+ *  @return             Returns 0 on success, QUEUE_E_FULL if the queue stayed
+ *                      full or QUEUE_E_STOPPED if the queue is not active.
+ */
+int queue_push(queue *q, void *in, size_t size, int wait_sec) {
+    uint32_t key;
+    int retval;
+
+    /* Sanity check */
+    assert(size > 0);
 
-    /* Advance the head */
-    q->head++;
-    if (q->head == QUEUE_SIZE) {
-        q->head = 0;
+    while ((retval = queue_do_push(q, in, size)) == QUEUE_E_FULL &&
+           wait_sec != 0) {
+        /* Wait for the queue to have free space */
+        key = event_prepare(&(q->not_full));
+        retval = queue_do_push(q, in, size);
+        if (retval != QUEUE_E_FULL) {
+            event_cancel(&(q->not_full));
+            break;
+        }
+        if (event_wait(&(q->not_full), key, wait_sec) == ETIMEDOUT) {
+            retval = queue_do_push(q, in, size);
+            break;
+        }
     }
 
-    /* Check if the queue is empty */
-    if (q->head == q->tail) {
-        q->empty = 1;
+    if (retval == 0) {
+        /* It is not empty anymore */
+        event_signal(&(q->not_empty));
+    }
 
-        /* Stop the queue */
-        if (q->state == QUEUE_STATE_STOPPING) {
-            q->state = QUEUE_STATE_STOPPED;
+    return retval;
+}
+
+
+/** Remove data from the queue.
+ *  Removes the next data pointer and size of the data from the queue, sleeping
+ *  for up to wait_sec seconds while the queue is empty.
+ *
+ *  @param[in]  q        The queue to remove from.
+ *  @param[out] out      The data to return.
+ *  @param[out] size     The size of the data value.
+ *  @param[in]  wait_sec Seconds to wait for data, 0 to not wait or
+ *                       QUEUE_WAIT_FOREVER to wait until there is data or the
+ *                       queue is stopped.
+ *
+ *  @return              Returns 0 on success, QUEUE_E_EMPTY if the queue
+ *                       stayed empty or QUEUE_E_STOPPED if the queue is
+ *                       stopped.
+ */
+int queue_pop(queue *q, void **out, size_t *size, int wait_sec) {
+    uint32_t key;
+    int retval;
+
+    while ((retval = queue_do_pop(q, out, size)) == QUEUE_E_EMPTY &&
+           wait_sec != 0) {
+        /* Wait for the queue to have something */
+        key = event_prepare(&(q->not_empty));
+        retval = queue_do_pop(q, out, size);
+        if (retval != QUEUE_E_EMPTY) {
+            event_cancel(&(q->not_empty));
+            break;
+        }
+        if (event_wait(&(q->not_empty), key, wait_sec) == ETIMEDOUT) {
+            retval = queue_do_pop(q, out, size);
+            break;
         }
     }
+    queue_popped(q);
 
-    /* It is not full anymore */
-    q->full = 0;
+    return retval;
+}
+
+
+/** Check if the queue is empty.
+ *  The result is only a snapshot when other threads are using the queue.
+ *
+ *  @param[in] q The queue to check.
+ *
+ *  @return      Returns true if the queue is empty.
+ */
+int queue_empty(queue *q) {
+    return __atomic_load_n(&(q->dequeue_pos), __ATOMIC_SEQ_CST) ==
+           __atomic_load_n(&(q->enqueue_pos), __ATOMIC_SEQ_CST);
+}
+
+
+/** Count the data in the queue.
+ *  The result is only a snapshot when other threads are using the queue.
+ *
+ *  @param[in] q The queue to check.
+ *
+ *  @return      Returns the number of data pointers in the queue.
+ */
+size_t queue_count(queue *q) {
+    uint64_t dequeue_pos = __atomic_load_n(&(q->dequeue_pos),
+                                           __ATOMIC_RELAXED);
+    uint64_t enqueue_pos = __atomic_load_n(&(q->enqueue_pos),
+                                           __ATOMIC_RELAXED);
+
+    /* The positions are read one after the other, so they can cross */
+    if (enqueue_pos <= dequeue_pos) {
+        return 0;
+    }
+    if (enqueue_pos - dequeue_pos > q->capacity) {
+        return q->capacity;
+    }
+    return enqueue_pos - dequeue_pos;
+}
+
+
+/** Get the state of the queue.
+ *
+ *  @param[in] q The queue to check.
+ *
+ *  @return      Returns the current queue state.
+ */
+queue_state queue_get_state(queue *q) {
+    return __atomic_load_n(&(q->state), __ATOMIC_ACQUIRE);
 }
 
 
 /** Stop the queue.
- *  Stops an active queue, this prevents new data from being added.  The queue
- *  must not already be stopped.
+ *  Stops an active queue, this prevents new data from being added and wakes
+ *  any blocked threads.  Data already in the queue can still be removed.
  *
  *  @param[in] q The queue to stop.
  */
 void queue_stop(queue *q) {
-    /* Change state, unless the queue is already stopped */
-    if (q->state != QUEUE_STATE_STOPPED) {
-        if (q->empty) {
-            q->state = QUEUE_STATE_STOPPED;
-        } else {
-            q->state = QUEUE_STATE_STOPPING;
-        }
-    }
-}
+    queue_state expected = QUEUE_STATE_ACTIVE;
+
+    /* Change state, unless the queue is already stopping or stopped */
+    __atomic_compare_exchange_n(&(q->state), &expected, QUEUE_STATE_STOPPING,
+                                0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    queue_check_stopped(q);
 
+    /* Wake everyone up so they notice */
+    event_broadcast(&(q->not_full));
+    event_broadcast(&(q->not_empty));
+}
@@ -20,14 +20,28 @@
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
-#include <pthread.h>
 #include <stdint.h>
+#include <sys/types.h>
+
+#include "event.h"
 
 /** @addtogroup queue
  *  @{
  */
 
-#define QUEUE_SIZE      20  /**< Maximum number of pointers a queue can hold. */
+#define QUEUE_SIZE      20  /**< Default number of pointers a queue can hold. */
+#define CACHE_LINE_SIZE 64  /**< Size of a CPU cache line, used for padding.  */
+#define QUEUE_WAIT_FOREVER EVENT_WAIT_FOREVER /**< Block until the queue
+                                               *   changes.
+                                               */
+
+/*** Errors ***/
+#define QUEUE_E_FULL    -1  /**< The queue is full.                           */
+#define QUEUE_E_EMPTY   -2  /**< The queue is empty.                          */
+#define QUEUE_E_STOPPED -3  /**< The queue is no longer accepting or returning
+                             *   data.
+                             */
+#define QUEUE_E_SYSTEM  -4  /**< A system error occurred, check errno.        */
 
 /** Queue state enum.
  *  Indicates the state of a queue.
@@ -38,33 +52,45 @@ typedef enum {
     QUEUE_STATE_STOPPED     /**< Queue stopped state.  */
 } queue_state;
 
+/** A queue cell.
+ *  One slot in the queue ring.  The sequence number tells producers and
+ *  consumers whose turn it is to use the slot.
+ */
+typedef struct QUEUE_CELL_ST {
+    uint64_t seq;               /**< The cell sequence number.                */
+    void *data;                 /**< The data pointer.                        */
+    size_t size;                /**< The data size.                           */
+} queue_cell;
+
 /** A queue structure.
- *  A FIFO, pthreads compatible queue.
+ *  A FIFO, lock-free, multi-producer/multi-consumer queue.  Producers and
+ *  consumers only fall back to sleeping on an event when the queue is full or
+ *  empty.
  */
 typedef struct {
-    void *stack[QUEUE_SIZE];    /**< The queue data stack.                    */
-    size_t stack_sizes[QUEUE_SIZE]; /**< The queue data size stack.           */
-    int head;                   /**< Pointer to the head of the queue.        */
-    int tail;                   /**< Pointer to the tail of the queue.        */
-    int full;                   /**< True if the queue is full.               */
-    int empty;                  /**< True if the queue is empty.              */
+    uint64_t enqueue_pos
+        __attribute__ ((aligned (CACHE_LINE_SIZE))); /**< Next push position. */
+    uint64_t dequeue_pos
+        __attribute__ ((aligned (CACHE_LINE_SIZE))); /**< Next pop position.  */
+    queue_cell *cells
+        __attribute__ ((aligned (CACHE_LINE_SIZE))); /**< The queue ring.     */
+    size_t capacity;            /**< Number of cells in the ring.             */
     queue_state state;          /**< The current state of the queue.          */
-    pthread_mutex_t mut;        /**< Thread mutex for the queue.              */
-    pthread_cond_t not_full;    /**< Thread condition for the queue being not
-                                 *   full.
-                                 */
-    pthread_cond_t not_empty;   /**< Thread condition for the queue being not
-                                 *   empty.
-                                 */
+    event not_full;             /**< Event for the queue being not full.      */
+    event not_empty;            /**< Event for the queue being not empty.     */
 } queue;
 
-void queue_init(queue *q);
+int queue_init(queue *q, size_t size);
 void queue_destroy(queue *q);
-void queue_push(queue *q, void *in, size_t size);
-void queue_pop(queue *q, void **out, size_t *size);
+int queue_try_push(queue *q, void *in, size_t size);
+int queue_try_pop(queue *q, void **out, size_t *size);
+int queue_push(queue *q, void *in, size_t size, int wait_sec);
+int queue_pop(queue *q, void **out, size_t *size, int wait_sec);
+int queue_empty(queue *q);
+size_t queue_count(queue *q);
+queue_state queue_get_state(queue *q);
 void queue_stop(queue *q);
 
 /** @} */
 
 #endif      /* QUEUE_H */
-
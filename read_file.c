@@ -23,6 +23,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -34,12 +36,21 @@
  *  Process a file as a set of records.
  *
  *  Read file implements the file interface for libattkthread.  Opens a file
- *  and reads through it, processing the file in chunks of records.
+ *  and reads through it, processing the file in chunks of records.  A file
+ *  written with packed blocks is read as packed blocks, its records can not
+ *  be counted, sought or split up front.
+ *
+ *  A file may be read ahead, keeping a few reads in flight with async_read,
+ *  and read with O_DIRECT so a dictionary much larger than memory does not
+ *  push everything else out of the page cache.  A file that fits in memory
+ *  may be mapped instead, fixed size blocks are then handed out straight
+ *  from the mapping, and attacks on the same file share its pages.
  */
 
 /** Initializes a read file structure.
  *  Clears a new read file structure, copies the file path, sets the record
- *  size, and sets up its thread mutex.
+ *  size, and sets up its thread mutex.  If its private data can not be
+ *  allocated file_data is left NULL, and opening the file fails.
  *
  *  @param[in] file                 The file structure.
  *  @param[in] records_per_block    The number of records per block.
@@ -75,11 +86,21 @@ void read_file_init(file_st *file, int records_per_block, char *file_path,
     /* Initialize pthread objects */
     pthread_mutex_init(&(file->mut), NULL);
 
+    /* Setup class methods */
+    file->open_file = read_open_file;
+    file->next_block = read_next_block;
+    file->free_block = read_free_block;
+    file->close_file = read_close_file;
+
     /* Create read_file_data_st */
     read_file_st = malloc(sizeof(read_file_data_st));
-    memset(read_file_st, 0, sizeof(read_file_data_st));
     file->file_data = read_file_st;
-    memcpy(read_file_st->description, file_description, 255);
+    if (read_file_st == NULL) {
+        return;
+    }
+    memset(read_file_st, 0, sizeof(read_file_data_st));
+    memcpy(read_file_st->description, file_description,
+           strlen(file_description) < 255 ? strlen(file_description) : 255);
     read_file_st->skip_records = skip_records;
     read_file_st->max_records = count_records;
 
@@ -96,8 +117,10 @@ void read_file_init(file_st *file, int records_per_block, char *file_path,
     read(fp, &header.description, sizeof(header.description));
     read(fp, &header.file_order, sizeof(header.file_order));
     read(fp, &header.record_size, sizeof(header.record_size));
+    read(fp, &header.revision, sizeof(header.revision));
     header.record_size = ntohs(header.record_size);
     header.file_order = ntohl(header.file_order);
+    header.revision = ntohs(header.revision);
 
     /* Save the file order and record size */
     read_file_st->file_order = header.file_order;
@@ -106,11 +129,33 @@ void read_file_init(file_st *file, int records_per_block, char *file_path,
     /* Close the file */
     close(fp);
 
-    /* Setup class methods */
-    file->open_file = read_open_file;
-    file->next_block = read_next_block;
-    file->free_block = read_free_block;
-    file->close_file = read_close_file;
+    /* Packed files can not be sought or split */
+    if (header.revision == READ_FILE_REVISION_PACKED) {
+        file->flags = FILE_PACKED | FILE_OWN_BLOCKS;
+    } else {
+        file->seek = read_seek;
+        file->split = read_split;
+        file->free_parts = read_free_parts;
+    }
+}
+
+/** Private method that unmaps the file.
+ *  Blocks handed out from the mapping are good until it is unmapped, so the
+ *  mapping outlives closing the file, until the file is opened again or
+ *  destroyed.  A part borrowing the split file's mapping leaves it be.
+ *
+ *  @param[in] file The file structure.
+ */
+static void read_map_close(file_st *file) {
+    read_file_data_st *read_file_st = file->file_data;
+
+    if (read_file_st->map != NULL) {
+        if (!read_file_st->map_borrowed) {
+            munmap(read_file_st->map, read_file_st->map_size);
+        }
+        read_file_st->map = NULL;
+        read_file_st->map_size = 0;
+    }
 }
 
 /** Destroys a read file structure.
@@ -124,9 +169,322 @@ void read_file_destroy(file_st *file) {
     pthread_mutex_destroy(&(file->mut));
 
     /* Destroy read_file_data_st */
+    if (file->file_data != NULL) {
+        read_map_close(file);
+        free(((read_file_data_st *)file->file_data)->packed);
+    }
     free(file->file_data);
 }
 
+/** Sets up reading ahead.
+ *  Keeps reads of the file in flight ahead of the blocks being asked for.
+ *  Must be called before the file is opened, parts split from the file read
+ *  ahead the same way.
+ *
+ *  @param[in] file     The file structure.
+ *  @param[in] reads    Number of reads to keep in flight, 0 to only read
+ *                      when a block is asked for.
+ *  @param[in] direct   Set to read with O_DIRECT, bypassing the page cache,
+ *                      if the file system allows it.
+ */
+void read_file_read_ahead(file_st *file, int reads, int direct) {
+    read_file_data_st *read_file_st = file->file_data;
+
+    if (read_file_st == NULL) {
+        return;
+    }
+    read_file_st->read_ahead = reads;
+    read_file_st->direct = direct;
+}
+
+/** Maps the file.
+ *  Maps the file when it is opened rather than reading it.  The blocks of
+ *  a file with fixed size records point into the mapping, the records must
+ *  not be written to.  Must be called before the file is opened, parts split
+ *  from the file are mapped the same way.
+ *
+ *  @param[in] file     The file structure.
+ *  @param[in] flags    READ_FILE_MAP* flags, 0 to read the file.
+ */
+void read_file_map(file_st *file, int flags) {
+    read_file_data_st *read_file_st = file->file_data;
+
+    if (read_file_st == NULL) {
+        return;
+    }
+    read_file_st->map_flags = flags;
+
+    /* Packed blocks are still copied, the file's are in network order */
+    if ((flags & READ_FILE_MAP) && !(file->flags & FILE_PACKED)) {
+        file->flags |= FILE_OWN_BLOCKS;
+    } else if (!(file->flags & FILE_PACKED)) {
+        file->flags &= ~FILE_OWN_BLOCKS;
+    }
+}
+
+/** Private method that maps the file.
+ *  Maps the whole file, reading then goes on from the file pointer's
+ *  offset.  The kernel is told the mapping is read in order, and to start
+ *  reading in the part of the file still to come.  A part split from a
+ *  mapped file uses its mapping, the engine frees every block through the
+ *  split file.
+ *
+ *  @param[in] file The file structure.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int read_map_open(file_st *file) {
+    read_file_data_st *read_file_st = file->file_data;
+    struct stat file_stat;
+    off64_t offset;
+    uint64_t start;
+    uint64_t end;
+    int flags = MAP_SHARED;
+
+    if (!(read_file_st->map_flags & READ_FILE_MAP)) {
+        read_map_close(file);
+        return 0;
+    }
+
+    offset = lseek64(read_file_st->fp, 0, SEEK_CUR);
+    if (offset < 0) {
+        return E_ATTK_SYSTEM;
+    }
+
+    /* Map it */
+    if (!read_file_st->map_borrowed) {
+        read_map_close(file);
+        if (fstat(read_file_st->fp, &file_stat) != 0) {
+            return E_ATTK_SYSTEM;
+        }
+        if (file_stat.st_size == 0) {
+            return E_ATTK_FILE_INVALID;
+        }
+        if (read_file_st->map_flags & READ_FILE_MAP_POPULATE) {
+            flags |= MAP_POPULATE;
+        }
+        read_file_st->map = mmap(NULL, file_stat.st_size, PROT_READ, flags,
+                                 read_file_st->fp, 0);
+        if (read_file_st->map == MAP_FAILED) {
+            read_file_st->map = NULL;
+            return E_ATTK_SYSTEM;
+        }
+        read_file_st->map_size = file_stat.st_size;
+
+        /* Advise the kernel, it is only advice so errors are ignored */
+        madvise(read_file_st->map, read_file_st->map_size, MADV_SEQUENTIAL);
+        if (read_file_st->map_flags & READ_FILE_MAP_HUGE) {
+            madvise(read_file_st->map, read_file_st->map_size, MADV_HUGEPAGE);
+        }
+    }
+    read_file_st->pos = offset;
+
+    /* Start reading in what is still to come */
+    start = offset & ~((uint64_t)sysconf(_SC_PAGESIZE) - 1);
+    end = read_file_st->map_size;
+    if (!(file->flags & FILE_PACKED) && read_file_st->max_records > 0 &&
+        offset + read_file_st->max_records * file->record_size < end) {
+        end = offset + read_file_st->max_records * file->record_size;
+    }
+    if (start < end) {
+        madvise(read_file_st->map + start, end - start, MADV_WILLNEED);
+    }
+
+    return 0;
+}
+
+/** Private method that stops reading ahead.
+ *
+ *  @param[in] file The file structure.
+ */
+static void read_ahead_close(file_st *file) {
+    read_file_data_st *read_file_st = file->file_data;
+    int fd;
+
+    if (read_file_st->ar == NULL) {
+        return;
+    }
+
+    fd = read_file_st->ar->fd;
+    async_read_destroy(read_file_st->ar);
+    free(read_file_st->ar);
+    read_file_st->ar = NULL;
+    read_file_st->chunk = NULL;
+    if (fd != read_file_st->fp) {
+        close(fd);
+    }
+}
+
+/** Private method that starts reading ahead.
+ *  Reads from the file pointer's offset on.  With O_DIRECT the file is
+ *  opened again, if the file system will not have it the reads go through
+ *  the page cache.
+ *
+ *  @param[in] file The file structure.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int read_ahead_open(file_st *file) {
+    read_file_data_st *read_file_st = file->file_data;
+    off64_t offset;
+    int fd = read_file_st->fp;
+    int flags = 0;
+
+    if (read_file_st->read_ahead <= 0 || read_file_st->map != NULL) {
+        return 0;
+    }
+
+    offset = lseek64(read_file_st->fp, 0, SEEK_CUR);
+    if (offset < 0) {
+        return E_ATTK_SYSTEM;
+    }
+
+    /* Open the file again to bypass the page cache */
+    if (read_file_st->direct) {
+        fd = open(file->file_path, O_RDONLY|O_LARGEFILE|O_DIRECT);
+        if (fd < 0) {
+            #ifdef DEBUG
+            printf("read_ahead_open: Can not use O_DIRECT (%s)\n",
+                   file->file_path);
+            #endif
+            fd = read_file_st->fp;
+        } else {
+            flags = ASYNC_READ_DIRECT;
+        }
+    }
+
+    /* Start reading */
+    read_file_st->ar = malloc(sizeof(async_read));
+    if (read_file_st->ar == NULL ||
+        async_read_init(read_file_st->ar, fd,
+                        (size_t)file->records_per_block * file->record_size,
+                        read_file_st->read_ahead, flags) != 0) {
+        free(read_file_st->ar);
+        read_file_st->ar = NULL;
+        if (fd != read_file_st->fp) {
+            close(fd);
+        }
+        return E_ATTK_SYSTEM;
+    }
+    read_file_st->chunk = NULL;
+    read_file_st->pos = offset;
+    if (async_read_start(read_file_st->ar, offset) != 0) {
+        read_ahead_close(file);
+        return E_ATTK_SYSTEM;
+    }
+
+    return 0;
+}
+
+/** Private method that reads from the file.
+ *  Copies from the mapping, if the file is mapped, or from the chunks read
+ *  ahead, if reading ahead, otherwise reads from the file pointer.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[out] buffer  Where to read to.
+ *  @param[in]  size    Bytes to read.
+ *
+ *  @return             Returns the number of bytes read, less than size at
+ *                      the end of the file, otherwise an error code.
+ */
+static ssize_t read_file_read(file_st *file, char *buffer, size_t size) {
+    read_file_data_st *read_file_st = file->file_data;
+    uint64_t offset;
+    ssize_t len;
+    size_t done = 0;
+    size_t n;
+
+    if (read_file_st->map != NULL) {
+        if (read_file_st->pos >= read_file_st->map_size) {
+            return 0;
+        }
+        if (size > read_file_st->map_size - read_file_st->pos) {
+            size = read_file_st->map_size - read_file_st->pos;
+        }
+        memcpy(buffer, read_file_st->map + read_file_st->pos, size);
+        read_file_st->pos += size;
+        return size;
+    } else if (read_file_st->ar == NULL) {
+        return read(read_file_st->fp, buffer, size);
+    }
+
+    while (done < size) {
+        /* Wait for the next chunk */
+        if (read_file_st->chunk == NULL) {
+            len = async_read_next(read_file_st->ar, &(read_file_st->chunk),
+                                  &offset);
+            if (len < 0) {
+                read_file_st->chunk = NULL;
+                return E_ATTK_SYSTEM;
+            } else if (len == 0) {
+                read_file_st->chunk = NULL;
+                break;
+            }
+            read_file_st->chunk_len = len;
+            read_file_st->chunk_offset = offset;
+        }
+
+        /* Copy what is left of it, the first chunk may start before pos */
+        n = 0;
+        if (read_file_st->pos <
+            read_file_st->chunk_offset + read_file_st->chunk_len) {
+            n = read_file_st->chunk_offset + read_file_st->chunk_len -
+                read_file_st->pos;
+            if (n > size - done) {
+                n = size - done;
+            }
+            memcpy(buffer + done, read_file_st->chunk +
+                   (read_file_st->pos - read_file_st->chunk_offset), n);
+            done += n;
+            read_file_st->pos += n;
+        }
+
+        /* Hand the chunk back once it is used up */
+        if (read_file_st->pos >=
+            read_file_st->chunk_offset + read_file_st->chunk_len) {
+            read_file_st->chunk = NULL;
+            if (async_read_done(read_file_st->ar) != 0) {
+                return E_ATTK_SYSTEM;
+            }
+        }
+    }
+
+    return done;
+}
+
+/** Private method that skips part of the file.
+ *  Chunks already read ahead are passed over, past them reading starts
+ *  again.  A mapped file just moves on.
+ *
+ *  @param[in] file The file structure.
+ *  @param[in] size Bytes to skip.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int read_file_skip(file_st *file, uint64_t size) {
+    read_file_data_st *read_file_st = file->file_data;
+
+    if (read_file_st->map != NULL) {
+        read_file_st->pos += size;
+        return 0;
+    } else if (read_file_st->ar == NULL) {
+        if (lseek64(read_file_st->fp, size, SEEK_CUR) < 0) {
+            return E_ATTK_SYSTEM;
+        }
+        return 0;
+    }
+
+    read_file_st->pos += size;
+    if (read_file_st->pos >= read_file_st->ar->next_offset) {
+        read_file_st->chunk = NULL;
+        if (async_read_start(read_file_st->ar, read_file_st->pos) != 0) {
+            return E_ATTK_SYSTEM;
+        }
+    }
+
+    return 0;
+}
+
 /** Open the file.
  *  Opens the file and starts processing it.
  *
@@ -139,12 +497,17 @@ int read_open_file(file_st *file) {
     struct stat file_stat;
     int fp;
     read_file_header_st header;
+    uint64_t available;
     int retval;
 
     #ifdef DEBUG
     printf("read_open_file: START (%s)\n", file->file_path);
     #endif
 
+    if (read_file_st == NULL) {
+        return E_ATTK_SYSTEM;
+    }
+
     /* Open the file */
     fp = open(file->file_path, O_RDONLY|O_LARGEFILE);
     if (fp < 0) {
@@ -160,10 +523,11 @@ int read_open_file(file_st *file) {
     read(fp, &header.description, sizeof(header.description));
     read(fp, &header.file_order, sizeof(header.file_order));
     read(fp, &header.record_size, sizeof(header.record_size));
-    read(fp, &header.reserved, sizeof(header.reserved));
+    read(fp, &header.revision, sizeof(header.revision));
     header.magic = ntohl(header.magic);
     header.file_order = ntohl(header.file_order);
     header.record_size = ntohs(header.record_size);
+    header.revision = ntohs(header.revision);
     file->record_size = header.record_size;
 
     if (header.magic != READ_FILE_MAGIC) {
@@ -179,6 +543,13 @@ int read_open_file(file_st *file) {
         #endif
         return E_ATTK_FILE_INVALID;
     }
+    if (header.revision != ((file->flags & FILE_PACKED) ?
+                            READ_FILE_REVISION_PACKED : 0)) {
+        #ifdef DEBUG
+        printf("read_open_file: Bad file revision.\n");
+        #endif
+        return E_ATTK_FILE_INVALID;
+    }
     if (strlen(header.description) != strlen(read_file_st->description)) {
         #ifdef DEBUG
         printf("read_open_file: Bad file description size.\n");
@@ -193,31 +564,245 @@ int read_open_file(file_st *file) {
         return E_ATTK_FILE_INVALID;
     }
 
-    /* Set the total number of records to read */
-    if (read_file_st->max_records == 0) {
-        /* Get the file size */
-        retval = fstat(fp, &file_stat);
-        if (retval == -1){
-            #ifdef DEBUG
-            printf("read_open_file: Can not get file size.\n");
-            #endif
-            return E_ATTK_SYSTEM;
+    /* Get the file size */
+    retval = fstat(fp, &file_stat);
+    if (retval == -1){
+        #ifdef DEBUG
+        printf("read_open_file: Can not get file size.\n");
+        #endif
+        return E_ATTK_SYSTEM;
+    }
+
+    /* Packed records can not be counted without reading them, they are
+       skipped as they are read, let the attack guess how far through the
+       file it is */
+    if (file->flags & FILE_PACKED) {
+        file->total_records = 0;
+        file->bytes_total = file_stat.st_size;
+        file->bytes_done = 0;
+        read_file_st->skip_left = read_file_st->skip_records;
+        read_file_st->current_record = 0;
+        read_file_st->packed_next = 0;
+        if (read_file_st->packed != NULL) {
+            ATTK_PACKED_COUNT(read_file_st->packed) = 0;
+        }
+        read_file_st->fp = fp;
+        retval = read_map_open(file);
+        if (retval != 0) {
+            return retval;
         }
-        file->total_records = file_stat.st_size / file->record_size;
+        return read_ahead_open(file);
+    }
+
+    /* Set the total number of records to read, past the header and any
+       skipped records */
+    available = 0;
+    if (file_stat.st_size > sizeof(read_file_header_st)) {
+        available = (file_stat.st_size - sizeof(read_file_header_st)) /
+                    file->record_size;
+    }
+    if (read_file_st->skip_records >= available) {
+        available = 0;
+    } else {
+        available -= read_file_st->skip_records;
+    }
+    if (read_file_st->max_records == 0 ||
+        read_file_st->max_records > available) {
+        file->total_records = available;
     } else {
         file->total_records = read_file_st->max_records;
     }
 
     /* Skip records, if needed */
     if (read_file_st->skip_records > 0) {
-        lseek64(read_file_st->fp, file->record_size*read_file_st->skip_records,
-                SEEK_CUR);
+        lseek64(fp, file->record_size * read_file_st->skip_records, SEEK_CUR);
     }
 
     /* Save the file pointer */
     read_file_st->fp = fp;
 
-    return 0;
+    retval = read_map_open(file);
+    if (retval != 0) {
+        return retval;
+    }
+    return read_ahead_open(file);
+}
+
+/** Private method that loads the next packed block from the file.
+ *  Checks every offset so each record ends in a 0 and fits record_size, and
+ *  passes over whole blocks of records still to skip without reading them.
+ *
+ *  @param[in] file The file structure.
+ *
+ *  @return         Returns the number of records in the block, 0 at the end
+ *                  of the file, otherwise an error code.
+ */
+static int read_packed_load(file_st *file) {
+    read_file_data_st *read_file_st = file->file_data;
+    uint32_t count;
+    uint32_t *offsets;
+    size_t head;
+    size_t size;
+    ssize_t retval;
+    char *buffer;
+    uint32_t i;
+
+    while (1) {
+        /* Read the record count */
+        retval = read_file_read(file, (char *)&count, sizeof(count));
+        if (retval == 0) {
+            return 0;
+        } else if (retval != sizeof(count)) {
+            return E_ATTK_FILE_INVALID;
+        }
+        count = ntohl(count);
+        head = ATTK_PACKED_HEADER(count);
+
+        /* Make room for the header */
+        if (head > read_file_st->packed_size) {
+            buffer = realloc(read_file_st->packed, head);
+            if (buffer == NULL) {
+                return E_ATTK_SYSTEM;
+            }
+            read_file_st->packed = buffer;
+            read_file_st->packed_size = head;
+        }
+        ATTK_PACKED_COUNT(read_file_st->packed) = 0;
+
+        /* Read the offsets, the records follow straight after them */
+        offsets = ATTK_PACKED_OFFSETS(read_file_st->packed);
+        size = head - sizeof(count);
+        if (read_file_read(file, (char *)offsets, size) != (ssize_t)size) {
+            return E_ATTK_FILE_INVALID;
+        }
+        for (i = 0; i <= count; i++) {
+            offsets[i] = ntohl(offsets[i]);
+        }
+        if (offsets[0] != head) {
+            return E_ATTK_FILE_INVALID;
+        }
+        for (i = 0; i < count; i++) {
+            if (offsets[i + 1] <= offsets[i] ||
+                offsets[i + 1] - offsets[i] > file->record_size) {
+                return E_ATTK_FILE_INVALID;
+            }
+        }
+        size = offsets[count] - head;
+
+        /* Pass over a block of skipped records */
+        if (read_file_st->skip_left >= count) {
+            read_file_st->skip_left -= count;
+            if (read_file_skip(file, size) != 0) {
+                return E_ATTK_SYSTEM;
+            }
+            continue;
+        }
+
+        /* Read the records */
+        if (head + size > read_file_st->packed_size) {
+            buffer = realloc(read_file_st->packed, head + size);
+            if (buffer == NULL) {
+                return E_ATTK_SYSTEM;
+            }
+            read_file_st->packed = buffer;
+            read_file_st->packed_size = head + size;
+            offsets = ATTK_PACKED_OFFSETS(buffer);
+        }
+        if (read_file_read(file, read_file_st->packed + head, size) !=
+            (ssize_t)size) {
+            return E_ATTK_FILE_INVALID;
+        }
+        for (i = 1; i <= count; i++) {
+            if (read_file_st->packed[offsets[i] - 1] != '\0') {
+                return E_ATTK_FILE_INVALID;
+            }
+        }
+        ATTK_PACKED_COUNT(read_file_st->packed) = count;
+        read_file_st->packed_next = read_file_st->skip_left;
+        read_file_st->skip_left = 0;
+
+        return count;
+    }
+}
+
+/** Private method that reads in a packed block.
+ *  Hands out up to records_per_block records of the loaded block as a new
+ *  packed block, loading the next one when it runs out.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[out] buf     The block to return.
+ *
+ *  @return             Returns the number of bytes of the block used,
+ *                      otherwise an error code.
+ */
+static ssize_t read_next_packed(file_st *file, char **buf) {
+    read_file_data_st *read_file_st = file->file_data;
+    uint64_t remaining;
+    uint32_t *offsets;
+    uint32_t *out_offsets;
+    uint32_t first;
+    uint32_t count;
+    uint32_t i;
+    size_t head;
+    char *buffer;
+    int retval;
+
+    /* Stop at the maximum number of records */
+    remaining = file->records_per_block;
+    if (read_file_st->max_records > 0) {
+        if (read_file_st->max_records - read_file_st->current_record <
+            remaining) {
+            remaining = read_file_st->max_records -
+                        read_file_st->current_record;
+        }
+        if (remaining == 0) {
+            return 0;
+        }
+    }
+
+    /* Load a block, if every record in the last one was handed out */
+    while (read_file_st->packed == NULL ||
+           read_file_st->packed_next >=
+           ATTK_PACKED_COUNT(read_file_st->packed)) {
+        retval = read_packed_load(file);
+        if (retval <= 0) {
+            return retval;
+        }
+    }
+    if (file->bytes_total > 0) {
+        __atomic_store_n(&(file->bytes_done),
+                         read_file_st->ar != NULL ||
+                         read_file_st->map != NULL ? read_file_st->pos :
+                         lseek64(read_file_st->fp, 0, SEEK_CUR),
+                         __ATOMIC_RELAXED);
+    }
+
+    /* Copy the records out, the offsets moved to follow the new header */
+    first = read_file_st->packed_next;
+    count = ATTK_PACKED_COUNT(read_file_st->packed) - first;
+    if (count > remaining) {
+        count = remaining;
+    }
+    offsets = ATTK_PACKED_OFFSETS(read_file_st->packed) + first;
+    head = ATTK_PACKED_HEADER(count);
+    buffer = malloc(head + offsets[count] - offsets[0]);
+    if (buffer == NULL) {
+        return E_ATTK_SYSTEM;
+    }
+    *buf = buffer;
+    ATTK_PACKED_COUNT(buffer) = count;
+    out_offsets = ATTK_PACKED_OFFSETS(buffer);
+    for (i = 0; i <= count; i++) {
+        out_offsets[i] = offsets[i] - offsets[0] + head;
+    }
+    memcpy(buffer + head, read_file_st->packed + offsets[0],
+           offsets[count] - offsets[0]);
+
+    /* Update number of records read */
+    read_file_st->packed_next += count;
+    read_file_st->current_record += count;
+
+    return head + offsets[count] - offsets[0];
 }
 
 /** Read in a block and return it.
@@ -233,6 +818,8 @@ int read_open_file(file_st *file) {
 ssize_t read_next_block(file_st *file, char **buf, size_t buf_size) {
     read_file_data_st *read_file_st = file->file_data;
     char *buffer;
+    uint64_t remaining;
+    ssize_t len;
 
     #ifdef DEBUG
     printf("read_next_block: START\n");
@@ -241,35 +828,68 @@ ssize_t read_next_block(file_st *file, char **buf, size_t buf_size) {
     /* Sanity check */
     assert(read_file_st->fp > 0);
 
+    if (file->flags & FILE_PACKED) {
+        return read_next_packed(file, buf);
+    }
+
+    /* Stop at the maximum number of records */
+    remaining = file->records_per_block;
+    if (read_file_st->max_records > 0) {
+        remaining = read_file_st->max_records - read_file_st->current_record;
+        if (remaining == 0) {
+            return 0;
+        }
+    }
+
     /* Calculate buffer size */
     if (buf_size == 0) {
-        if (read_file_st->max_records > 0 && read_file_st->max_records <
-            (file->records_per_block + read_file_st->current_record)) {
-            buf_size = file->record_size *
-                (read_file_st->max_records - read_file_st->current_record);
+        if (remaining < file->records_per_block) {
+            buf_size = file->record_size * remaining;
         } else {
             buf_size = file->record_size * file->records_per_block;
         }
 
+        /* Hand out the records in the mapping, whole records only */
+        if (read_file_st->map != NULL) {
+            if (read_file_st->pos >= read_file_st->map_size) {
+                return 0;
+            }
+            if (buf_size > read_file_st->map_size - read_file_st->pos) {
+                buf_size = ((read_file_st->map_size - read_file_st->pos) /
+                            file->record_size) * file->record_size;
+            }
+            *buf = read_file_st->map + read_file_st->pos;
+            read_file_st->pos += buf_size;
+            read_file_st->current_record += buf_size / file->record_size;
+            return buf_size;
+        }
+
         /* Allocate buffer */
         buffer = malloc(buf_size);
         *buf = buffer;
     } else {
+        if (read_file_st->max_records > 0 &&
+            buf_size / file->record_size > remaining) {
+            buf_size = file->record_size * remaining;
+        }
         buf_size = (buf_size / file->record_size) * file->record_size;
         buffer = *buf;
     }
 
     /* Read in record block */
-    buf_size = read(read_file_st->fp, buffer, buf_size);
+    len = read_file_read(file, buffer, buf_size);
+    if (len < 0) {
+        return len;
+    }
 
     /* Update number of records read */
-    read_file_st->current_record += buf_size / file->record_size;
+    read_file_st->current_record += len / file->record_size;
 
-    return buf_size;
+    return len;
 }
 
 /** Free a block.
- *  Frees a block that was previously read.
+ *  Frees a block that was previously read, unless it is in the mapping.
  *
  *  @param[in]  file    The file structure.
  *  @param[in]  buf     The block to free.
@@ -278,6 +898,14 @@ ssize_t read_next_block(file_st *file, char **buf, size_t buf_size) {
  *  @return             Returns 0 on success, otherwise an error code.
  */
 int read_free_block(file_st *file, char *buf, size_t buf_len) {
+    read_file_data_st *read_file_st = file->file_data;
+
+    /* Blocks in the mapping are not freed */
+    if (read_file_st->map != NULL && buf >= read_file_st->map &&
+        buf < read_file_st->map + read_file_st->map_size) {
+        return 0;
+    }
+
     /* Free the buffer */
     free(buf);
 
@@ -297,7 +925,125 @@ int read_close_file(file_st *file) {
     /* Sanity check */
     assert(read_file_st->fp > 0);
 
-    /* Close the file */
+    /* Stop reading ahead, then close the file */
+    read_ahead_close(file);
     return close(read_file_st->fp);
 }
 
+/** Seek to a record.
+ *  Moves the file pointer so the next block starts at record.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[in]  record  The record, counting from the first record after any
+ *                      skipped records.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int read_seek(file_st *file, uint64_t record) {
+    read_file_data_st *read_file_st = file->file_data;
+
+    /* Records past the end leave nothing to read */
+    if (record > file->total_records) {
+        record = file->total_records;
+    }
+
+    if (lseek64(read_file_st->fp, sizeof(read_file_header_st) +
+                (uint64_t)file->record_size *
+                (read_file_st->skip_records + record), SEEK_SET) < 0) {
+        return E_ATTK_SYSTEM;
+    }
+    read_file_st->current_record = record;
+
+    /* Read ahead, or hand out the mapping, from there */
+    read_file_st->pos = sizeof(read_file_header_st) +
+                        (uint64_t)file->record_size *
+                        (read_file_st->skip_records + record);
+    if (read_file_st->ar != NULL) {
+        read_file_st->chunk = NULL;
+        if (async_read_start(read_file_st->ar, read_file_st->pos) != 0) {
+            return E_ATTK_SYSTEM;
+        }
+    }
+
+    return 0;
+}
+
+/** Split the file.
+ *  Splits the records left to read into at most n ranges of about the same
+ *  size, each with its own read file structure and file pointer.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[in]  n       The maximum number of parts.
+ *  @param[out] parts   The parts, n pointers.
+ *
+ *  @return             Returns the number of parts, 0 if the file can not be
+ *                      split, otherwise an error code.
+ */
+int read_split(file_st *file, int n, file_st **parts) {
+    read_file_data_st *read_file_st = file->file_data;
+    read_file_data_st *part_st;
+    uint64_t count;
+    uint64_t lo;
+    uint64_t hi;
+    int i;
+
+    /* Only split a file that has not been read yet */
+    count = file->total_records;
+    if (count == 0 || read_file_st->current_record != 0) {
+        return 0;
+    }
+    if (n > count) {
+        n = count;
+    }
+
+    /* Create a reader for each part of the file */
+    for (i = 0; i < n; i++) {
+        /* The first count % n parts get a record more, count * i could
+           overflow */
+        lo = (count / n) * i + (i < count % n ? i : count % n);
+        hi = lo + count / n + (i < count % n);
+
+        parts[i] = malloc(sizeof(file_st));
+        if (parts[i] == NULL) {
+            read_free_parts(file, i, parts);
+            return E_ATTK_SYSTEM;
+        }
+        read_file_init(parts[i], file->records_per_block, file->file_path,
+                       read_file_st->description,
+                       read_file_st->skip_records + lo, hi - lo);
+        if (parts[i]->file_data == NULL) {
+            read_file_destroy(parts[i]);
+            free(parts[i]);
+            read_free_parts(file, i, parts);
+            return E_ATTK_SYSTEM;
+        }
+        read_file_read_ahead(parts[i], read_file_st->read_ahead,
+                             read_file_st->direct);
+        read_file_map(parts[i], read_file_st->map_flags);
+        if (read_file_st->map != NULL) {
+            part_st = parts[i]->file_data;
+            part_st->map = read_file_st->map;
+            part_st->map_size = read_file_st->map_size;
+            part_st->map_borrowed = 1;
+        }
+        parts[i]->first_record = file->first_record + lo;
+    }
+
+    return n;
+}
+
+/** Free split parts.
+ *  Destroys and frees the parts made by read_split.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[in]  n       The number of parts.
+ *  @param[in]  parts   The parts.
+ */
+void read_free_parts(file_st *file, int n, file_st **parts) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        read_file_destroy(parts[i]);
+        free(parts[i]);
+    }
+}
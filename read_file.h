@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include "async_read.h"
 #include "libattkthread.h"
 
 /** @addtogroup read_file
@@ -26,6 +27,22 @@
  */
 
 #define READ_FILE_MAGIC 0x11BA77AC
+#define READ_FILE_REVISION_PACKED   1   /**< The records are in packed blocks,
+                                         *   each stored as a count, then the
+                                         *   offsets, all in network order,
+                                         *   then the records.
+                                         */
+
+#define READ_FILE_MAP           0x1     /**< Map the file, fixed size blocks
+                                         *   point into the mapping.
+                                         */
+#define READ_FILE_MAP_POPULATE  0x2     /**< Fault the whole file in when it
+                                         *   is opened.
+                                         */
+#define READ_FILE_MAP_HUGE      0x4     /**< Ask for huge pages, if the file
+                                         *   system can back the mapping with
+                                         *   them.
+                                         */
 
 /** File header structure.
  *  Data at the beginning of a file.
@@ -35,7 +52,7 @@ typedef struct READ_FILE_HEADER_ST {
     char description[256];
     uint32_t file_order;
     uint16_t record_size;
-    uint16_t reserved;
+    uint16_t revision;
 } __attribute__ ((packed)) read_file_header_st;
 
 /** Read file structure.
@@ -48,16 +65,45 @@ typedef struct READ_FILE_DATA_ST {
     uint64_t skip_records;      /**< Number of records to skip.         */
     uint64_t max_records;       /**< Maximum number of records to read. */
     uint64_t current_record;    /**< Current record count.              */
+    uint64_t skip_left;         /**< Packed records left to skip.       */
+    char *packed;               /**< Packed block being handed out.     */
+    size_t packed_size;         /**< Size of the packed buffer.         */
+    uint32_t packed_next;       /**< Next packed record to hand out.    */
+    int read_ahead;             /**< Reads to keep in flight, 0 to read
+                                 *   as the blocks are asked for.
+                                 */
+    int direct;                 /**< Set to read ahead with O_DIRECT.   */
+    async_read *ar;             /**< Read ahead, NULL if not reading
+                                 *   ahead.
+                                 */
+    char *chunk;                /**< Chunk being copied from.           */
+    size_t chunk_len;           /**< Bytes in the chunk.                */
+    uint64_t chunk_offset;      /**< File offset of the chunk.          */
+    uint64_t pos;               /**< File offset of the next byte.      */
+    int map_flags;              /**< READ_FILE_MAP* flags, 0 to read.   */
+    char *map;                  /**< The mapped file, NULL if the file
+                                 *   is not mapped.
+                                 */
+    size_t map_size;            /**< Size of the mapping.               */
+    int map_borrowed;           /**< Set if the mapping is the split
+                                 *   file's, blocks are freed through
+                                 *   it.
+                                 */
 } read_file_data_st;
 
 void read_file_init(file_st *file, int records_per_block, char *file_path,
                     char *file_description, uint64_t skip_records,
                     uint64_t count_records);
 void read_file_destroy(file_st *file);
+void read_file_read_ahead(file_st *file, int reads, int direct);
+void read_file_map(file_st *file, int flags);
 int read_open_file(file_st *file);
 ssize_t read_next_block(file_st *file, char **buf, size_t buf_size);
 int read_free_block(file_st *file, char *buf, size_t buf_len);
 int read_close_file(file_st *file);
+int read_seek(file_st *file, uint64_t record);
+int read_split(file_st *file, int n, file_st **parts);
+void read_free_parts(file_st *file, int n, file_st **parts);
 
 /** @} */
 
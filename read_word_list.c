@@ -19,16 +19,21 @@
 #define _FILE_OFFSET_BITS 64
 #include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "read_word_list.h"
 
-#define BUFFSIZE    256
+#define PACKED_GUESS    16  /**< Guess at a packed word's bytes, with its 0 */
 
 /** @defgroup read_word_list read_word_list
  *
@@ -36,13 +41,172 @@
  *
  *  Read word list implements the file interface for libattkthread.  Opens a
  *  file and reads through it, processing the file as a list of words, one per
- *  line.
+ *  line.  Setting FILE_PACKED in the file's flags after it is initialized
+ *  hands out packed blocks, each word taking only its own length.
+ *
+ *  The file is read a large buffer at a time and the lines are found in
+ *  place with a vector newline scan, each word is copied once, straight into
+ *  the block.  Lines may end in CRLF, empty lines are passed over, and so
+ *  are lines too long for the record size, counted in long_lines.
+ *
+ *  A word list with an up to date line index next to it, see line_index,
+ *  knows its number of words when it is opened, and can be sought and
+ *  split.
+ */
+
+
+/** Private method that finds the next newline.
+ *  Compares 32 bytes at a time with AVX2, or 16 with SSE2, the tail is left
+ *  to memchr.
+ *
+ *  @param[in] p    Where to start looking.
+ *  @param[in] end  Where to stop looking.
+ *
+ *  @return         Returns the newline, NULL if there is none.
+ */
+static char *read_wl_newline(char *p, char *end) {
+    #if defined(__AVX2__)
+    const __m256i nl = _mm256_set1_epi8('\n');
+    unsigned int mask;
+
+    while (end - p >= 32) {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                   _mm256_loadu_si256((const __m256i *)p), nl));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    #elif defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    unsigned int mask;
+
+    while (end - p >= 16) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                   _mm_loadu_si128((const __m128i *)p), nl));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    #endif
+
+    return memchr(p, '\n', end - p);
+}
+
+
+/** Private method that gets the next line.
+ *  Finds the next line in the read buffer, reading more of the file when it
+ *  runs out.  A line longer than the whole buffer is passed over and counted
+ *  in long_lines.  The line is good until the next call.
+ *
+ *  @param[in]  read_wl_st  The read word list data.
+ *  @param[out] line        The line, without its CR or LF.
+ *  @param[out] len         The length of the line.
+ *
+ *  @return                 Returns 1 if there is a line, 0 at the end of the
+ *                          file, otherwise an error code.
+ */
+static int read_wl_next_line(read_wl_data_st *read_wl_st, char **line,
+                             size_t *len) {
+    char *buf = read_wl_st->read_buf;
+    char *start;
+    char *nl;
+    ssize_t read_len;
+
+    while (1) {
+        /* Look for the end of the line */
+        start = buf + read_wl_st->read_pos;
+        nl = read_wl_newline(buf + read_wl_st->scan_pos,
+                             buf + read_wl_st->read_len);
+        if (nl == NULL && read_wl_st->eof) {
+            /* The last line may not have a newline */
+            nl = buf + read_wl_st->read_len;
+            if (nl == start && !read_wl_st->skipping) {
+                return 0;
+            }
+        }
+        if (nl != NULL) {
+            read_wl_st->read_pos = nl - buf;
+            if (read_wl_st->read_pos < read_wl_st->read_len) {
+                read_wl_st->read_pos++;
+            }
+            read_wl_st->scan_pos = read_wl_st->read_pos;
+            if (read_wl_st->skipping) {
+                read_wl_st->skipping = 0;
+                read_wl_st->long_lines++;
+                continue;
+            }
+
+            *line = start;
+            *len = nl - start;
+            if (*len > 0 && start[*len - 1] == '\r') {
+                (*len)--;
+            }
+            return 1;
+        }
+
+        /* Move the start of the line to the front, or drop it if it fills
+           the whole buffer, then read more */
+        if (read_wl_st->read_pos == 0 &&
+            read_wl_st->read_len == read_wl_st->read_buf_size) {
+            read_wl_st->skipping = 1;
+            read_wl_st->read_len = 0;
+        } else {
+            memmove(buf, start, read_wl_st->read_len - read_wl_st->read_pos);
+            read_wl_st->read_len -= read_wl_st->read_pos;
+        }
+        read_wl_st->read_pos = 0;
+        read_wl_st->scan_pos = read_wl_st->read_len;
+        do {
+            read_len = read(read_wl_st->fd, buf + read_wl_st->read_len,
+                            read_wl_st->read_buf_size - read_wl_st->read_len);
+        } while (read_len < 0 && errno == EINTR);
+        if (read_len < 0) {
+            return E_ATTK_SYSTEM;
+        } else if (read_len == 0) {
+            read_wl_st->eof = 1;
+        }
+        read_wl_st->read_len += read_len;
+        read_wl_st->offset += read_len;
+    }
+}
+
+
+/** Private method that opens the file for reading lines.
+ *
+ *  @param[in] read_wl_st   The read word list data.
+ *  @param[in] file_path    The file's path.
+ *  @param[in] buf_size     The size of the read buffer.
+ *
+ *  @return                 Returns 0 on success, otherwise an error code.
  */
+static int read_wl_open_lines(read_wl_data_st *read_wl_st, char *file_path,
+                              size_t buf_size) {
+    read_wl_st->fd = open(file_path, O_RDONLY);
+    if (read_wl_st->fd < 0) {
+        return E_ATTK_SYSTEM;
+    }
+    posix_fadvise(read_wl_st->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    read_wl_st->read_buf = malloc(buf_size);
+    if (read_wl_st->read_buf == NULL) {
+        close(read_wl_st->fd);
+        return E_ATTK_SYSTEM;
+    }
+    read_wl_st->read_buf_size = buf_size;
+    read_wl_st->read_len = read_wl_st->read_pos = read_wl_st->scan_pos = 0;
+    read_wl_st->offset = 0;
+    read_wl_st->eof = read_wl_st->skipping = 0;
+
+    return 0;
+}
 
 
 /** Private method that finds the longest line in a file.
  *  Private method that finds the longest line in a file, does not count the
- *  newline character.  Only supports UNIX style end of line character - 0x0A.
+ *  newline character, or a CR before it.  Lines may hold any bytes,
+ *  including 0.  Lines longer than READ_WL_BUF_SIZE are not counted.
  *
  *  @param[in] file_path    The file's path.
  *
@@ -50,51 +214,37 @@
  *                          error code.
  */
 size_t find_max_line_len(char *file_path) {
-    FILE *fp = NULL;        /* File pointer         */
-    char buffer[BUFFSIZE];  /* Read buffer          */
-    size_t curr_len;        /* Current line length  */
-    size_t max_len;         /* Longest length found */
+    read_wl_data_st read_wl_st; /* Line reader          */
+    char *line;                 /* Current line         */
+    size_t curr_len;            /* Current line length  */
+    size_t max_len;             /* Longest length found */
+    int retval;
 
     /* Open the file */
-    fp = fopen(file_path, "r");
-    if (fp == NULL) {
+    if (read_wl_open_lines(&read_wl_st, file_path, READ_WL_BUF_SIZE) != 0) {
         return E_ATTK_SYSTEM;
     }
 
     /* Find the longest line */
-    max_len = curr_len = 0;
-    while (feof(fp) == 0) {
-        memset(buffer, 0, BUFFSIZE);
-        fgets(buffer, BUFFSIZE, fp);
-        curr_len += strlen(buffer);
-        if (*(buffer + strlen(buffer) - 1) == '\n') {
-            if (curr_len > max_len) {
-                max_len = curr_len - 1;
-            }
-            curr_len = 0;
-        }
-    }
-    if (*(buffer + strlen(buffer) - 1) == '\n') {
-        if (curr_len > max_len) {
-            max_len = curr_len - 1;
-        }
-        curr_len = 0;
-    } else {
+    max_len = 0;
+    while ((retval = read_wl_next_line(&read_wl_st, &line, &curr_len)) > 0) {
         if (curr_len > max_len) {
             max_len = curr_len;
         }
     }
+    free(read_wl_st.read_buf);
 
     /* Close the file */
-    fclose(fp);
+    close(read_wl_st.fd);
 
-    return max_len;
+    return retval < 0 ? (size_t)E_ATTK_SYSTEM : max_len;
 }
 
 
 /** Initializes a read word list structure.
  *  Clears a new read word list structure, copies the file path, sets the record
- *  size, and sets up its thread mutex.
+ *  size, and sets up its thread mutex.  If its private data can not be
+ *  allocated file_data is left NULL, and opening the file fails.
  *
  *  @param[in] file                 The file structure.
  *  @param[in] records_per_block    The number of records per block.
@@ -119,7 +269,10 @@ void read_word_list_init(file_st *file, char *file_path, int records_per_block,
 
     /* Create read_file_data_st */
     read_wl_st = malloc(sizeof(read_wl_data_st));
-    memset(read_wl_st, 0, sizeof(read_wl_data_st));
+    if (read_wl_st != NULL) {
+        memset(read_wl_st, 0, sizeof(read_wl_data_st));
+        read_wl_st->fd = -1;
+    }
     file->file_data = read_wl_st;
 
     /* Setup class methods */
@@ -140,6 +293,9 @@ void read_word_list_destroy(file_st *file) {
     pthread_mutex_destroy(&(file->mut));
 
     /* Destroy read_file_data_st */
+    if (file->file_data != NULL) {
+        line_index_destroy(&(((read_wl_data_st *)file->file_data)->index));
+    }
     free(file->file_data);
 }
 
@@ -152,10 +308,31 @@ void read_word_list_destroy(file_st *file) {
  */
 int read_wl_open_file(file_st *file) {
     read_wl_data_st *read_wl_st = file->file_data;
-    FILE *fp;
+    struct stat st;
+    size_t buf_size;
     int retval;
 
-    /* Set the total number of records to read */
+    if (read_wl_st == NULL) {
+        return E_ATTK_SYSTEM;
+    }
+
+    /* Use the index if every word fits a record, it knows the longest */
+    line_index_destroy(&(read_wl_st->index));
+    read_wl_st->indexed = 0;
+    if (line_index_load(&(read_wl_st->index), file->file_path) == 0) {
+        if (file->record_size == 0 &&
+            read_wl_st->index.max_len + 1 <= UINT16_MAX) {
+            file->record_size = read_wl_st->index.max_len + 1;
+        }
+        if (file->record_size > 0 &&
+            file->record_size >= read_wl_st->index.max_len + 1) {
+            read_wl_st->indexed = 1;
+        } else {
+            line_index_destroy(&(read_wl_st->index));
+        }
+    }
+
+    /* Set the record size */
     if (file->record_size == 0) {
         retval = find_max_line_len(file->file_path);
         if (retval == E_ATTK_SYSTEM) {
@@ -166,19 +343,163 @@ int read_wl_open_file(file_st *file) {
         }
     }
 
-    /* Open the file */
-    fp = fopen(file->file_path, "r");
-    if (fp == NULL) {
+    /* Open the file, the buffer holds at least two records so only lines
+       too long to be records fill it */
+    buf_size = READ_WL_BUF_SIZE;
+    if (buf_size < file->record_size * 2 + 2) {
+        buf_size = file->record_size * 2 + 2;
+    }
+    if (read_wl_open_lines(read_wl_st, file->file_path, buf_size) != 0) {
         /* Can not open file */
         return E_ATTK_SYSTEM;
     }
+    read_wl_st->long_lines = 0;
+    read_wl_st->current_word = 0;
+    file->bytes_total = file->bytes_done = 0;
+
+    /* The index counts the words, start at the first one */
+    if (read_wl_st->indexed) {
+        file->total_records = 0;
+        if (read_wl_st->index.words > read_wl_st->first_word) {
+            file->total_records = read_wl_st->index.words -
+                                  read_wl_st->first_word;
+        }
+        if (read_wl_st->max_words > 0 &&
+            read_wl_st->max_words < file->total_records) {
+            file->total_records = read_wl_st->max_words;
+        }
+        file->seek = read_wl_seek;
+        file->split = read_wl_split;
+        file->free_parts = read_wl_free_parts;
 
-    /* Save the file pointer */
-    read_wl_st->fp = fp;
+        return read_wl_seek(file, 0);
+    }
+
+    /* The number of words is not known, let the attack guess it from how
+       far through the file it is */
+    file->total_records = 0;
+    file->seek = NULL;
+    file->split = NULL;
+    file->free_parts = NULL;
+    if (fstat(read_wl_st->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        file->bytes_total = st.st_size;
+    }
 
     return 0;
 }
 
+/** Private method that gets the next word.
+ *  Passes over empty lines and lines too long for the record size, and stops
+ *  after max_words.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[out] word    The word, not 0 terminated.
+ *  @param[out] len     The length of the word.
+ *
+ *  @return             Returns 1 if there is a word, 0 at the end of the
+ *                      file, otherwise an error code.
+ */
+static int read_wl_next_word(file_st *file, char **word, size_t *len) {
+    read_wl_data_st *read_wl_st = file->file_data;
+    int retval;
+
+    if (read_wl_st->max_words > 0 &&
+        read_wl_st->current_word >= read_wl_st->max_words) {
+        return 0;
+    }
+
+    while ((retval = read_wl_next_line(read_wl_st, word, len)) > 0) {
+        if (*len == 0) {
+            continue;
+        }
+        if (*len + 1 > file->record_size) {
+            read_wl_st->long_lines++;
+            continue;
+        }
+        read_wl_st->current_word++;
+        break;
+    }
+
+    return retval;
+}
+
+/** Private method that updates how far through the file the reads are.
+ *
+ *  @param[in] file The file structure.
+ */
+static void read_wl_bytes_done(file_st *file) {
+    read_wl_data_st *read_wl_st = file->file_data;
+
+    if (file->bytes_total > 0) {
+        __atomic_store_n(&(file->bytes_done), read_wl_st->offset -
+                         (read_wl_st->read_len - read_wl_st->read_pos),
+                         __ATOMIC_RELAXED);
+    }
+}
+
+/** Private method that reads in a packed block.
+ *  Reads up to records_per_block words into a new packed block, growing it
+ *  as the words need.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[out] buf     The block to return.
+ *
+ *  @return             Returns the number of bytes of the block used,
+ *                      otherwise an error code.
+ */
+static ssize_t read_wl_next_packed(file_st *file, char **buf) {
+    char *buffer;
+    char *word;
+    uint32_t *offsets;
+    uint32_t count = 0;
+    size_t used;
+    size_t buf_size;
+    size_t len;
+    int retval;
+
+    /* Allocate the block, with the whole header up front */
+    used = ATTK_PACKED_HEADER(file->records_per_block);
+    buf_size = used + file->records_per_block * PACKED_GUESS;
+    buffer = malloc(buf_size);
+    if (buffer == NULL) {
+        return E_ATTK_SYSTEM;
+    }
+    *buf = buffer;
+
+    /* Read in words */
+    while (count < (uint32_t)file->records_per_block) {
+        retval = read_wl_next_word(file, &word, &len);
+        if (retval < 0) {
+            return retval;
+        } else if (retval == 0) {
+            /* End of File */
+            break;
+        }
+
+        /* Grow the block if the word does not fit, then add it */
+        if (used + len + 1 > buf_size) {
+            buf_size = buf_size * 2 + len + 1;
+            buffer = realloc(*buf, buf_size);
+            if (buffer == NULL) {
+                return E_ATTK_SYSTEM;
+            }
+            *buf = buffer;
+        }
+        ATTK_PACKED_OFFSETS(buffer)[count++] = used;
+        memcpy(buffer + used, word, len);
+        buffer[used + len] = '\0';
+        used += len + 1;
+    }
+    read_wl_bytes_done(file);
+
+    /* Fill in the header */
+    offsets = ATTK_PACKED_OFFSETS(buffer);
+    offsets[count] = used;
+    ATTK_PACKED_COUNT(buffer) = count;
+
+    return count > 0 ? (ssize_t)used : 0;
+}
+
 /** Read in a block and return it.
  *  Reads in a block of data and allocates it into a buffer.
  *
@@ -192,11 +513,17 @@ int read_wl_open_file(file_st *file) {
 ssize_t read_wl_next_block(file_st *file, char **buf, size_t buf_size) {
     read_wl_data_st *read_wl_st = file->file_data;
     char *buffer;
-    char *read_buf;
+    char *word;
     char *curr_buf_p;
+    size_t len;
+    int retval;
 
     /* Sanity check */
-    assert(read_wl_st->fp != NULL);
+    assert(read_wl_st->fd >= 0);
+
+    if (file->flags & FILE_PACKED) {
+        return read_wl_next_packed(file, buf);
+    }
 
     if (buf_size == 0) {
         /* Calculate buffer size */
@@ -210,32 +537,22 @@ ssize_t read_wl_next_block(file_st *file, char **buf, size_t buf_size) {
         buffer = *buf;
     }
 
-    /* Allocate read buffer */
-    read_buf = malloc(file->record_size + 1);
-
-    /* Read in words */
+    /* Read in words, each padded out to the record size with 0s */
     curr_buf_p = buffer;
     while (curr_buf_p < (buffer + buf_size)) {
-        /* End of File */
-        if (feof(read_wl_st->fp)) {
+        retval = read_wl_next_word(file, &word, &len);
+        if (retval < 0) {
+            return retval;
+        } else if (retval == 0) {
+            /* End of File */
             break;
         }
 
-        /* Read in next line and add it to the return buffer */
-        memset(read_buf, 0, file->record_size + 1);
-        fgets(read_buf, file->record_size + 1, read_wl_st->fp);
-        if (read_buf[strlen(read_buf) - 1] != '\n' && !feof(read_wl_st->fp)) {
-            return E_ATTK_RECORD_SIZE_INVALID;
-        }
-        read_buf[strlen(read_buf) - 1] = '\0';
-        if (strlen(read_buf) > 0) {
-            memcpy(curr_buf_p, read_buf, file->record_size);
-            curr_buf_p += file->record_size;
-        }
+        memcpy(curr_buf_p, word, len);
+        memset(curr_buf_p + len, 0, file->record_size - len);
+        curr_buf_p += file->record_size;
     }
-
-    /* Free read buffer */
-    free(read_buf);
+    read_wl_bytes_done(file);
 
     return curr_buf_p - buffer;
 }
@@ -265,11 +582,148 @@ int read_wl_free_block(file_st *file, char *buf, size_t buf_len) {
  */
 int read_wl_close_file(file_st *file) {
     read_wl_data_st *read_wl_st = file->file_data;
+    int retval;
 
     /* Sanity check */
-    assert(read_wl_st->fp != NULL);
+    assert(read_wl_st->fd >= 0);
+
+    /* Free the read buffer */
+    free(read_wl_st->read_buf);
+    read_wl_st->read_buf = NULL;
+
+    /* Drop the index */
+    line_index_destroy(&(read_wl_st->index));
+    read_wl_st->indexed = 0;
 
     /* Close the file */
-    return fclose(read_wl_st->fp);
+    retval = close(read_wl_st->fd);
+    read_wl_st->fd = -1;
+
+    return retval;
 }
 
+/** Seek to a word.
+ *  Moves to the index's sample at or before the word, then passes over the
+ *  words up to it.  Only set as the file's seek for an indexed word list.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[in]  record  The word, counting from the first word of the part.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int read_wl_seek(file_st *file, uint64_t record) {
+    read_wl_data_st *read_wl_st = file->file_data;
+    uint64_t offset;
+    uint64_t word;
+    char *line;
+    size_t len;
+    int retval;
+
+    /* Words past the end leave nothing to read */
+    if (record > file->total_records) {
+        record = file->total_records;
+    }
+
+    /* Go to the sample, dropping what was read ahead */
+    word = line_index_find(&(read_wl_st->index),
+                           read_wl_st->first_word + record, &offset);
+    if (lseek(read_wl_st->fd, offset, SEEK_SET) < 0) {
+        return E_ATTK_SYSTEM;
+    }
+    read_wl_st->read_len = read_wl_st->read_pos = read_wl_st->scan_pos = 0;
+    read_wl_st->offset = offset;
+    read_wl_st->eof = read_wl_st->skipping = 0;
+
+    /* Pass over the words before it */
+    while (word < read_wl_st->first_word + record) {
+        retval = read_wl_next_line(read_wl_st, &line, &len);
+        if (retval < 0) {
+            return retval;
+        } else if (retval == 0) {
+            /* The index does not match the word list */
+            return E_ATTK_FILE_INVALID;
+        }
+        if (len > 0) {
+            word++;
+        }
+    }
+    read_wl_st->current_word = record;
+
+    return 0;
+}
+
+/** Split the file.
+ *  Splits the words left to read into at most n ranges of about the same
+ *  size, each with its own read word list structure.  Only set as the
+ *  file's split for an indexed word list, each part loads the index again
+ *  when it is opened.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[in]  n       The maximum number of parts.
+ *  @param[out] parts   The parts, n pointers.
+ *
+ *  @return             Returns the number of parts, 0 if the file can not be
+ *                      split, otherwise an error code.
+ */
+int read_wl_split(file_st *file, int n, file_st **parts) {
+    read_wl_data_st *read_wl_st = file->file_data;
+    read_wl_data_st *part_st;
+    uint64_t count;
+    uint64_t lo;
+    uint64_t hi;
+    int i;
+
+    /* Only split a word list that has not been read yet */
+    count = file->total_records;
+    if (count == 0 || read_wl_st->current_word != 0) {
+        return 0;
+    }
+    if (n > count) {
+        n = count;
+    }
+
+    /* Create a reader for each part of the word list */
+    for (i = 0; i < n; i++) {
+        /* The first count % n parts get a word more, count * i could
+           overflow */
+        lo = (count / n) * i + (i < count % n ? i : count % n);
+        hi = lo + count / n + (i < count % n);
+
+        parts[i] = malloc(sizeof(file_st));
+        if (parts[i] == NULL) {
+            read_wl_free_parts(file, i, parts);
+            return E_ATTK_SYSTEM;
+        }
+        read_word_list_init(parts[i], file->file_path,
+                            file->records_per_block, file->record_size);
+        if (parts[i]->file_data == NULL) {
+            read_word_list_destroy(parts[i]);
+            free(parts[i]);
+            read_wl_free_parts(file, i, parts);
+            return E_ATTK_SYSTEM;
+        }
+        parts[i]->flags = file->flags;
+        parts[i]->first_record = file->first_record + lo;
+        part_st = parts[i]->file_data;
+        part_st->first_word = read_wl_st->first_word + lo;
+        part_st->max_words = hi - lo;
+    }
+
+    return n;
+}
+
+/** Free split parts.
+ *  Destroys and frees the parts made by read_wl_split.
+ *
+ *  @param[in]  file    The file structure.
+ *  @param[in]  n       The number of parts.
+ *  @param[in]  parts   The parts.
+ */
+void read_wl_free_parts(file_st *file, int n, file_st **parts) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        read_word_list_destroy(parts[i]);
+        free(parts[i]);
+    }
+}
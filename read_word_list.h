@@ -20,16 +20,45 @@
 #include <stdint.h>
 
 #include "libattkthread.h"
+#include "line_index.h"
 
 /** @addtogroup read_word_list
  *  @{
  */
 
+#define READ_WL_BUF_SIZE    (1 << 20)   /**< Bytes read from the file at a
+                                         *   time, at least two records.
+                                         */
+
 /** Read file structure.
  *  Private data used by read_word_list.
  */
 typedef struct READ_WL_DATA_ST {
-    FILE *fp;   /**< File pointer. */
+    int fd;             /**< File descriptor.                */
+    char *read_buf;     /**< Read buffer, lines are parsed in
+                         *   place.
+                         */
+    size_t read_buf_size; /**< Size of the read buffer.      */
+    size_t read_len;    /**< Bytes in the read buffer.       */
+    size_t read_pos;    /**< Start of the next line.         */
+    size_t scan_pos;    /**< Where to look for its newline.  */
+    uint64_t offset;    /**< File offset of the end of the
+                         *   bytes in the read buffer.
+                         */
+    int eof;            /**< Set at the end of the file.     */
+    int skipping;       /**< Set while passing over a line
+                         *   longer than the read buffer.
+                         */
+    uint64_t long_lines; /**< Lines too long for record_size,
+                          *   passed over.
+                          */
+    line_index index;   /**< The word list's index.          */
+    int indexed;        /**< Set if the index is loaded and
+                         *   every word fits a record.
+                         */
+    uint64_t first_word; /**< First word to read, set by split. */
+    uint64_t max_words; /**< Words to read, 0 for all.       */
+    uint64_t current_word; /**< Words read, from first_word.  */
 } read_wl_data_st;
 
 void read_word_list_init(file_st *file, char *file_path, int records_per_block,
@@ -39,6 +68,9 @@ int read_wl_open_file(file_st *file);
 ssize_t read_wl_next_block(file_st *file, char **buf, size_t buf_size);
 int read_wl_free_block(file_st *file, char *buf, size_t buf_len);
 int read_wl_close_file(file_st *file);
+int read_wl_seek(file_st *file, uint64_t record);
+int read_wl_split(file_st *file, int n, file_st **parts);
+void read_wl_free_parts(file_st *file, int n, file_st **parts);
 
 /** @} */
 
@@ -0,0 +1,279 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "result_store.h"
+
+/** @defgroup result_store result_store
+ *
+ *  An append-only result store.
+ *
+ *  A result store keeps every result added to it, in the order the slots
+ *  were handed out.  Writers claim a slot with a single atomic add, fill it,
+ *  then mark it ready.  Chunk k holds RESULT_STORE_FIRST_CHUNK << k slots and
+ *  is allocated by whichever writer needs it first.
+ */
+
+/** Private method that finds a slot's chunk.
+ *
+ *  @param[in]  slot    The slot number.
+ *  @param[out] offset  The slot's position in its chunk.
+ *  @param[out] size    The number of slots in the chunk.
+ *
+ *  @return             Returns the chunk number.
+ */
+static int result_store_chunk(uint64_t slot, uint64_t *offset,
+                              uint64_t *size) {
+    uint64_t n = slot / RESULT_STORE_FIRST_CHUNK + 1;
+    int chunk = 63 - __builtin_clzll(n);
+
+    *size = (uint64_t)RESULT_STORE_FIRST_CHUNK << chunk;
+    *offset = slot - (*size - RESULT_STORE_FIRST_CHUNK);
+
+    return chunk;
+}
+
+
+/** Private method that gets a chunk, allocating it if needed.
+ *  Writers racing to allocate the same chunk all allocate one, the first to
+ *  publish it wins and the others free theirs.
+ *
+ *  @param[in] store    The result store.
+ *  @param[in] chunk    The chunk number.
+ *  @param[in] size     The number of slots in the chunk.
+ *
+ *  @return             Returns the chunk, NULL on error.
+ */
+static char *result_store_alloc(result_store *store, int chunk,
+                                uint64_t size) {
+    char *expected = NULL;
+    char *block;
+
+    block = __atomic_load_n(&(store->chunks[chunk]), __ATOMIC_ACQUIRE);
+    if (block != NULL) {
+        return block;
+    }
+
+    /* Slot states, then the result data when it is kept in memory */
+    block = calloc(1, size + (store->fd < 0 ? size * store->record_size : 0));
+    if (block == NULL) {
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(&(store->chunks[chunk]), &expected, block,
+                                     0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* Someone else got there first */
+        free(block);
+        block = expected;
+    }
+
+    return block;
+}
+
+
+/** Initializes a result store.
+ *  Clears a new result store, and creates its spill file if it has one.
+ *  Nothing else is allocated until results are added.
+ *
+ *  @param[in] store        The result store to initialize.
+ *  @param[in] record_size  The size of each result.
+ *  @param[in] limit        Most results to store, 0 for no limit.
+ *  @param[in] path         The file to spill results to, it is truncated.
+ *                          NULL to keep results in memory.
+ *
+ *  @return                 Returns 0 on success, otherwise an error code.
+ */
+int result_store_init(result_store *store, size_t record_size, uint64_t limit,
+                      const char *path) {
+    /* Clear the structure */
+    memset(store, 0, sizeof(result_store));
+
+    /* Set defaults */
+    store->record_size = record_size;
+    store->limit = limit;
+    store->fd = -1;
+    if (path != NULL) {
+        store->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (store->fd < 0) {
+            return RESULT_STORE_E_SYSTEM;
+        }
+    }
+
+    return 0;
+}
+
+
+/** Destroys a result store.
+ *  Frees every chunk and closes the spill file, which is left in place.
+ *  Nothing may be adding results.
+ *
+ *  @param[in] store    The result store to destroy.
+ */
+void result_store_destroy(result_store *store) {
+    int i;
+
+    for (i = 0; i < RESULT_STORE_CHUNKS; i++) {
+        free(store->chunks[i]);
+    }
+    if (store->fd >= 0) {
+        close(store->fd);
+    }
+
+    /* Clear the structure */
+    memset(store, 0, sizeof(result_store));
+    store->fd = -1;
+}
+
+
+/** Add a result.
+ *  Claims the next slot and fills it.  If the result can not be written the
+ *  slot is marked lost, so readers skip it.
+ *
+ *  @param[in] store    The result store.
+ *  @param[in] record   The result, record_size bytes.
+ *
+ *  @return             Returns the number of the slot it was stored in,
+ *                      counting from 1, otherwise an error code.
+ */
+int64_t result_store_add(result_store *store, const char *record) {
+    uint64_t slot;
+    uint64_t offset;
+    uint64_t size;
+    char *block;
+    int chunk;
+    ssize_t written;
+
+    /* Claim a slot */
+    slot = __atomic_fetch_add(&(store->next), 1, __ATOMIC_RELAXED);
+    if (store->limit > 0 && slot >= store->limit) {
+        return RESULT_STORE_E_FULL;
+    }
+    chunk = result_store_chunk(slot, &offset, &size);
+    if (chunk >= RESULT_STORE_CHUNKS) {
+        return RESULT_STORE_E_FULL;
+    }
+    block = result_store_alloc(store, chunk, size);
+    if (block == NULL) {
+        /* Nowhere to mark the slot lost, readers stop here */
+        return RESULT_STORE_E_SYSTEM;
+    }
+
+    /* Fill it */
+    if (store->fd < 0) {
+        memcpy(block + size + offset * store->record_size, record,
+               store->record_size);
+    } else {
+        written = pwrite(store->fd, record, store->record_size,
+                         slot * store->record_size);
+        if (written != (ssize_t)store->record_size) {
+            if (written >= 0) {
+                errno = EIO;
+            }
+            __atomic_store_n(&(block[offset]), RESULT_STORE_SLOT_LOST,
+                             __ATOMIC_RELEASE);
+            return RESULT_STORE_E_SYSTEM;
+        }
+    }
+
+    /* Publish it */
+    __atomic_store_n(&(block[offset]), RESULT_STORE_SLOT_READY,
+                     __ATOMIC_RELEASE);
+    __atomic_add_fetch(&(store->count), 1, __ATOMIC_RELAXED);
+
+    return slot + 1;
+}
+
+
+/** Get a result.
+ *  Copies the result in a slot.
+ *
+ *  @param[in]  store   The result store.
+ *  @param[in]  slot    The slot number, counting from 0.
+ *  @param[out] buf     Buffer for the result, record_size bytes.
+ *
+ *  @return             Returns 0 on success, RESULT_STORE_E_EMPTY if the slot
+ *                      is not filled yet, RESULT_STORE_E_LOST if its result
+ *                      was lost, otherwise an error code.
+ */
+int result_store_get(result_store *store, uint64_t slot, char *buf) {
+    uint64_t offset;
+    uint64_t size;
+    char *block;
+    int chunk;
+    char state;
+
+    chunk = result_store_chunk(slot, &offset, &size);
+    if (chunk >= RESULT_STORE_CHUNKS) {
+        return RESULT_STORE_E_EMPTY;
+    }
+    block = __atomic_load_n(&(store->chunks[chunk]), __ATOMIC_ACQUIRE);
+    if (block == NULL) {
+        return RESULT_STORE_E_EMPTY;
+    }
+
+    state = __atomic_load_n(&(block[offset]), __ATOMIC_ACQUIRE);
+    if (state == RESULT_STORE_SLOT_LOST) {
+        return RESULT_STORE_E_LOST;
+    } else if (state != RESULT_STORE_SLOT_READY) {
+        return RESULT_STORE_E_EMPTY;
+    }
+
+    /* Copy it out */
+    if (store->fd < 0) {
+        memcpy(buf, block + size + offset * store->record_size,
+               store->record_size);
+    } else if (pread(store->fd, buf, store->record_size,
+                     slot * store->record_size) !=
+               (ssize_t)store->record_size) {
+        return RESULT_STORE_E_SYSTEM;
+    }
+
+    return 0;
+}
+
+
+/** Get the number of slots handed out.
+ *  Slots below this number are filled, lost, or about to be filled.
+ *
+ *  @param[in] store    The result store.
+ *
+ *  @return             Returns the number of slots handed out.
+ */
+uint64_t result_store_slots(result_store *store) {
+    uint64_t slots = __atomic_load_n(&(store->next), __ATOMIC_ACQUIRE);
+
+    if (store->limit > 0 && slots > store->limit) {
+        slots = store->limit;
+    }
+
+    return slots;
+}
+
+
+/** Get the number of results stored.
+ *
+ *  @param[in] store    The result store.
+ *
+ *  @return             Returns the number of results stored.
+ */
+uint64_t result_store_count(result_store *store) {
+    return __atomic_load_n(&(store->count), __ATOMIC_RELAXED);
+}
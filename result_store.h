@@ -0,0 +1,88 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+
+#ifndef RESULT_STORE_H
+#define RESULT_STORE_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "queue.h"
+
+/** @addtogroup result_store
+ *  @{
+ */
+
+#define RESULT_STORE_FIRST_CHUNK 1024   /**< Records in the first chunk, each
+                                         *   chunk after holds twice as many.
+                                         */
+#define RESULT_STORE_CHUNKS      40     /**< Most chunks a store can have.    */
+
+/*** Slot states ***/
+#define RESULT_STORE_SLOT_EMPTY  0      /**< The slot is not filled yet.      */
+#define RESULT_STORE_SLOT_READY  1      /**< The slot holds a result.         */
+#define RESULT_STORE_SLOT_LOST   2      /**< The slot's result could not be
+                                         *   stored.
+                                         */
+
+/*** Errors ***/
+#define RESULT_STORE_E_SYSTEM   -1      /**< A system error occurred, check
+                                         *   errno.
+                                         */
+#define RESULT_STORE_E_FULL     -2      /**< The store is at its limit.       */
+#define RESULT_STORE_E_EMPTY    -3      /**< The slot is not filled yet.      */
+#define RESULT_STORE_E_LOST     -4      /**< The slot's result was lost.      */
+
+/** A result store structure.
+ *  An append-only store of equally sized results.  Adding a result takes no
+ *  locks, each one gets its own slot, numbered in the order they were added.
+ *  Slots live in chunks that double in size and are never moved, so readers
+ *  can read filled slots while results are still being added.  Result data is
+ *  kept in the chunks, or spilled to a file.
+ */
+typedef struct RESULT_STORE {
+    uint64_t next
+        __attribute__ ((aligned (CACHE_LINE_SIZE))); /**< Next slot to fill. */
+    uint64_t count
+        __attribute__ ((aligned (CACHE_LINE_SIZE))); /**< Results stored.    */
+    char *chunks[RESULT_STORE_CHUNKS]
+        __attribute__ ((aligned (CACHE_LINE_SIZE))); /**< Each chunk's slot
+                                                      *   states, followed by
+                                                      *   its result data when
+                                                      *   kept in memory.
+                                                      */
+    size_t record_size;         /**< The size of each result.                 */
+    uint64_t limit;             /**< Most results to store, 0 for no limit.   */
+    int fd;                     /**< The spill file, -1 to keep results in
+                                 *   memory.
+                                 */
+} result_store;
+
+int result_store_init(result_store *store, size_t record_size, uint64_t limit,
+                      const char *path);
+void result_store_destroy(result_store *store);
+int64_t result_store_add(result_store *store, const char *record);
+int result_store_get(result_store *store, uint64_t slot, char *buf);
+uint64_t result_store_slots(result_store *store);
+uint64_t result_store_count(result_store *store);
+
+/** @} */
+
+#endif      /* RESULT_STORE_H */
@@ -0,0 +1,122 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * An example worker, brute forces the units an attk_coordinator leases to
+ * it, looking for a target string.  Run several to spread the work.
+ *
+ * Usage: attk_bf_worker address start end alphabet target [threads]
+ *        attk_bf_worker count start end alphabet
+ *
+ * The second form prints the number of records to give attk_coordinator.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../brute_force.h"
+#include "../distribute.h"
+
+#define WORKER_BLOCK    1024
+
+struct worker_args {
+    char *start;
+    char *end;
+    char *alphabet;
+    char *target;
+    int threads;
+};
+
+static int worker_check(char *record, size_t record_size, char *ret_record,
+                        size_t return_size, void *attack_data) {
+    if (strcmp(record, (char *)attack_data) == 0) {
+        return 0;
+    }
+    return E_ATTK_RECORD_NO_MATCH;
+}
+
+static int worker_setup(attack_st *attk_st, file_st *file_in, uint64_t first,
+                        uint64_t count, void *data) {
+    struct worker_args *args = data;
+    int retval;
+
+    retval = brute_force_init(file_in, WORKER_BLOCK, args->start, args->end,
+                              args->alphabet);
+    if (retval != 0) {
+        return retval;
+    }
+    retval = brute_force_range(file_in, first, count);
+    if (retval != 0) {
+        brute_force_destroy(file_in);
+        return retval;
+    }
+    return attack_st_init(attk_st, file_in, NULL, args->threads,
+                          worker_check, NULL, NULL, args->target);
+}
+
+static void worker_teardown(attack_st *attk_st, file_st *file_in,
+                            void *data) {
+    attack_st_destroy(attk_st);
+    brute_force_destroy(file_in);
+}
+
+int main(int argc, char **argv) {
+    struct worker_args args;
+    dist_worker worker;
+    file_st file;
+    int retval;
+
+    if (argc == 5 && strcmp(argv[1], "count") == 0) {
+        if (brute_force_init(&file, WORKER_BLOCK, argv[2], argv[3],
+                             argv[4]) != 0 ||
+            bf_open_file(&file) != 0) {
+            fprintf(stderr, "%s: invalid range\n", argv[0]);
+            return 1;
+        }
+        printf("%lu\n", (unsigned long)file.total_records);
+        bf_close_file(&file);
+        brute_force_destroy(&file);
+        return 0;
+    } else if (argc < 6) {
+        fprintf(stderr, "Usage: %s address start end alphabet target "
+                "[threads]\n       %s count start end alphabet\n", argv[0],
+                argv[0]);
+        return 1;
+    }
+
+    args.start = argv[2];
+    args.end = argv[3];
+    args.alphabet = argv[4];
+    args.target = argv[5];
+    args.threads = argc > 6 ? atoi(argv[6]) : 4;
+
+    if (dist_worker_init(&worker, worker_setup, worker_teardown,
+                         &args) != 0) {
+        return 1;
+    }
+    retval = dist_worker_run(&worker, argv[1]);
+    printf("units=%lu tested=%lu\n", (unsigned long)worker.units_done,
+           (unsigned long)worker.records_tested);
+    if (worker.result != NULL) {
+        printf("result=%.*s\n", (int)strnlen(worker.result,
+                                             worker.result_size),
+               worker.result);
+    }
+    dist_worker_destroy(&worker);
+
+    return retval == 0 ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Leases the records of an input to workers until one finds the answer or
+ * every unit is done.  Stops every worker on SIGINT or SIGTERM.
+ *
+ * Usage: attk_coordinator address records [unit_records] [lease_ms]
+ *
+ *   address       - unix:PATH or [tcp:]HOST:PORT to listen on.
+ *   records       - records in the input, see attk_bf_worker count.
+ *   unit_records  - records per unit, default 1000000.
+ *   lease_ms      - milliseconds a worker may go quiet, default 30000.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../distribute.h"
+
+#define COORD_UNIT_RECORDS  1000000
+
+static dist_coordinator coord;
+
+static void coord_signal(int sig) {
+    dist_coordinator_stop(&coord);
+}
+
+int main(int argc, char **argv) {
+    struct sigaction sa;
+    uint64_t records;
+    uint64_t unit_records;
+    uint32_t lease_ms;
+    int retval;
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s address records [unit_records] "
+                "[lease_ms]\n", argv[0]);
+        return 1;
+    }
+    records = strtoull(argv[2], NULL, 10);
+    unit_records = argc > 3 ? strtoull(argv[3], NULL, 10) :
+                              COORD_UNIT_RECORDS;
+    lease_ms = argc > 4 ? strtoul(argv[4], NULL, 10) : 0;
+
+    retval = dist_coordinator_init(&coord, argv[1], records, unit_records,
+                                   lease_ms);
+    if (retval != 0) {
+        fprintf(stderr, "%s: can not listen on %s (%d)\n", argv[0], argv[1],
+                retval);
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = coord_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    retval = dist_coordinator_run(&coord);
+    printf("records=%lu done=%lu tested=%lu units=%lu expired=%lu\n",
+           (unsigned long)records, (unsigned long)coord.records_done,
+           (unsigned long)coord.records_tested,
+           (unsigned long)coord.units_done,
+           (unsigned long)coord.units_expired);
+    if (coord.result != NULL) {
+        printf("result=%.*s\n", (int)strnlen(coord.result, coord.result_size),
+               coord.result);
+    }
+
+    dist_coordinator_destroy(&coord);
+    return retval == 0 ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Builds the line index read_word_list picks up, so a word list's words are
+ * counted up front and it can be sought and split between producers.
+ *
+ * Usage: attk_line_index word_list [stride] [threads]
+ *
+ * The index is written next to the word list, as word_list.idx.  Build it
+ * again if the word list changes, an index for an older list is not used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../line_index.h"
+
+int main(int argc, char **argv) {
+    line_index idx;
+    uint32_t stride;
+    int threads;
+
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s word_list [stride] [threads]\n", argv[0]);
+        return 1;
+    }
+    stride = argc > 2 ? strtoul(argv[2], NULL, 10) : LINE_INDEX_STRIDE;
+    threads = argc > 3 ? atoi(argv[3]) : 0;
+
+    if (line_index_build(&idx, argv[1], stride, threads) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (line_index_save(&idx, argv[1]) != 0) {
+        perror(argv[1]);
+        line_index_destroy(&idx);
+        return 1;
+    }
+    printf("words=%lu samples=%lu stride=%u max_len=%u\n",
+           (unsigned long)idx.words, (unsigned long)idx.count, idx.stride,
+           idx.max_len);
+    line_index_destroy(&idx);
+
+    return 0;
+}
@@ -0,0 +1,230 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "topology.h"
+
+/** @defgroup topology topology
+ *
+ *  CPU and NUMA node layout.
+ *
+ *  Topology reads which CPUs belong to which NUMA node from sysfs, so worker
+ *  threads can be pinned close together or spread across nodes, and memory
+ *  can be placed on the node that will use it.  Machines without NUMA
+ *  information are treated as a single node.
+ */
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1    /**< mbind mode, prefer the given node. */
+#endif
+
+/** Private method that reads a node's CPU list.
+ *  Parses a sysfs CPU list such as "0-3,8-11" and adds each CPU that is also
+ *  in allowed to the topology, then clears it from allowed.
+ *
+ *  @param[in]     topo     The topology.
+ *  @param[in]     path     The CPU list file.
+ *  @param[in,out] allowed  The usable CPUs not yet in the topology.
+ *
+ *  @return             Returns the number of CPUs added, otherwise an error
+ *                      code.
+ */
+static int topology_read_cpulist(topology *topo, char *path,
+                                 cpu_set_t *allowed) {
+    FILE *fp;
+    char line[4096];
+    char *p;
+    char *end;
+    long first;
+    long last;
+    int added = 0;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return TOPOLOGY_E_SYSTEM;
+    }
+    if (fgets(line, sizeof(line), fp) == NULL) {
+        line[0] = '\0';
+    }
+    fclose(fp);
+
+    /* Walk the ranges */
+    p = line;
+    while (*p != '\0' && *p != '\n') {
+        first = last = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            p = end;
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++) {
+            if (CPU_ISSET(first, allowed)) {
+                /* A CPU only goes in the first node that lists it */
+                CPU_CLR(first, allowed);
+                topo->cpus[topo->cpu_count++] = first;
+                added++;
+            }
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+
+    return added;
+}
+
+/** Initializes a topology.
+ *  Finds the usable CPUs and the NUMA node each one is on.
+ *
+ *  @param[in] topo     The topology to initialize.
+ *  @param[in] allowed  The CPUs that may be used, NULL for the CPUs this
+ *                      process may run on.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int topology_init(topology *topo, cpu_set_t *allowed) {
+    cpu_set_t process_cpus;
+    cpu_set_t unplaced;
+    char path[256];
+    int added;
+    int i;
+
+    /* Clear the structure */
+    memset(topo, 0, sizeof(topology));
+
+    /* Default to the process's CPUs */
+    if (allowed == NULL) {
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &process_cpus) != 0) {
+            return TOPOLOGY_E_SYSTEM;
+        }
+        allowed = &process_cpus;
+    }
+    if (CPU_COUNT(allowed) == 0) {
+        errno = EINVAL;
+        return TOPOLOGY_E_SYSTEM;
+    }
+    topo->cpus = malloc(sizeof(int) * CPU_COUNT(allowed));
+    if (topo->cpus == NULL) {
+        return TOPOLOGY_E_SYSTEM;
+    }
+    memcpy(&unplaced, allowed, sizeof(cpu_set_t));
+
+    /* Group the CPUs by node */
+    for (i = 0; i < TOPOLOGY_MAX_NODES; i++) {
+        snprintf(path, sizeof(path), TOPOLOGY_NODE_PATH "/node%i/cpulist", i);
+        topo->node_first[topo->node_count] = topo->cpu_count;
+        added = topology_read_cpulist(topo, path, &unplaced);
+        if (added > 0) {
+            topo->node_ids[topo->node_count] = i;
+            topo->node_cpus[topo->node_count] = added;
+            topo->node_count++;
+        }
+    }
+
+    /* No NUMA information, one node with every CPU */
+    if (topo->node_count == 0) {
+        for (i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, allowed)) {
+                topo->cpus[topo->cpu_count++] = i;
+            }
+        }
+        topo->node_ids[0] = 0;
+        topo->node_first[0] = 0;
+        topo->node_cpus[0] = topo->cpu_count;
+        topo->node_count = 1;
+    }
+
+    return 0;
+}
+
+
+/** Destroys a topology.
+ *
+ *  @param[in] topo The topology to destroy.
+ */
+void topology_destroy(topology *topo) {
+    free(topo->cpus);
+    memset(topo, 0, sizeof(topology));
+}
+
+
+/** Place a worker.
+ *  Picks the CPU for a worker.  Compact placement fills one node's CPUs
+ *  before moving on to the next node, spread placement puts each worker on
+ *  the next node in turn.
+ *
+ *  @param[in]  topo    The topology.
+ *  @param[in]  worker  The worker's number.
+ *  @param[in]  spread  Set to spread workers across nodes.
+ *  @param[out] cpu     The worker's CPU.
+ *  @param[out] node    The worker's node, numbered from 0.
+ */
+void topology_place(topology *topo, int worker, int spread, int *cpu,
+                    int *node) {
+    int index;
+    int n;
+
+    if (spread) {
+        n = worker % topo->node_count;
+        index = topo->node_first[n] +
+                (worker / topo->node_count) % topo->node_cpus[n];
+    } else {
+        index = worker % topo->cpu_count;
+        n = 0;
+        while (index >= topo->node_first[n] + topo->node_cpus[n]) {
+            n++;
+        }
+    }
+
+    *cpu = topo->cpus[index];
+    *node = n;
+}
+
+
+/** Bind memory to a node.
+ *  Asks the kernel to place the pages of a range on a NUMA node when they are
+ *  first touched.  It is only a preference, the kernel may still use another
+ *  node.
+ *
+ *  @param[in] addr     The start of the range, page aligned.
+ *  @param[in] len      The length of the range.
+ *  @param[in] node_id  The system's node number.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int topology_bind(void *addr, size_t len, int node_id) {
+    unsigned long mask[TOPOLOGY_MAX_NODES / (8 * sizeof(unsigned long))];
+
+    memset(mask, 0, sizeof(mask));
+    mask[node_id / (8 * sizeof(unsigned long))] |=
+        1UL << (node_id % (8 * sizeof(unsigned long)));
+
+    return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask,
+                   TOPOLOGY_MAX_NODES + 1, 0) == 0 ? 0 : TOPOLOGY_E_SYSTEM;
+}
@@ -0,0 +1,65 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/** @addtogroup topology
+ *  @{
+ */
+
+#define TOPOLOGY_MAX_NODES  64  /**< Highest NUMA node number looked for.     */
+#define TOPOLOGY_NODE_PATH  "/sys/devices/system/node" /**< Where the kernel
+                                                        *   lists NUMA nodes.
+                                                        */
+
+/*** Errors ***/
+#define TOPOLOGY_E_SYSTEM   -1  /**< A system error occurred, check errno.    */
+
+/** A CPU topology structure.
+ *  The CPUs a process may use, grouped by NUMA node.  Nodes are numbered
+ *  from 0 in the order found, node_ids maps them back to the system's node
+ *  numbers.
+ */
+typedef struct {
+    int *cpus;                          /**< Usable CPUs, grouped by node.    */
+    int cpu_count;                      /**< Number of usable CPUs.           */
+    int node_ids[TOPOLOGY_MAX_NODES];   /**< System number of each node.      */
+    int node_first[TOPOLOGY_MAX_NODES]; /**< Index in cpus of each node's
+                                         *   first CPU.
+                                         */
+    int node_cpus[TOPOLOGY_MAX_NODES];  /**< Number of CPUs in each node.     */
+    int node_count;                     /**< Number of nodes with usable
+                                         *   CPUs.
+                                         */
+} topology;
+
+int topology_init(topology *topo, cpu_set_t *allowed);
+void topology_destroy(topology *topo);
+void topology_place(topology *topo, int worker, int spread, int *cpu,
+                    int *node);
+int topology_bind(void *addr, size_t len, int node_id);
+
+/** @} */
+
+#endif      /* TOPOLOGY_H */
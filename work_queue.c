@@ -0,0 +1,410 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "work_queue.h"
+
+/** @defgroup work_queue work_queue
+ *
+ *  A set of thread safe FIFO queues with work stealing.
+ *
+ *  A work queue splits its blocks over a number of lanes, each lane is a
+ *  lock-free queue.  The producer fills the lanes round robin.  A consumer
+ *  pops from its own lane, so it mostly touches blocks nobody else is
+ *  touching, and only steals from the other lanes when its own is empty.  With
+ *  a single lane it behaves like a plain shared queue.
+ */
+
+/** Private method that tries each lane in turn for free space.
+ *
+ *  @param[in] wq   The work queue.
+ *  @param[in] lane The lane to try first, -1 for the next lane in line.
+ *  @param[in] in   The data to push.
+ *  @param[in] size The size of the data value.
+ *
+ *  @return         Returns 0 on success, otherwise an error code.
+ */
+static int work_queue_do_push(work_queue *wq, int lane, void *in,
+                              size_t size) {
+    int i;
+    int retval = QUEUE_E_FULL;
+
+    if (work_queue_get_state(wq) != QUEUE_STATE_ACTIVE) {
+        return QUEUE_E_STOPPED;
+    }
+
+    /* Start with the given lane, or the next lane in line */
+    if (lane < 0) {
+        lane = __atomic_fetch_add(&(wq->next_lane), 1, __ATOMIC_RELAXED)
+               % wq->lane_count;
+    } else {
+        lane %= wq->lane_count;
+    }
+    for (i = 0; i < wq->lane_count; i++) {
+        retval = queue_try_push(&(wq->lanes[lane]), in, size);
+        if (retval != QUEUE_E_FULL) {
+            break;
+        }
+        lane = (lane + 1) % wq->lane_count;
+    }
+
+    return retval;
+}
+
+/** Private method that pops from a lane, stealing from the others if needed.
+ *
+ *  @param[in]  wq   The work queue.
+ *  @param[in]  lane The consumer's own lane.
+ *  @param[out] out  The data to return.
+ *  @param[out] size The size of the data value.
+ *
+ *  @return          Returns 0 on success, QUEUE_E_EMPTY if every lane is
+ *                   empty or QUEUE_E_STOPPED if the work queue is stopped.
+ */
+static int work_queue_do_pop(work_queue *wq, int lane, void **out,
+                             size_t *size) {
+    queue_state expected = QUEUE_STATE_STOPPING;
+    queue_state state;
+    int i;
+
+    /* An aborted work queue hands nothing more out, look before the lanes
+       so a block pushed to a lane already passed is never left behind when
+       the queue stops during the search */
+    state = work_queue_get_state(wq);
+    if (state == QUEUE_STATE_STOPPED) {
+        return QUEUE_E_STOPPED;
+    }
+
+    /* Own lane first, then steal */
+    lane %= wq->lane_count;
+    for (i = 0; i < wq->lane_count; i++) {
+        if (queue_try_pop(&(wq->lanes[lane]), out, size) == 0) {
+            return 0;
+        }
+        lane = (lane + 1) % wq->lane_count;
+    }
+
+    /* Every lane is empty, finish stopping if we were already stopping */
+    if (state != QUEUE_STATE_ACTIVE) {
+        __atomic_compare_exchange_n(&(wq->state), &expected,
+                                    QUEUE_STATE_STOPPED, 0, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_SEQ_CST);
+        return QUEUE_E_STOPPED;
+    }
+
+    return QUEUE_E_EMPTY;
+}
+
+/** Initializes a work queue.
+ *  Clears a new work queue, creates its lanes, makes it active, and sets up
+ *  its events.
+ *
+ *  @param[in] wq       The work queue to initialize.
+ *  @param[in] lanes    The number of lanes, usually 1 or one per consumer.
+ *  @param[in] size     The total number of data pointers the work queue can
+ *                      hold, 0 for QUEUE_SIZE.  Split evenly over the lanes.
+ *
+ *  @return             Returns 0 on success, otherwise an error code.
+ */
+int work_queue_init(work_queue *wq, int lanes, size_t size) {
+    size_t lane_size;
+    int i;
+
+    /* Clear the structure */
+    memset(wq, 0, sizeof(work_queue));
+
+    /* Set defaults */
+    if (lanes < 1) {
+        lanes = 1;
+    }
+    if (size == 0) {
+        size = QUEUE_SIZE;
+    }
+    lane_size = (size + lanes - 1) / lanes;
+    if (lanes > 1 && lane_size < WORK_QUEUE_MIN_LANE_SIZE) {
+        lane_size = WORK_QUEUE_MIN_LANE_SIZE;
+    }
+    wq->lane_count = lanes;
+    wq->state = QUEUE_STATE_ACTIVE;
+
+    /* Create the lanes */
+    if (posix_memalign((void **)&(wq->lanes), CACHE_LINE_SIZE,
+                       sizeof(queue) * lanes) != 0) {
+        return QUEUE_E_SYSTEM;
+    }
+    for (i = 0; i < lanes; i++) {
+        if (queue_init(&(wq->lanes[i]), lane_size) != 0) {
+            while (i-- > 0) {
+                queue_stop(&(wq->lanes[i]));
+                queue_destroy(&(wq->lanes[i]));
+            }
+            free(wq->lanes);
+            return QUEUE_E_SYSTEM;
+        }
+    }
+
+    /* Initialize events */
+    event_init(&(wq->not_full));
+    event_init(&(wq->not_empty));
+
+    return 0;
+}
+
+
+/** Destroys a work queue structure.
+ *  Destroys every lane.  The work queue must be stopped and empty.
+ *
+ *  @param[in] wq The work queue to destroy.
+ */
+void work_queue_destroy(work_queue *wq) {
+    int i;
+
+    /* Destroy the lanes */
+    for (i = 0; i < wq->lane_count; i++) {
+        queue_destroy(&(wq->lanes[i]));
+    }
+    free(wq->lanes);
+
+    /* Clear the structure */
+    memset(wq, 0, sizeof(work_queue));
+
+    /* Set defaults */
+    wq->state = QUEUE_STATE_STOPPED;
+}
+
+
+/** Add data to the work queue.
+ *  Adds the data pointer and size of the data to the next lane with free
+ *  space, sleeping for up to wait_sec seconds while every lane is full.
+ *
+ *  @param[in] wq       The work queue to add to.
+ *  @param[in] in       The data to push onto the work queue.
+ *  @param[in] size     The size of the data value.
+ *  @param[in] wait_sec Seconds to wait for free space, 0 to not wait or
+ *                      QUEUE_WAIT_FOREVER to wait until there is free space or
+ *                      the work queue is stopped.
+ *
+ *  @return             Returns 0 on success, QUEUE_E_FULL if every lane
+ *                      stayed full or QUEUE_E_STOPPED if the work queue is not
+ *                      active.
+ */
+int work_queue_push(work_queue *wq, void *in, size_t size, int wait_sec) {
+    return work_queue_push_lane(wq, -1, in, size, wait_sec);
+}
+
+
+/** Add data to a lane of the work queue.
+ *  Adds the data pointer and size of the data to the given lane, or the next
+ *  lane with free space if it is full, sleeping for up to wait_sec seconds
+ *  while every lane is full.
+ *
+ *  @param[in] wq       The work queue to add to.
+ *  @param[in] lane     The lane to add to, -1 for the next lane in line.
+ *  @param[in] in       The data to push onto the work queue.
+ *  @param[in] size     The size of the data value.
+ *  @param[in] wait_sec Seconds to wait for free space, 0 to not wait or
+ *                      QUEUE_WAIT_FOREVER to wait until there is free space or
+ *                      the work queue is stopped.
+ *
+ *  @return             Returns 0 on success, QUEUE_E_FULL if every lane
+ *                      stayed full or QUEUE_E_STOPPED if the work queue is not
+ *                      active.
+ */
+int work_queue_push_lane(work_queue *wq, int lane, void *in, size_t size,
+                         int wait_sec) {
+    uint32_t key;
+    int retval;
+
+    while ((retval = work_queue_do_push(wq, lane, in, size)) == QUEUE_E_FULL &&
+           wait_sec != 0) {
+        /* Wait for a lane to have free space */
+        key = event_prepare(&(wq->not_full));
+        retval = work_queue_do_push(wq, lane, in, size);
+        if (retval != QUEUE_E_FULL) {
+            event_cancel(&(wq->not_full));
+            break;
+        }
+        if (event_wait(&(wq->not_full), key, wait_sec) == ETIMEDOUT) {
+            retval = work_queue_do_push(wq, lane, in, size);
+            break;
+        }
+    }
+
+    if (retval == 0) {
+        /* It is not empty anymore */
+        event_signal(&(wq->not_empty));
+    }
+
+    return retval;
+}
+
+
+/** Try to remove data from the work queue.
+ *  Removes the next data pointer and size of the data from the given lane, or
+ *  any other lane if it is empty, without blocking.  Data is still returned
+ *  from a stopping or stopped work queue so that it can be drained.
+ *
+ *  @param[in]  wq   The work queue to remove from.
+ *  @param[in]  lane The lane to try first.
+ *  @param[out] out  The data to return.
+ *  @param[out] size The size of the data value.
+ *
+ *  @return          Returns 0 on success, otherwise QUEUE_E_EMPTY.
+ */
+int work_queue_try_pop(work_queue *wq, int lane, void **out, size_t *size) {
+    int i;
+
+    lane %= wq->lane_count;
+    for (i = 0; i < wq->lane_count; i++) {
+        if (queue_try_pop(&(wq->lanes[lane]), out, size) == 0) {
+            /* It is not full anymore */
+            event_signal(&(wq->not_full));
+            return 0;
+        }
+        lane = (lane + 1) % wq->lane_count;
+    }
+
+    return QUEUE_E_EMPTY;
+}
+
+
+/** Remove data from the work queue.
+ *  Removes the next data pointer and size of the data from the consumer's own
+ *  lane, stealing from the other lanes when it is empty, and sleeping for up
+ *  to wait_sec seconds while every lane is empty.
+ *
+ *  @param[in]  wq       The work queue to remove from.
+ *  @param[in]  lane     The consumer's own lane.
+ *  @param[out] out      The data to return.
+ *  @param[out] size     The size of the data value.
+ *  @param[in]  wait_sec Seconds to wait for data, 0 to not wait or
+ *                       QUEUE_WAIT_FOREVER to wait until there is data or the
+ *                       work queue is stopped.
+ *
+ *  @return              Returns 0 on success, QUEUE_E_EMPTY if every lane
+ *                       stayed empty or QUEUE_E_STOPPED if the work queue is
+ *                       stopped.
+ */
+int work_queue_pop(work_queue *wq, int lane, void **out, size_t *size,
+                   int wait_sec) {
+    uint32_t key;
+    int retval;
+
+    while ((retval = work_queue_do_pop(wq, lane, out, size)) == QUEUE_E_EMPTY
+           && wait_sec != 0) {
+        /* Wait for a lane to have something */
+        key = event_prepare(&(wq->not_empty));
+        retval = work_queue_do_pop(wq, lane, out, size);
+        if (retval != QUEUE_E_EMPTY) {
+            event_cancel(&(wq->not_empty));
+            break;
+        }
+        if (event_wait(&(wq->not_empty), key, wait_sec) == ETIMEDOUT) {
+            retval = work_queue_do_pop(wq, lane, out, size);
+            break;
+        }
+    }
+
+    if (retval == 0) {
+        /* It is not full anymore */
+        event_signal(&(wq->not_full));
+    } else if (retval == QUEUE_E_STOPPED) {
+        /* Make sure every other consumer notices too */
+        event_broadcast(&(wq->not_empty));
+    }
+
+    return retval;
+}
+
+
+/** Count the data in the work queue.
+ *  The result is only a snapshot when other threads are using the queue.
+ *
+ *  @param[in] wq The work queue to check.
+ *
+ *  @return       Returns the number of data pointers in all of the lanes.
+ */
+size_t work_queue_count(work_queue *wq) {
+    size_t count = 0;
+    int i;
+
+    for (i = 0; i < wq->lane_count; i++) {
+        count += queue_count(&(wq->lanes[i]));
+    }
+
+    return count;
+}
+
+
+/** Get the state of the work queue.
+ *
+ *  @param[in] wq The work queue to check.
+ *
+ *  @return       Returns the current work queue state.
+ */
+queue_state work_queue_get_state(work_queue *wq) {
+    return __atomic_load_n(&(wq->state), __ATOMIC_ACQUIRE);
+}
+
+
+/** Stop the work queue.
+ *  Stops an active work queue and all of its lanes, this prevents new data
+ *  from being added and wakes any blocked threads.  Data already in the lanes
+ *  can still be removed.
+ *
+ *  @param[in] wq The work queue to stop.
+ */
+void work_queue_stop(work_queue *wq) {
+    queue_state expected = QUEUE_STATE_ACTIVE;
+    int i;
+
+    /* Change state, unless the work queue is already stopping or stopped */
+    __atomic_compare_exchange_n(&(wq->state), &expected, QUEUE_STATE_STOPPING,
+                                0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    for (i = 0; i < wq->lane_count; i++) {
+        queue_stop(&(wq->lanes[i]));
+    }
+
+    /* Wake everyone up so they notice */
+    event_broadcast(&(wq->not_full));
+    event_broadcast(&(wq->not_empty));
+}
+
+
+/** Abort the work queue.
+ *  Stops the work queue right away.  Producers and consumers are woken up and
+ *  nothing more is handed out, data left in the lanes can only be drained with
+ *  work_queue_try_pop.
+ *
+ *  @param[in] wq The work queue to abort.
+ */
+void work_queue_abort(work_queue *wq) {
+    int i;
+
+    /* Stop the lanes from taking anything new */
+    __atomic_store_n(&(wq->state), QUEUE_STATE_STOPPED, __ATOMIC_SEQ_CST);
+    for (i = 0; i < wq->lane_count; i++) {
+        queue_stop(&(wq->lanes[i]));
+    }
+
+    /* Wake everyone up so they notice */
+    event_broadcast(&(wq->not_full));
+    event_broadcast(&(wq->not_empty));
+}
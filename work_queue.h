@@ -0,0 +1,64 @@
+/*
+ * libattkthread - A threaded attack library template.
+ *
+ * Copyright (c) 2008-2013, Adam Bregenzer <adam@bregenzer.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See COPYING for more
+ * details.
+ *
+ * libattkthread is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+
+#include "event.h"
+#include "queue.h"
+
+/** @addtogroup work_queue
+ *  @{
+ */
+
+#define WORK_QUEUE_MIN_LANE_SIZE 2  /**< Minimum number of blocks per lane. */
+
+/** A work queue structure.
+ *  A set of lane queues, the producer fills the lanes round robin and each
+ *  consumer pops from its own lane before stealing from the others.
+ */
+typedef struct {
+    uint64_t next_lane
+        __attribute__ ((aligned (CACHE_LINE_SIZE))); /**< Next lane to fill. */
+    queue *lanes
+        __attribute__ ((aligned (CACHE_LINE_SIZE))); /**< The lane queues.    */
+    int lane_count;             /**< Number of lanes.                         */
+    queue_state state;          /**< The current state of the work queue.     */
+    event not_full;             /**< Event for a lane being not full.         */
+    event not_empty;            /**< Event for a lane being not empty.        */
+} work_queue;
+
+int work_queue_init(work_queue *wq, int lanes, size_t size);
+void work_queue_destroy(work_queue *wq);
+int work_queue_push(work_queue *wq, void *in, size_t size, int wait_sec);
+int work_queue_push_lane(work_queue *wq, int lane, void *in, size_t size,
+                         int wait_sec);
+int work_queue_try_pop(work_queue *wq, int lane, void **out, size_t *size);
+int work_queue_pop(work_queue *wq, int lane, void **out, size_t *size,
+                   int wait_sec);
+size_t work_queue_count(work_queue *wq);
+queue_state work_queue_get_state(work_queue *wq);
+void work_queue_stop(work_queue *wq);
+void work_queue_abort(work_queue *wq);
+
+/** @} */
+
+#endif      /* WORK_QUEUE_H */
@@ -34,7 +34,8 @@
  *  Write a set of records to a file.
  *
  *  Write file implements the file interface for libattkthread.  Opens a file
- *  and write blocks of records to it.
+ *  and write blocks of records to it.  Setting FILE_PACKED in the file's
+ *  flags after it is initialized writes packed blocks, see read_file.
  */
 
 /** Initializes a write file structure.
@@ -109,7 +110,7 @@ int write_open_file(file_st *file) {
 
     /* Check if the file already exists */
     retval = stat(file->file_path, &file_stat);
-    if (errno == ENOENT) {
+    if (retval != 0 && errno == ENOENT) {
         errno = 0;
         /* File does not exist, open the file */
         fp = open(file->file_path, O_WRONLY|O_CREAT|O_TRUNC|O_LARGEFILE,
@@ -124,11 +125,14 @@ int write_open_file(file_st *file) {
         memcpy(header.description, write_file_st->description, 255);
         header.file_order = htonl(write_file_st->file_order);
         header.record_size = htons(file->record_size);
+        if (file->flags & FILE_PACKED) {
+            header.revision = htons(READ_FILE_REVISION_PACKED);
+        }
         write(fp, &header.magic, sizeof(header.magic));
         write(fp, &header.description, sizeof(header.description));
         write(fp, &header.file_order, sizeof(header.file_order));
         write(fp, &header.record_size, sizeof(header.record_size));
-        write(fp, &header.reserved, sizeof(header.reserved));
+        write(fp, &header.revision, sizeof(header.revision));
     } else {
         /* File already exists, open the file */
         fp = open(file->file_path, O_RDWR|O_LARGEFILE);
@@ -142,10 +146,11 @@ int write_open_file(file_st *file) {
         read(fp, &header.description, sizeof(header.description));
         read(fp, &header.file_order, sizeof(header.file_order));
         read(fp, &header.record_size, sizeof(header.record_size));
-        read(fp, &header.reserved, sizeof(header.reserved));
+        read(fp, &header.revision, sizeof(header.revision));
         header.magic = ntohl(header.magic);
         header.file_order = ntohl(header.file_order);
         header.record_size = ntohs(header.record_size);
+        header.revision = ntohs(header.revision);
 
         if (file->record_size <= header.record_size) {
             file->record_size = header.record_size;
@@ -157,6 +162,10 @@ int write_open_file(file_st *file) {
         if (header.file_order != write_file_st->file_order) {
             return E_ATTK_FILE_INVALID;
         }
+        if (header.revision != ((file->flags & FILE_PACKED) ?
+                                READ_FILE_REVISION_PACKED : 0)) {
+            return E_ATTK_FILE_INVALID;
+        }
         if (header.record_size < file->record_size) {
             return E_ATTK_RECORD_SIZE_INVALID;
         }
@@ -177,30 +186,23 @@ int write_open_file(file_st *file) {
     return 0;
 }
 
-/** Write a block to the file.
- *  Writes out the passed block of data.
+/** Private method that writes out a whole buffer.
  *
- *  @param[in]  file        The file structure.
- *  @param[out] buf         The block to write.
- *  @param[in]  buf_size    The size of the block.
+ *  @param[in]  fp          The file pointer.
+ *  @param[in]  buf_p       The buffer.
+ *  @param[in]  buf_size    The size of the buffer.
  *
  *  @return                 Returns the number of bytes written, otherwise an
  *                          error code.
  */
-ssize_t write_next_block(file_st *file, char **buf, size_t buf_size) {
-    write_file_data_st *write_file_st = file->file_data;
+static ssize_t write_buffer(int fp, char *buf_p, size_t buf_size) {
     int retval;
-    char *buf_p = *buf;
     size_t written = 0;
     size_t counter = 0;
 
-    /* Sanity check */
-    assert(write_file_st->fp > 0);
-
-    /* Write record block */
     while (written < buf_size) {
         /* Write out the buffer */
-        retval = write(write_file_st->fp, buf_p, buf_size - written);
+        retval = write(fp, buf_p, buf_size - written);
         if (retval >= 0) {
             written += retval;
             buf_p += retval;
@@ -219,6 +221,75 @@ ssize_t write_next_block(file_st *file, char **buf, size_t buf_size) {
     return written;
 }
 
+/** Private method that writes a packed block to the file.
+ *  Writes the count and offsets in network order, then the records, leaving
+ *  out any space between the block's header and its first record.
+ *
+ *  @param[in]  fp      The file pointer.
+ *  @param[in]  block   The packed block.
+ *
+ *  @return             Returns the number of bytes written, otherwise an
+ *                      error code.
+ */
+static ssize_t write_packed(int fp, char *block) {
+    uint32_t count = ATTK_PACKED_COUNT(block);
+    uint32_t *offsets = ATTK_PACKED_OFFSETS(block);
+    uint32_t *header;
+    ssize_t head_retval;
+    ssize_t retval;
+    uint32_t i;
+
+    /* Build the header, with the offsets moved up to just after it */
+    header = malloc(ATTK_PACKED_HEADER(count));
+    if (header == NULL) {
+        return E_ATTK_SYSTEM;
+    }
+    header[0] = htonl(count);
+    for (i = 0; i <= count; i++) {
+        header[i + 1] = htonl(offsets[i] - offsets[0] +
+                              ATTK_PACKED_HEADER(count));
+    }
+
+    /* Write the header, then the records */
+    head_retval = write_buffer(fp, (char *)header, ATTK_PACKED_HEADER(count));
+    free(header);
+    if (head_retval < 0) {
+        return head_retval;
+    }
+    retval = write_buffer(fp, block + offsets[0], offsets[count] - offsets[0]);
+    if (retval < 0) {
+        return retval;
+    }
+
+    return head_retval + retval;
+}
+
+/** Write a block to the file.
+ *  Writes out the passed block of data.
+ *
+ *  @param[in]  file        The file structure.
+ *  @param[out] buf         The block to write.
+ *  @param[in]  buf_size    The size of the block.
+ *
+ *  @return                 Returns the number of bytes written, otherwise an
+ *                          error code.
+ */
+ssize_t write_next_block(file_st *file, char **buf, size_t buf_size) {
+    write_file_data_st *write_file_st = file->file_data;
+
+    /* Sanity check */
+    assert(write_file_st->fp > 0);
+
+    /* Write record block */
+    if (file->flags & FILE_PACKED) {
+        if (buf_size == 0) {
+            return 0;
+        }
+        return write_packed(write_file_st->fp, *buf);
+    }
+    return write_buffer(write_file_st->fp, *buf, buf_size);
+}
+
 /** Placeholder for free_block, always returns an error.
  *  Always returns an error!
  *